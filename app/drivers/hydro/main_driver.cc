@@ -53,8 +53,9 @@ void
 set_derived_params() {
   using namespace param;
 
-  // set kernel
+  // set kernel and the SPH passes instantiated for it
   kernels::select();
+  physics::select();
 
   // set viscosity
   viscosity::select(sph_viscosity);
@@ -92,6 +93,10 @@ mpi_init_task(const char * parameter_file) {
 
   // read input file and initialize equation of state
   body_system<double, gdimension> bs;
+  // the smoothing length solve searches the neighbors of the density pass
+  // once, in a padded radius
+  const double h_padding =
+    physics::smoothinglength_solved() ? sph_h_search_padding : 1.;
   bs.read_bodies(initial_data_prefix, output_h5data_prefix, initial_iteration);
 
   MPI_Barrier(MPI_COMM_WORLD);
@@ -100,6 +105,8 @@ mpi_init_task(const char * parameter_file) {
     analysis::screen_output(rank);
     MPI_Barrier(MPI_COMM_WORLD);
 
+    // the leapfrog step ends with the fused kick, checks and timestep sweep
+    bool leapfrog_step = false;
     if(physics::iteration == param::initial_iteration) {
 
       log_one(trace) << "First iteration" << std::endl << std::flush;
@@ -113,7 +120,10 @@ mpi_init_task(const char * parameter_file) {
 
       log_one(trace) << "compute density pressure cs" << std::endl
                      << std::flush;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      bs.apply_in_smoothinglength_padded(
+        h_padding, physics::compute_density_pressure_soundspeed);
+      if(physics::smoothinglength_solved())
+        bs.apply_all(physics::update_smoothinglength_solved);
       bs.apply_all(integration::save_velocityhalf);
 
       // necessary for computing dv/dt and du/dt in the next step
@@ -121,17 +131,15 @@ mpi_init_task(const char * parameter_file) {
 
       log_one(trace) << "compute rhs of evolution equations" << std::endl
                      << std::flush;
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
-      if(evolve_internal_energy) {
-        if(thermokinetic_formulation) {
-          log_one(trace) << "compute dedt" << std::endl;
-          bs.apply_in_smoothinglength(physics::compute_dedt);
-        }
-        else {
-          log_one(trace) << "compute dudt" << std::endl;
-          bs.apply_in_smoothinglength(physics::compute_dudt);
-        }
-      }
+      // velocities equal the half-step velocities: one pass for both
+      if(evolve_internal_energy)
+        bs.apply_in_smoothinglength(physics::compute_acceleration_energy);
+      else if(sph_half_pairs)
+        bs.apply_in_smoothinglength_pairs(
+          physics::reset_acceleration, physics::compute_acceleration_pairs);
+      else
+        bs.apply_in_smoothinglength(physics::compute_acceleration);
+      bs.get_all(external_force::add_acceleration);
       log_one(trace) << ".done" << std::endl;
 
       if(physics::iteration < relaxation_steps) {
@@ -143,67 +151,153 @@ mpi_init_task(const char * parameter_file) {
         log_one(trace) << ".done" << std::endl;
       }
     }
-    else {
-      log_one(trace) << "leapfrog: kick one" << std::endl << std::flush;
-      bs.apply_all(integration::leapfrog_kick_v);
+    else if(block_timesteps) {
+      using namespace integration;
+      log_one(trace) << "block leapfrog: kick one" << std::endl << std::flush;
+      bs.apply_all_if(block_starts, block_kick_v);
       if(evolve_internal_energy) {
         if(thermokinetic_formulation)
-          bs.apply_all(integration::leapfrog_kick_e);
+          bs.apply_all_if(block_starts, block_kick_e);
         else
-          bs.apply_all(integration::leapfrog_kick_u);
+          bs.apply_all_if(block_starts, block_kick_u);
       }
-      bs.apply_all(integration::save_velocityhalf);
+      bs.apply_all_if(block_starts, save_velocityhalf);
       log_one(trace) << ".done" << std::endl;
 
+      // all the particles move, the inactive ones at their half-step
+      // velocity
       log_one(trace) << "leapfrog: drift" << std::endl << std::flush;
-      bs.apply_all(integration::leapfrog_drift);
+      bs.apply_all(leapfrog_drift);
+      log_one(trace) << ".done" << std::endl;
+
+      bs.update_iteration();
+      log_one(trace) << "compute density pressure cs" << std::flush
+                     << std::endl;
+      bs.apply_in_smoothinglength_padded(
+        h_padding, physics::compute_density_pressure_soundspeed);
+      if(physics::smoothinglength_solved())
+        bs.apply_all(physics::update_smoothinglength_solved);
+      if(physics::eos_deferred())
+        bs.get_all(physics::compute_eos_batched);
+      // neighbor limiter, before the ghosts take the shortened steps
+      bs.apply_all(block_wake);
+      bs.reset_ghosts();
+
+      log_one(trace) << "block leapfrog: kick two (velocity)" << std::flush
+                     << std::endl;
+      if(sph_fused_rhs and evolve_internal_energy)
+        bs.apply_in_smoothinglength_if(
+          block_ends, physics::compute_acceleration_energy);
+      else
+        bs.apply_in_smoothinglength_if(
+          block_ends, physics::compute_acceleration);
+      bs.apply_all_if(block_ends, physics::add_external_acceleration);
+      if(physics::iteration < relaxation_steps) {
+        bs.apply_all_if(block_ends, physics::add_drag_acceleration);
+        bs.apply_in_smoothinglength_if(
+          block_ends, physics::add_short_range_repulsion);
+      }
+      bs.apply_all_if(block_ends, block_kick_v);
+      log_one(trace) << ".done" << std::endl;
+
+      // sync velocities
+      if(not sph_fused_rhs)
+        bs.reset_ghosts();
+
+      if(evolve_internal_energy) {
+        log_one(trace) << "block leapfrog: kick two (energy)" << std::flush
+                       << std::endl;
+        if(thermokinetic_formulation) {
+          if(not sph_fused_rhs)
+            bs.apply_in_smoothinglength_if(block_ends, physics::compute_dedt);
+          if(physics::iteration < relaxation_steps)
+            bs.apply_all_if(block_ends, physics::add_drag_dedt);
+          bs.apply_all_if(block_ends, block_kick_e);
+        }
+        else {
+          if(not sph_fused_rhs)
+            bs.apply_in_smoothinglength_if(block_ends, physics::compute_dudt);
+          bs.apply_all_if(block_ends, block_kick_u);
+        }
+        log_one(trace) << ".done" << std::endl;
+      }
+    }
+    else {
+      leapfrog_step = true;
+      log_one(trace) << "leapfrog: kick one and drift" << std::endl
+                     << std::flush;
+      bs.apply_all_parallel(integration::leapfrog_kick_drift);
       log_one(trace) << ".done" << std::endl;
 
       // sync velocities
       bs.update_iteration();
       log_one(trace) << "compute density pressure cs" << std::flush
                      << std::endl;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      bs.apply_in_smoothinglength_padded(
+        h_padding, physics::compute_density_pressure_soundspeed);
+      if(physics::smoothinglength_solved())
+        bs.apply_all(physics::update_smoothinglength_solved);
+      if(physics::eos_deferred())
+        bs.get_all(physics::compute_eos_batched);
 
       // Sync density/pressure/cs
       bs.reset_ghosts();
 
       log_one(trace) << "leapfrog: kick two (velocity)" << std::flush
                      << std::endl;
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      if(sph_fused_rhs and evolve_internal_energy)
+        bs.apply_in_smoothinglength(physics::compute_acceleration_energy);
+      else if(sph_half_pairs)
+        bs.apply_in_smoothinglength_pairs(
+          physics::reset_acceleration, physics::compute_acceleration_pairs);
+      else
+        bs.apply_in_smoothinglength(physics::compute_acceleration);
+      bs.get_all(external_force::add_acceleration);
       if(physics::iteration < relaxation_steps) {
         bs.apply_all(physics::add_drag_acceleration);
         bs.apply_in_smoothinglength(physics::add_short_range_repulsion);
       }
-      bs.apply_all(integration::leapfrog_kick_v);
+      // without energy equation, the velocity kick ends the step
+      if(evolve_internal_energy)
+        bs.apply_all(integration::leapfrog_kick_v);
       log_one(trace) << ".done" << std::endl;
 
       // sync velocities
-      bs.reset_ghosts();
+      if(not sph_fused_rhs)
+        bs.reset_ghosts();
 
       if(evolve_internal_energy) {
-        log_one(trace) << "leapfrog: kick two (energy)" << std::flush
-                       << std::endl;
+        log_one(trace) << "leapfrog: energy rhs" << std::flush << std::endl;
         if(thermokinetic_formulation) {
           log_one(trace) << "compute dedt" << std::flush;
-          bs.apply_in_smoothinglength(physics::compute_dedt);
+          if(not sph_fused_rhs and sph_half_pairs)
+            bs.apply_in_smoothinglength_pairs(
+              physics::reset_dedt, physics::compute_dedt_pairs);
+          else if(not sph_fused_rhs)
+            bs.apply_in_smoothinglength(physics::compute_dedt);
           if(physics::iteration < relaxation_steps)
             bs.apply_all(physics::add_drag_dedt);
-          bs.apply_all(integration::leapfrog_kick_e);
         }
         else {
           log_one(trace) << "compute dudt" << std::endl << std::flush;
-          bs.apply_in_smoothinglength(physics::compute_dudt);
-          bs.apply_all(integration::leapfrog_kick_u);
+          if(not sph_fused_rhs and sph_half_pairs)
+            bs.apply_in_smoothinglength_pairs(
+              physics::reset_dudt, physics::compute_dudt_pairs);
+          else if(not sph_fused_rhs)
+            bs.apply_in_smoothinglength(physics::compute_dudt);
         }
         log_one(trace) << ".done" << std::endl;
       }
     }
 
     if(sph_variable_h) {
-      log_one(trace) << "updating smoothing length" << std::endl << std::flush;
-      bs.get_all(physics::compute_smoothinglength);
-      log_one(trace) << ".done" << std::endl << std::flush;
+      // otherwise solved with the density
+      if(sph_h_iterations == 0) {
+        log_one(trace) << "updating smoothing length" << std::endl
+                       << std::flush;
+        bs.get_all(physics::compute_smoothinglength);
+        log_one(trace) << ".done" << std::endl << std::flush;
+      }
     }
     else if(sph_update_uniform_h) {
       // The particles moved, compute new smoothing length
@@ -212,19 +306,37 @@ mpi_init_task(const char * parameter_file) {
       log_one(trace) << ".done" << std::endl << std::flush;
     }
 
+    if(leapfrog_step) {
+      log_one(trace) << "leapfrog: kick two, checks and timestep" << std::endl
+                     << std::flush;
+      bs.apply_all_parallel(integration::leapfrog_kick_check_dt);
+      log_one(trace) << ".done" << std::endl;
+    }
+
     // Periodic output
     analysis::scalar_output(bs, rank);
     analysis::h5data_output(bs, rank);
     diagnostic::output(bs, rank);
 
     // Check for nans
-    bs.apply_all(physics::check_nans);
-    bs.apply_all(physics::check_negativity);
+    if(not leapfrog_step) {
+      bs.apply_all(physics::check_nans);
+      bs.apply_all(physics::check_negativity);
+    }
 
-    if(adaptive_timestep) {
+    if(block_timesteps) {
+      // New rungs of the particles at the end of their step, next substep
+      log_one(trace) << "compute block timesteps" << std::endl << std::flush;
+      bs.apply_all_if(integration::block_ends, physics::compute_dt);
+      bs.apply_all_if(integration::block_ends, integration::block_set_rung);
+      bs.get_all(integration::block_advance);
+      log_one(trace) << ".done" << std::endl;
+    }
+    else if(adaptive_timestep) {
       // Update timestep
       log_one(trace) << "compute adaptive timestep" << std::endl << std::flush;
-      bs.apply_all(physics::compute_dt);
+      if(not leapfrog_step)
+        bs.apply_all(physics::compute_dt);
       bs.get_all(physics::set_adaptive_timestep);
       log_one(trace) << ".done" << std::endl;
     }
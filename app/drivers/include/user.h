@@ -29,8 +29,9 @@
 #define OUTPUT
 #define INTERNAL_ENERGY
 
-// Uncomment the next line to fix sph_kernel at compile time and
-// enable vectorization:
+// The SPH passes are instantiated for every kernel and selected at runtime
+// (physics::select). Uncomment the next line to fix sph_kernel at compile
+// time instead:
 // #define sph_kernel wendland_c4
 
 static const size_t gdimension = EXT_GDIMENSION;
@@ -57,8 +57,9 @@ void
 set_derived_params() {
   using namespace param;
 
-  // set kernel
+  // set kernel and the SPH passes instantiated for it
   kernels::select();
+  physics::select();
 
   // set viscosity
   viscosity::select(sph_viscosity);
@@ -79,6 +80,11 @@ set_derived_params() {
 
   // set external force
   external_force::select(external_force_type);
+
+  // the block timesteps are only integrated by the hydro driver
+  if(block_timesteps)
+    log_fatal("block_timesteps is not supported by the newtonian driver"
+              << std::endl);
 }
 
 namespace flecsi {
@@ -99,6 +105,10 @@ mpi_init_task(const char * parameter_file) {
 
   // read input file and initialize equation of state
   body_system<double, gdimension> bs;
+  // the smoothing length solve searches the neighbors of the density pass
+  // once, in a padded radius
+  const double h_padding =
+    physics::smoothinglength_solved() ? sph_h_search_padding : 1.;
   bs.read_bodies(initial_data_prefix, output_h5data_prefix, initial_iteration);
   bs.setMacangle(param::fmm_macangle);
 
@@ -108,6 +118,8 @@ mpi_init_task(const char * parameter_file) {
     analysis::screen_output(rank);
     MPI_Barrier(MPI_COMM_WORLD);
 
+    // the leapfrog step ends with the fused kick, checks and timestep sweep
+    bool leapfrog_step = false;
     if(physics::iteration == param::initial_iteration) {
 
       log_one(trace) << "First iteration" << std::endl << std::flush;
@@ -121,7 +133,10 @@ mpi_init_task(const char * parameter_file) {
 
       log_one(trace) << "compute density pressure cs" << std::endl
                      << std::flush;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      bs.apply_in_smoothinglength_padded(
+        h_padding, physics::compute_density_pressure_soundspeed);
+      if(physics::smoothinglength_solved())
+        bs.apply_all(physics::update_smoothinglength_solved);
       bs.apply_all(integration::save_velocityhalf);
 
       // necessary for computing dv/dt and du/dt in the next step
@@ -129,82 +144,99 @@ mpi_init_task(const char * parameter_file) {
 
       log_one(trace) << "compute rhs of evolution equations" << std::endl
                      << std::flush;
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      // velocities equal the half-step velocities: one pass for both
+      if(evolve_internal_energy)
+        bs.apply_in_smoothinglength(physics::compute_acceleration_energy);
+      else if(sph_half_pairs)
+        bs.apply_in_smoothinglength_pairs(
+          physics::reset_acceleration, physics::compute_acceleration_pairs);
+      else
+        bs.apply_in_smoothinglength(physics::compute_acceleration);
+      bs.get_all(external_force::add_acceleration);
       if(param::enable_fmm) {
         log_one(trace) << "compute gravitation" << std::endl << std::flush;
-        bs.gravitation_fmm();
-      }
-      if(evolve_internal_energy) {
-        if(thermokinetic_formulation) {
-          log_one(trace) << "compute dedt" << std::flush;
-          bs.apply_in_smoothinglength(physics::compute_dedt);
-        }
-        else {
-          log_one(trace) << "compute dudt" << std::flush;
-          bs.apply_in_smoothinglength(physics::compute_dudt);
-        }
+        bs.gravitation_fmm(physics::totaltime);
       }
+      if(evolve_internal_energy and thermokinetic_formulation)
+        bs.apply_all(physics::add_gravity_dedt);
       log_one(trace) << ".done" << std::endl;
     }
     else {
-      log_one(trace) << "leapfrog: kick one" << std::flush;
-      bs.apply_all(integration::leapfrog_kick_v);
-      if(evolve_internal_energy) {
-        if(thermokinetic_formulation)
-          bs.apply_all(integration::leapfrog_kick_e);
-        else
-          bs.apply_all(integration::leapfrog_kick_u);
-      }
-      bs.apply_all(integration::save_velocityhalf);
-      log_one(trace) << ".done" << std::endl;
-
-      log_one(trace) << "leapfrog: drift" << std::flush;
-      bs.apply_all(integration::leapfrog_drift);
+      leapfrog_step = true;
+      log_one(trace) << "leapfrog: kick one and drift" << std::flush;
+      bs.apply_all_parallel(integration::leapfrog_kick_drift);
       log_one(trace) << ".done" << std::endl;
 
       // sync velocities
       bs.update_iteration();
       log_one(trace) << "compute density pressure cs" << std::flush
                      << std::endl;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      bs.apply_in_smoothinglength_padded(
+        h_padding, physics::compute_density_pressure_soundspeed);
+      if(physics::smoothinglength_solved())
+        bs.apply_all(physics::update_smoothinglength_solved);
+      if(physics::eos_deferred())
+        bs.get_all(physics::compute_eos_batched);
 
       // Sync density/pressure/cs
       bs.reset_ghosts();
 
       log_one(trace) << "leapfrog: kick two (velocity)" << std::flush
                      << std::endl;
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      const bool fused = sph_fused_rhs and evolve_internal_energy;
+      if(fused)
+        bs.apply_in_smoothinglength(physics::compute_acceleration_energy);
+      else if(sph_half_pairs)
+        bs.apply_in_smoothinglength_pairs(
+          physics::reset_acceleration, physics::compute_acceleration_pairs);
+      else
+        bs.apply_in_smoothinglength(physics::compute_acceleration);
+      bs.get_all(external_force::add_acceleration);
       if(param::enable_fmm) {
         log_one(trace) << "compute gravitation" << std::endl << std::flush;
-        bs.gravitation_fmm();
+        // positions drifted to the end of the step
+        bs.gravitation_fmm(physics::totaltime + physics::dt);
       }
-      bs.apply_all(integration::leapfrog_kick_v);
+      if(fused and thermokinetic_formulation)
+        bs.apply_all(physics::add_gravity_dedt);
+      // without energy equation, the velocity kick ends the step
+      if(evolve_internal_energy)
+        bs.apply_all(integration::leapfrog_kick_v);
       log_one(trace) << ".done" << std::endl;
 
       // sync velocities
-      bs.reset_ghosts();
+      if(not sph_fused_rhs)
+        bs.reset_ghosts();
 
       if(evolve_internal_energy) {
-        log_one(trace) << "leapfrog: kick two (energy)" << std::flush
-                       << std::endl;
+        log_one(trace) << "leapfrog: energy rhs" << std::flush << std::endl;
         if(thermokinetic_formulation) {
           log_one(trace) << "compute dedt" << std::flush;
-          bs.apply_in_smoothinglength(physics::compute_dedt);
-          bs.apply_all(integration::leapfrog_kick_e);
+          if(not fused and sph_half_pairs)
+            bs.apply_in_smoothinglength_pairs(
+              physics::reset_dedt, physics::compute_dedt_pairs);
+          else if(not fused)
+            bs.apply_in_smoothinglength(physics::compute_dedt);
         }
         else {
           log_one(trace) << "compute dudt" << std::flush;
-          bs.apply_in_smoothinglength(physics::compute_dudt);
-          bs.apply_all(integration::leapfrog_kick_u);
+          if(not fused and sph_half_pairs)
+            bs.apply_in_smoothinglength_pairs(
+              physics::reset_dudt, physics::compute_dudt_pairs);
+          else if(not fused)
+            bs.apply_in_smoothinglength(physics::compute_dudt);
         }
         log_one(trace) << ".done" << std::endl;
       }
     }
 
     if(sph_variable_h) {
-      log_one(trace) << "updating smoothing length" << std::flush;
-      bs.get_all(physics::compute_smoothinglength);
-      log_one(trace) << ".done" << std::endl << std::flush;
+      // otherwise solved with the density
+      if(sph_h_iterations == 0) {
+        log_one(trace) << "updating smoothing length" << std::flush;
+        bs.get_all(physics::compute_smoothinglength);
+        log_one(trace) << ".done" << std::endl << std::flush;
+      }
     }
     else if(sph_update_uniform_h) {
       // The particles moved, compute new smoothing length
@@ -213,19 +245,28 @@ mpi_init_task(const char * parameter_file) {
       log_one(trace) << ".done" << std::endl << std::flush;
     }
 
+    if(leapfrog_step) {
+      log_one(trace) << "leapfrog: kick two, checks and timestep" << std::flush;
+      bs.apply_all_parallel(integration::leapfrog_kick_check_dt);
+      log_one(trace) << ".done" << std::endl;
+    }
+
     // Periodic output
     analysis::scalar_output(bs, rank);
     analysis::h5data_output(bs, rank);
     diagnostic::output(bs, rank);
 
     // Check for nans
-    bs.apply_all(physics::check_nans);
-    bs.apply_all(physics::check_negativity);
+    if(not leapfrog_step) {
+      bs.apply_all(physics::check_nans);
+      bs.apply_all(physics::check_negativity);
+    }
 
     if(adaptive_timestep) {
       // Update timestep
       log_one(trace) << "compute adaptive timestep" << std::endl << std::flush;
-      bs.apply_all(physics::compute_dt);
+      if(not leapfrog_step)
+        bs.apply_all(physics::compute_dt);
       bs.get_all(physics::set_adaptive_timestep);
       log_one(trace) << ".done" << std::endl;
     }
@@ -27,9 +27,11 @@
 #define _PHYSICS_DIAGNOSTIC_H_
 
 #include "params.h"
+#include "utils.h"
 #include <vector>
 
 namespace diagnostic {
+using namespace mpi_utils;
 
 uint64_t N_min, N_max, N_average;
 uint64_t N_ghosts;
@@ -37,6 +39,8 @@ double h_min, h_max, h_average;
 double min_dist, average_dist_in_h;
 size_t id_N_min, id_N_max, id_h_min, id_h_max;
 double V_min, V_max, V_average;
+double h_iterations_average;
+uint64_t h_iterations_max;
 
 /**
  * @brief      Compute the min, max and average number of neighbor
@@ -106,11 +110,27 @@ compute_velocity_stats(std::vector<body> & bodies, int64_t totalnbodies) {
   V_average = V_tot / totalnbodies;
 }
 
+/**
+ * @brief Average and maximum number of iterations of the smoothing length
+ *        solve since the last output, reset the counters
+ */
+void
+compute_smoothinglength_solve_stats() {
+  uint64_t solves = physics::h_solves, iterations = physics::h_iterations;
+  h_iterations_max = physics::h_iterations_max;
+  reduce_sum(solves);
+  reduce_sum(iterations);
+  reduce_max(h_iterations_max);
+  h_iterations_average = solves > 0 ? double(iterations) / solves : 0.;
+  physics::h_solves = physics::h_iterations = physics::h_iterations_max = 0;
+}
+
 /**
  * @brief Periodic file output
  */
+template<typename BS>
 void
-output(body_system<double, gdimension> & bs, const int rank) {
+output(BS & bs, const int rank) {
   static bool first_time = true;
   if(param::out_diagnostic_every <= 0 ||
      physics::iteration % param::out_diagnostic_every != 0)
@@ -120,6 +140,7 @@ output(body_system<double, gdimension> & bs, const int rank) {
   bs.get_all(compute_neighbors_stats, bs.getNBodies());
   bs.get_all(compute_smoothinglength_stats, bs.getNBodies());
   bs.get_all(compute_velocity_stats, bs.getNBodies());
+  compute_smoothinglength_solve_stats();
 
   // output only from rank #0
   if(rank != 0)
@@ -132,7 +153,8 @@ output(body_system<double, gdimension> & bs, const int rank) {
     oss_header << "# Diagnostic: " << std::endl
                << "# 1:iteration 2:time 3:h_min 4:h_max 5:h_avg "
                << "6:N_min 7:N_max 8:N_avg 9:min_dist 10:avg_dist_h "
-               << "11:V_min 12:V_max 13:V_avg 14:N_ghosts" << std::endl;
+               << "11:V_min 12:V_max 13:V_avg 14:N_ghosts "
+               << "15:h_iter_avg 16:h_iter_max" << std::endl;
 
     std::ofstream out(filename);
     out << oss_header.str();
@@ -149,7 +171,8 @@ output(body_system<double, gdimension> & bs, const int rank) {
            << std::setw(5) << N_average << std::setw(20) << min_dist
            << std::setw(20) << average_dist_in_h << std::setw(20) << V_min
            << std::setw(20) << V_max << std::setw(20) << V_average
-           << std::setw(20) << N_ghosts;
+           << std::setw(20) << N_ghosts << std::setw(20)
+           << h_iterations_average << std::setw(5) << h_iterations_max;
   oss_data << std::endl;
 
   // Open file in append mode
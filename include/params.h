@@ -141,6 +141,7 @@ typedef enum eos_type_keyword_enum{
   eos_polytropic,
   eos_wd,
   eos_ppt,
+  eos_tab,
   eos_no_eos
 } eos_type_keyword;
 
@@ -181,6 +182,23 @@ DECLARE_PARAM(double, timestep_cfl_factor, 0.25)
 DECLARE_PARAM(bool, adaptive_timestep, false)
 #endif
 
+//- hierarchical block timesteps: each particle advances with the step
+//  initial_dt / 2^k closest below its own dt, k < block_timestep_rungs,
+//  and only the particles at the end of their step compute their forces
+#ifndef block_timesteps
+DECLARE_PARAM(bool, block_timesteps, false)
+#endif
+
+#ifndef block_timestep_rungs
+DECLARE_PARAM(int, block_timestep_rungs, 8)
+#endif
+
+//- neighbor limiter of the block timesteps: a particle stays at most this
+//  many rungs below its neighbors, and ends its step early otherwise
+#ifndef block_timestep_rung_gap
+DECLARE_PARAM(int, block_timestep_rung_gap, 2)
+#endif
+
 //
 // Parameters related to particle number and density
 //
@@ -219,6 +237,17 @@ DECLARE_KEYWORD_PARAM(sph_kernel, wendland_c4)
 DECLARE_PARAM(double, sph_sinc_index, 4.0)
 #endif
 
+//- evaluate the kernel and its gradient by interpolation in tables
+#ifndef sph_kernel_tabulated
+DECLARE_PARAM(bool, sph_kernel_tabulated, false)
+#endif
+
+//- compute the SPH interactions with the explicitly vectorized passes of
+//  sph_simd.h (analytic kernels except sinc)
+#ifndef sph_simd_kernels
+DECLARE_PARAM(bool, sph_simd_kernels, false)
+#endif
+
 //- if true, recompute (uniform) smoothing length every timestep
 //  h = average { sph_eta (m/rho)^1/D } (Rosswog'09, eq.51)
 #ifndef sph_update_uniform_h
@@ -231,6 +260,24 @@ DECLARE_PARAM(bool, sph_update_uniform_h, false)
 DECLARE_PARAM(bool, sph_variable_h, false)
 #endif
 
+//- with variable smoothing length: maximum number of Newton-Raphson
+//  iterations solving h and rho together in the density pass
+//  (h = sph_eta (m/rho)^1/D), 0 to update h from rho after the step
+#ifndef sph_h_iterations
+DECLARE_PARAM(int, sph_h_iterations, 0)
+#endif
+
+//- relative tolerance of the smoothing length solve on rho
+#ifndef sph_h_tolerance
+DECLARE_PARAM(double, sph_h_tolerance, 1.e-3)
+#endif
+
+//- factor on the search radius of the smoothing length solve: the solved h
+//  stays below the padded radius, where the neighbor list is complete
+#ifndef sph_h_search_padding
+DECLARE_PARAM(double, sph_h_search_padding, 1.2)
+#endif
+
 //
 // Geometric parameters
 //
@@ -451,16 +498,25 @@ DECLARE_PARAM(double, wvt_radius, 1.0)
 //  * "polytropic"
 //  * "white dwarf"
 //  * "piecewise polytropic"
+//  * "tabulated" (table in eos_tab_file_path)
 #ifndef eos_type
 DECLARE_KEYWORD_PARAM(eos_type, eos_ideal)
 #endif
 
 
-// - file for tabulated EOS
+// - file for tabulated EOS: HDF5 table in the stellar collapse format,
+//   in CGS units (see tools/dummyTabEOS)
 #ifndef eos_tab_file_path
 DECLARE_STRING_PARAM(eos_tab_file_path, ".")
 #endif
 
+//- evaluate the EOS in one sweep over arrays of the local particles after
+//  the density pass, instead of once per particle inside the pass: pays off
+//  for the EOS with transcendental functions (polytropic, ppt, wd)
+#ifndef eos_batched
+DECLARE_PARAM(bool, eos_batched, false)
+#endif
+
 //- polytropic index
 #ifndef poly_gamma
 DECLARE_PARAM(double, poly_gamma, 1.4)
@@ -515,6 +571,91 @@ DECLARE_PARAM(double, fmm_macangle, 0.0)
 DECLARE_PARAM(double, fmm_max_cell_mass, 0.)
 #endif
 
+//- evaluate interactions between locally owned cells only once, updating
+//  both cells (mutual interactions); remote pairs stay one-sided
+#ifndef fmm_mutual_interactions
+DECLARE_PARAM(bool, fmm_mutual_interactions, false)
+#endif
+
+//- reuse the FMM interaction list of the previous iteration (single rank)
+#ifndef fmm_cache_interactions
+DECLARE_PARAM(bool, fmm_cache_interactions, false)
+#endif
+
+//- relative safety margin on the MAC when recording the interaction list
+#ifndef fmm_cache_margin
+DECLARE_PARAM(double, fmm_cache_margin, 0.1)
+#endif
+
+//- rebuild the interaction list from the root every N iterations
+#ifndef fmm_cache_refresh
+DECLARE_PARAM(int32_t, fmm_cache_refresh, 10)
+#endif
+
+//- gravity subcycling: solve the FMM at most every N iterations and
+//  extrapolate the gravitational field of the particles in between
+#ifndef gravity_subcycling
+DECLARE_PARAM(int32_t, gravity_subcycling, 1)
+#endif
+
+//- adaptive subcycling: solve again as soon as a particle moved by more than
+//  this fraction of its smoothing length since the last solve (0: disabled)
+#ifndef gravity_subcycling_displacement
+DECLARE_PARAM(double, gravity_subcycling_displacement, 0.)
+#endif
+
+//- TreePM: long-range gravitation on a mesh, short-range by the FMM walk
+#ifndef enable_treepm
+DECLARE_PARAM(bool, enable_treepm, false)
+#endif
+
+//- number of mesh cells per direction (power of 2)
+#ifndef treepm_mesh_size
+DECLARE_PARAM(int32_t, treepm_mesh_size, 64)
+#endif
+
+//- force split scale, in mesh cells
+#ifndef treepm_split
+DECLARE_PARAM(double, treepm_split, 1.25)
+#endif
+
+//- short-range cutoff of the tree walk, in units of the split scale
+#ifndef treepm_cutoff
+DECLARE_PARAM(double, treepm_cutoff, 4.5)
+#endif
+
+//
+// Tree traversal parameters
+//
+//- maximum number of particles in a group of the SPH traversal
+#ifndef sph_group_size
+DECLARE_PARAM(int, sph_group_size, 128)
+#endif
+
+//- cells with fewer particles are computed directly (p2p) in the FMM
+//  traversal instead of being split further
+#ifndef fmm_p2p_group_size
+DECLARE_PARAM(int, fmm_p2p_group_size, 0)
+#endif
+
+//- time a few group sizes in the first steps and keep the fastest ones
+#ifndef tree_autotune
+DECLARE_PARAM(bool, tree_autotune, false)
+#endif
+
+//- neighbor search of the SPH passes:
+//  "tree": octree walk
+//  "cell_list": uniform grid of cells, for nearly uniform smoothing lengths
+//               on a single rank
+#ifndef sph_neighbor_search
+DECLARE_STRING_PARAM(sph_neighbor_search, "tree")
+#endif
+
+//- the cell list falls back to the tree when h_max / h_min is larger
+#ifndef cell_list_max_h_ratio
+DECLARE_PARAM(double, cell_list_max_h_ratio, 2.0)
+#endif
+
 //
 // Parameters for particle relaxation, used to relax configurations
 // by applying negative drag force against the direction of velocity
@@ -552,6 +693,19 @@ DECLARE_PARAM(double, relaxation_repulsion_gamma, 0.0)
 DECLARE_PARAM(bool, evolve_internal_energy, true)
 #endif
 
+//- compute dv/dt and du/dt (or de/dt) in one neighbor pass at every step,
+//  with the energy equation at the half-step velocities (the first
+//  iteration always uses one pass)
+#ifndef sph_fused_rhs
+DECLARE_PARAM(bool, sph_fused_rhs, false)
+#endif
+
+//- evaluate each pair of local particles once for the acceleration and
+//  du/dt (or de/dt), updating both particles (pairs with ghosts one-sided)
+#ifndef sph_half_pairs
+DECLARE_PARAM(bool, sph_half_pairs, false)
+#endif
+
 //
 // Parameters for external acceleration
 //
@@ -826,6 +980,18 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_BOOLEAN_PARAM(adaptive_timestep)
 #endif
 
+#ifndef block_timesteps
+  READ_BOOLEAN_PARAM(block_timesteps)
+#endif
+
+#ifndef block_timestep_rungs
+  READ_NUMERIC_PARAM(block_timestep_rungs)
+#endif
+
+#ifndef block_timestep_rung_gap
+  READ_NUMERIC_PARAM(block_timestep_rung_gap)
+#endif
+
   // particle number and density --------------------------------------------
 #ifndef nparticles
   READ_NUMERIC_PARAM(nparticles)
@@ -896,6 +1062,14 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_NUMERIC_PARAM(sph_sinc_index)
 #endif
 
+#ifndef sph_kernel_tabulated
+  READ_BOOLEAN_PARAM(sph_kernel_tabulated)
+#endif
+
+#ifndef sph_simd_kernels
+  READ_BOOLEAN_PARAM(sph_simd_kernels)
+#endif
+
 #ifndef sph_update_uniform_h
   READ_BOOLEAN_PARAM(sph_update_uniform_h)
 #endif
@@ -904,6 +1078,18 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_BOOLEAN_PARAM(sph_variable_h)
 #endif
 
+#ifndef sph_h_iterations
+  READ_NUMERIC_PARAM(sph_h_iterations)
+#endif
+
+#ifndef sph_h_tolerance
+  READ_NUMERIC_PARAM(sph_h_tolerance)
+#endif
+
+#ifndef sph_h_search_padding
+  READ_NUMERIC_PARAM(sph_h_search_padding)
+#endif
+
   // geometric configuration  -----------------------------------------------
 #ifndef domain_type
   READ_NUMERIC_PARAM(domain_type)
@@ -1056,6 +1242,9 @@ set_param(const std::string & param_name, const std::string & param_value) {
     else if(boost::iequals(str_value, "ppt"))
       _eos_type = eos_ppt;
 
+    else if(boost::iequals(str_value, "tabulated"))
+      _eos_type = eos_tab;
+
     else if(boost::iequals(str_value, "no_eos"))
       _eos_type = eos_no_eos;
 
@@ -1078,6 +1267,10 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_STRING_PARAM(eos_tab_file_path)
 #endif
 
+#ifndef eos_batched
+  READ_BOOLEAN_PARAM(eos_batched)
+#endif
+
 #ifndef poly_gamma
   READ_NUMERIC_PARAM(poly_gamma)
 #endif
@@ -1116,6 +1309,68 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_NUMERIC_PARAM(fmm_macangle)
 #endif
 
+#ifndef fmm_mutual_interactions
+  READ_BOOLEAN_PARAM(fmm_mutual_interactions)
+#endif
+
+#ifndef fmm_cache_interactions
+  READ_BOOLEAN_PARAM(fmm_cache_interactions)
+#endif
+
+#ifndef fmm_cache_margin
+  READ_NUMERIC_PARAM(fmm_cache_margin)
+#endif
+
+#ifndef fmm_cache_refresh
+  READ_NUMERIC_PARAM(fmm_cache_refresh)
+#endif
+
+#ifndef gravity_subcycling
+  READ_NUMERIC_PARAM(gravity_subcycling)
+#endif
+
+#ifndef gravity_subcycling_displacement
+  READ_NUMERIC_PARAM(gravity_subcycling_displacement)
+#endif
+
+#ifndef enable_treepm
+  READ_BOOLEAN_PARAM(enable_treepm)
+#endif
+
+#ifndef treepm_mesh_size
+  READ_NUMERIC_PARAM(treepm_mesh_size)
+#endif
+
+#ifndef treepm_split
+  READ_NUMERIC_PARAM(treepm_split)
+#endif
+
+#ifndef treepm_cutoff
+  READ_NUMERIC_PARAM(treepm_cutoff)
+#endif
+
+  // tree traversal  --------------------------------------------------------
+
+#ifndef sph_group_size
+  READ_NUMERIC_PARAM(sph_group_size)
+#endif
+
+#ifndef fmm_p2p_group_size
+  READ_NUMERIC_PARAM(fmm_p2p_group_size)
+#endif
+
+#ifndef tree_autotune
+  READ_BOOLEAN_PARAM(tree_autotune)
+#endif
+
+#ifndef sph_neighbor_search
+  READ_STRING_PARAM(sph_neighbor_search)
+#endif
+
+#ifndef cell_list_max_h_ratio
+  READ_NUMERIC_PARAM(cell_list_max_h_ratio)
+#endif
+
   // relaxation parameters  --------------------------------------------------
 #ifndef relaxation_steps
   READ_NUMERIC_PARAM(relaxation_steps)
@@ -1141,6 +1396,14 @@ set_param(const std::string & param_name, const std::string & param_value) {
   READ_BOOLEAN_PARAM(evolve_internal_energy)
 #endif
 
+#ifndef sph_fused_rhs
+  READ_BOOLEAN_PARAM(sph_fused_rhs)
+#endif
+
+#ifndef sph_half_pairs
+  READ_BOOLEAN_PARAM(sph_half_pairs)
+#endif
+
   // external force  --------------------------------------------------------
 #ifndef thermokinetic_formulation
   READ_BOOLEAN_PARAM(thermokinetic_formulation)
@@ -36,8 +36,306 @@ enum particle_type_t : int { NORMAL = 0, WALL = 1 };
 
 enum state_t : int { NONE = 0, STAR1 = 1, STAR2 = 2, POINTP = 3 };
 
+// Optional fields of the particles, selected per driver at compile time
+// (see app/drivers/CMakeLists.txt). A disabled group keeps its accessors:
+// the getters return zero and the setters do nothing.
+//- gravitation: acceleration and potential
+#ifndef FLECSPH_BODY_GRAVITY
+#define FLECSPH_BODY_GRAVITY 1
+#endif
+//- gravity subcycling (gravity_subcycling > 1): field at the last FMM solve
+//  and acceleration at the one before, only with the gravitation group
+#ifndef FLECSPH_BODY_GRAVITY_SUBCYCLING
+#define FLECSPH_BODY_GRAVITY_SUBCYCLING 1
+#endif
+//- thermokinetic formulation: total energy and its time derivative
+#ifndef FLECSPH_BODY_THERMOKINETIC
+#define FLECSPH_BODY_THERMOKINETIC 1
+#endif
+//- composition: electron fraction, temperature, entropy, minimal pressure
+#ifndef FLECSPH_BODY_COMPOSITION
+#define FLECSPH_BODY_COMPOSITION 1
+#endif
+//- adiabatic invariant K of the polytropic, ideal and piecewise polytropic
+//  EOS and its time derivative, only dropped by the drivers that do not use
+//  the pressure from these EOS
+#ifndef FLECSPH_BODY_ADIABATIC
+#define FLECSPH_BODY_ADIABATIC 1
+#endif
+//- smoothing length solved with the density (sph_h_iterations), the solve
+//  is not available without it
+#ifndef FLECSPH_BODY_H_SOLVE
+#define FLECSPH_BODY_H_SOLVE 1
+#endif
+
+namespace body_fields {
+
+using point_t = flecsi::space_vector_u<type_t, gdimension>;
+
+constexpr bool gravity = FLECSPH_BODY_GRAVITY;
+constexpr bool gravity_subcycling =
+  FLECSPH_BODY_GRAVITY && FLECSPH_BODY_GRAVITY_SUBCYCLING;
+constexpr bool thermokinetic = FLECSPH_BODY_THERMOKINETIC;
+constexpr bool composition = FLECSPH_BODY_COMPOSITION;
+constexpr bool adiabatic = FLECSPH_BODY_ADIABATIC;
+constexpr bool h_solve = FLECSPH_BODY_H_SOLVE;
+
+template<bool ENABLED>
+class gravity_t
+{
+public:
+  point_t getGAcceleration() const {
+    return g_acceleration_;
+  }
+  double getGPotential() const {
+    return g_potential_;
+  }
+  void setGAcceleration(const point_t & g_acceleration) {
+    g_acceleration_ = g_acceleration;
+  }
+  void setGPotential(const double & g_potential) {
+    g_potential_ = g_potential;
+  }
+
+private:
+  point_t g_acceleration_;
+  double g_potential_;
+}; // class gravity_t
+
+template<>
+class gravity_t<false>
+{
+public:
+  point_t getGAcceleration() const {
+    return point_t{};
+  }
+  double getGPotential() const {
+    return 0.;
+  }
+  void setGAcceleration(const point_t &) {}
+  void setGPotential(const double &) {}
+}; // class gravity_t<false>
+
+template<bool ENABLED>
+class gravity_subcycling_t
+{
+public:
+  // Gravitational field at the last FMM solve and acceleration at the one
+  // before
+  const point_t & getGSolveCoordinates() const {
+    return gsolve_coordinates_;
+  }
+  const point_t & getGSolveAcceleration() const {
+    return gsolve_acceleration_;
+  }
+  double getGSolvePotential() const {
+    return gsolve_potential_;
+  }
+  const point_t & getGPrevAcceleration() const {
+    return gprev_acceleration_;
+  }
+  void setGSolve(const point_t & coordinates,
+    const point_t & g_acceleration,
+    const double & g_potential) {
+    gprev_acceleration_ = gsolve_acceleration_;
+    gsolve_coordinates_ = coordinates;
+    gsolve_acceleration_ = g_acceleration;
+    gsolve_potential_ = g_potential;
+  }
+
+private:
+  point_t gsolve_coordinates_;
+  point_t gsolve_acceleration_;
+  double gsolve_potential_;
+  point_t gprev_acceleration_;
+}; // class gravity_subcycling_t
+
+template<>
+class gravity_subcycling_t<false>
+{
+public:
+  point_t getGSolveCoordinates() const {
+    return point_t{};
+  }
+  point_t getGSolveAcceleration() const {
+    return point_t{};
+  }
+  double getGSolvePotential() const {
+    return 0.;
+  }
+  point_t getGPrevAcceleration() const {
+    return point_t{};
+  }
+  void setGSolve(const point_t &, const point_t &, const double &) {}
+}; // class gravity_subcycling_t<false>
+
+template<bool ENABLED>
+class thermokinetic_t
+{
+public:
+  double getTotalenergy() const {
+    return totalenergy_;
+  }
+  void setTotalenergy(double totalenergy) {
+    totalenergy_ = totalenergy;
+  }
+  double getDedt() const {
+    return dedt_;
+  }
+  void setDedt(double dedt) {
+    dedt_ = dedt;
+  }
+
+private:
+  double totalenergy_;
+  double dedt_;
+}; // class thermokinetic_t
+
+template<>
+class thermokinetic_t<false>
+{
+public:
+  double getTotalenergy() const {
+    return 0.;
+  }
+  void setTotalenergy(double) {}
+  double getDedt() const {
+    return 0.;
+  }
+  void setDedt(double) {}
+}; // class thermokinetic_t<false>
+
+template<bool ENABLED>
+class composition_t
+{
+public:
+  double getEntropy() const {
+    return entropy_;
+  }
+  double getElectronfraction() const {
+    return electronfraction_;
+  }
+  double getTemperature() const {
+    return temperature_;
+  }
+  double getPressuremin() const {
+    return pressuremin_;
+  }
+  void setEntropy(const double & entropy) {
+    entropy_ = entropy;
+  }
+  void setElectronfraction(const double & electronfraction) {
+    electronfraction_ = electronfraction;
+  }
+  void setTemperature(const double & temperature) {
+    temperature_ = temperature;
+  }
+  void setPressuremin(const double & pressuremin) {
+    pressuremin_ = pressuremin;
+  }
+
+private:
+  double entropy_;
+  double electronfraction_;
+  double temperature_;
+  double pressuremin_;
+}; // class composition_t
+
+template<>
+class composition_t<false>
+{
+public:
+  double getEntropy() const {
+    return 0.;
+  }
+  double getElectronfraction() const {
+    return 0.;
+  }
+  double getTemperature() const {
+    return 0.;
+  }
+  double getPressuremin() const {
+    return 0.;
+  }
+  void setEntropy(const double &) {}
+  void setElectronfraction(const double &) {}
+  void setTemperature(const double &) {}
+  void setPressuremin(const double &) {}
+}; // class composition_t<false>
+
+template<bool ENABLED>
+class adiabatic_t
+{
+public:
+  double getAdiabatic() const {
+    return adiabatic_;
+  }
+  void setAdiabatic(double adiabatic) {
+    adiabatic_ = adiabatic;
+  }
+  double getDadt() const {
+    return dadt_;
+  }
+  void setDadt(double dadt) {
+    dadt_ = dadt;
+  }
+
+private:
+  double adiabatic_;
+  double dadt_;
+}; // class adiabatic_t
+
+template<>
+class adiabatic_t<false>
+{
+public:
+  double getAdiabatic() const {
+    return 0.;
+  }
+  void setAdiabatic(double) {}
+  double getDadt() const {
+    return 0.;
+  }
+  void setDadt(double) {}
+}; // class adiabatic_t<false>
+
+template<bool ENABLED>
+class h_solve_t
+{
+public:
+  // Smoothing length solved in the density pass, set after the traversal
+  void set_next_radius(const double & next_radius) {
+    next_radius_ = next_radius;
+  }
+  double next_radius() const {
+    return next_radius_;
+  }
+
+private:
+  double next_radius_;
+}; // class h_solve_t
+
+template<>
+class h_solve_t<false>
+{
+public:
+  void set_next_radius(const double &) {}
+  double next_radius() const {
+    return 0.;
+  }
+}; // class h_solve_t<false>
+
+} // namespace body_fields
+
 template<class KEY>
-class body_u : public flecsi::topology::entity<gdimension, type_t, KEY>
+class body_u : public flecsi::topology::entity<gdimension, type_t, KEY>,
+               public body_fields::gravity_t<body_fields::gravity>,
+               public body_fields::gravity_subcycling_t<
+                 body_fields::gravity_subcycling>,
+               public body_fields::thermokinetic_t<body_fields::thermokinetic>,
+               public body_fields::composition_t<body_fields::composition>,
+               public body_fields::adiabatic_t<body_fields::adiabatic>,
+               public body_fields::h_solve_t<body_fields::h_solve>
 {
 
   static const size_t dimension = gdimension;
@@ -57,18 +355,9 @@ public:
   double getSoundspeed() const {
     return soundspeed_;
   }
-  double getEntropy() const {
-    return entropy_;
-  }
-  double getElectronfraction() const {
-    return electronfraction_;
-  }
   double getDensity() const {
     return density_;
   }
-  double getTemperature() const {
-    return temperature_;
-  }
   point_t getVelocity() const {
     return velocity_;
   }
@@ -78,15 +367,9 @@ public:
   point_t getAcceleration() const {
     return acceleration_;
   }
-  point_t getGAcceleration() const {
-    return g_acceleration_;
-  }
   particle_type_t type() const {
     return type_;
   };
-  double getGPotential() const {
-    return g_potential_;
-  }
 
   point_t getLinMomentum() const {
     point_t res = {};
@@ -98,6 +381,14 @@ public:
   double getDt() {
     return dt_;
   };
+  // Rung of the block timestep (see integration.h)
+  int getRung() const {
+    return rung_;
+  };
+  // Largest rung among the neighbors, from the density pass
+  int getNeighborRung() const {
+    return neighbor_rung_;
+  };
   particle_type_t getType() const {
     return type_;
   };
@@ -111,12 +402,6 @@ public:
   void setAcceleration(const point_t & acceleration) {
     acceleration_ = acceleration;
   }
-  void setGAcceleration(const point_t & g_acceleration) {
-    g_acceleration_ = g_acceleration;
-  }
-  void setGPotential(const double & g_potential) {
-    g_potential_ = g_potential;
-  }
   void setVelocity(const point_t & velocity) {
     velocity_ = velocity;
   }
@@ -129,21 +414,18 @@ public:
   void setPressure(const double & pressure) {
     pressure_ = pressure;
   }
-  void setEntropy(const double & entropy) {
-    entropy_ = entropy;
-  }
-  void setElectronfraction(const double & electronfraction) {
-    electronfraction_ = electronfraction;
-  }
   void setDensity(const double & density) {
     density_ = density;
   }
-  void setTemperature(const double & temperature) {
-    temperature_ = temperature;
-  }
   void setDt(const double & dt) {
     dt_ = dt;
   }
+  void setRung(const int & rung) {
+    rung_ = rung;
+  }
+  void setNeighborRung(const int & rung) {
+    neighbor_rung_ = rung;
+  }
   void setType(const particle_type_t & type) {
     type_ = type;
   }
@@ -163,36 +445,12 @@ public:
   void setInternalenergy(double internalenergy) {
     internalenergy_ = internalenergy;
   }
-  double getTotalenergy() const {
-    return totalenergy_;
-  }
-  void setTotalenergy(double totalenergy) {
-    totalenergy_ = totalenergy;
-  }
   void setDudt(double dudt) {
     dudt_ = dudt;
   };
-  void setDedt(double dedt) {
-    dedt_ = dedt;
-  };
-  double getDudt() {
+  double getDudt() const {
     return dudt_;
   };
-  double getDedt() {
-    return dedt_;
-  };
-  double getAdiabatic() const {
-    return adiabatic_;
-  }
-  void setAdiabatic(double adiabatic) {
-    adiabatic_ = adiabatic;
-  };
-  double getDadt() const {
-    return dadt_;
-  };
-  void setDadt(double dadt) {
-    dadt_ = dadt;
-  };
 
   void setNeighbors(const size_t & neighbors) {
     neighbors_ = neighbors;
@@ -201,13 +459,6 @@ public:
     return neighbors_;
   }
 
-  void setPressuremin(const double & pressuremin) {
-    pressuremin_ = pressuremin;
-  }
-  double getPressuremin() const {
-    return pressuremin_;
-  }
-
   void setSignalspeed(const double & signalspeed) {
     signalspeed_ = signalspeed;
   }
@@ -226,8 +477,8 @@ public:
     os << " u: " << b.internalenergy_;
     os << " cs: " << b.soundspeed_;
     os << " a: " << b.acceleration_;
-    os << " ga: " << b.g_acceleration_;
-    os << "gpot: " << b.g_potential_;
+    os << " ga: " << b.getGAcceleration();
+    os << "gpot: " << b.getGPotential();
     os << " id: " << b.id_;
     os << " key: " << b.key_;
     os << " owner: " << b.owner_;
@@ -239,25 +490,17 @@ private:
   point_t velocity_;
   point_t velocityhalf_;
   point_t acceleration_;
-  point_t g_acceleration_;
-  double g_potential_;
   double density_;
   double pressure_;
-  double entropy_;
-  double electronfraction_;
-  double temperature_;
   double soundspeed_;
   double internalenergy_;
-  double totalenergy_;
   double dudt_;
-  double dedt_;
-  double adiabatic_;
-  double dadt_;
   double dt_;
   particle_type_t type_;
+  int rung_ = 0;
   size_t neighbors_;
   state_t state_;
-  double pressuremin_;
+  int neighbor_rung_ = 0;
   double signalspeed_;
 }; // class body
 
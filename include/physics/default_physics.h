@@ -37,6 +37,11 @@ double t_h5data_output = 0.0;
 double t_screen_output = 0.0;
 double t_scalar_output = 0.0;
 int64_t iteration = 0;
+// Newton-Raphson iterations of the smoothing length solve since the last
+// diagnostic output (see compute_density_smoothinglength)
+uint64_t h_solves = 0;
+uint64_t h_iterations = 0;
+uint64_t h_iterations_max = 0;
 } // namespace physics
 
 #include "eforce.h"
@@ -50,6 +55,7 @@ int64_t iteration = 0;
 #include "eos.h"
 #include "integration.h"
 #include "viscosity.h"
+#include "sph_simd.h"
 #include "tensor.h"
 #include "fmm.h"
 
@@ -57,7 +63,9 @@ namespace physics {
 using namespace param;
 
 void
-compute_cofm(node * cofm, std::vector<body *> ents, std::vector<node *> nodes) {
+compute_cofm(node * cofm,
+  const tree_topology_t::scratch_vector<body *> & ents,
+  const tree_topology_t::scratch_vector<node *> & nodes) {
   // Then compute the CoFM
   point_t coordinates = point_t{};
   double radius = 0; // bmax
@@ -132,60 +140,15 @@ compute_cofm(node * cofm, std::vector<body *> ents, std::vector<node *> nodes) {
 #endif
 }
 
-/**
- * @brief      Computes the density in "vanilla sph" formulation
- *             [Rosswog'09, eq.(13)]:
- *
- *             $\rho_a =\sum_b {m_b W_ab(r_ab, (h_a + h_b)/2)}$
- *
- * @param      particle  The particle body
- * @param      nbs       Vector of neighbor particles
- */
-void
-compute_density(body & particle, std::vector<body *> & nbs) {
-  using namespace kernels;
-  const double h_a = particle.radius();
-  const point_t pos_a = particle.coordinates();
-  const int n_nb = nbs.size();
-  mpi_assert(n_nb > 0);
-
-  double r_a_[n_nb], m_[n_nb], h_[n_nb];
-  for(int b = 0; b < n_nb; ++b) {
-    const body * const nb = nbs[b];
-    m_[b] = nb->mass();
-    h_[b] = nb->radius();
-    point_t pos_b = nb->coordinates();
-    r_a_[b] = flecsi::magnitude(pos_a - pos_b);
-  }
-
-  double rho_a = 0.0;
-  for(int b = 0; b < n_nb; ++b) { // Vectorized
-    double Wab = sph_kernel_function(r_a_[b], .5 * (h_a + h_[b]));
-    rho_a += m_[b] * Wab;
-  } // for
-  if(not(rho_a > 0)) {
-    std::cout << "Density of a particle is not a positive number: "
-              << "rho = " << rho_a << std::endl;
-    std::cout << "Failed particle id: " << particle.id() << std::endl;
-    std::cerr << "particle position: " << particle.coordinates() << std::endl;
-    std::cerr << "particle velocity: " << particle.getVelocity() << std::endl;
-    std::cerr << "particle acceleration: "
-              << particle.getAcceleration() + particle.getGAcceleration()
-              << std::endl;
-    std::cerr << "smoothing length:  " << particle.radius() << std::endl;
-    assert(false);
-  }
-  particle.setDensity(rho_a);
-} // compute_density
-
 /**
  * @brief      Computes maximum signal speed for the given particle
  *
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename NBS>
 void
-compute_signalspeed(body & particle, std::vector<body *> & nbs) {
+compute_signalspeed(body & particle, NBS & nbs) {
   using namespace param;
   using namespace kernels;
   using namespace flecsi;
@@ -201,7 +164,7 @@ compute_signalspeed(body & particle, std::vector<body *> & nbs) {
 
   for(int b = 0; b < n_nb; ++b) {
     const body * const nb = nbs[b];
-    const point_t pos_b  = nb->coordinates();
+    const point_t pos_b = boundary::nearest_image(pos_a, nb->coordinates());
     n_a_[b] = (pos_a - pos_b)/distance(pos_a, pos_b);
     v_a_[b]   = v_a - nb->getVelocity();
     c_a_[b]   = std::max(c_a, nb->getSoundspeed());
@@ -215,6 +178,66 @@ compute_signalspeed(body & particle, std::vector<body *> & nbs) {
   particle.setSignalspeed(vsig);
 } // compute_signalspeed
 
+/**
+ * @brief      True if the density pass leaves the EOS to compute_eos_batched.
+ *             The first iteration evaluates it in the pass: there is no
+ *             sound speed yet for the signal speed.
+ */
+bool
+eos_deferred() {
+  return eos_batched and iteration > initial_iteration;
+}
+
+/**
+ * @brief      Pressure and sound speed of all the particles after the
+ *             density pass, with the array interface of the EOS. The
+ *             fields are gathered by chunks which stay in cache.
+ *             The signal speed needs the new sound speeds of the neighbors:
+ *             it is left to the acceleration pass, after the ghosts update.
+ *
+ * @param      bodies  The local particles
+ */
+void
+compute_eos_batched(std::vector<body> & bodies) {
+  constexpr size_t chunk = 512;
+  double rho[chunk], eps[chunk], ye[chunk], K[chunk], P[chunk], cs[chunk];
+  for(size_t start = 0; start < bodies.size(); start += chunk) {
+    const size_t n = std::min(chunk, bodies.size() - start);
+    body * b = &bodies[start];
+    for(size_t i = 0; i < n; ++i) {
+      rho[i] = b[i].getDensity();
+      eps[i] = b[i].getInternalenergy();
+      ye[i] = b[i].getElectronfraction();
+      K[i] = b[i].getAdiabatic();
+    }
+    eos::compute_arrays({n, rho, eps, ye, K, P, cs});
+    for(size_t i = 0; i < n; ++i) {
+      b[i].setPressure(P[i]);
+      b[i].setSoundspeed(cs[i]);
+    }
+  }
+} // compute_eos_batched
+
+/**
+ * @brief      True if the density pass solves the smoothing length, to be
+ *             applied after the traversal by update_smoothinglength_solved
+ */
+bool
+smoothinglength_solved() {
+  return sph_variable_h and sph_h_iterations > 0;
+}
+
+/**
+ * @brief      Apply the smoothing length solved in the density pass, before
+ *             the ghosts are updated
+ *
+ * @param      particle  The particle body
+ */
+void
+update_smoothinglength_solved(body & particle) {
+  particle.set_radius(particle.next_radius());
+}
+
 /**
  * @brief      Calculates total energy for every particle
  *             NOTE: total energy does not include grav. energy
@@ -254,22 +277,260 @@ recover_internal_energy(body & particle) {
   particle.setInternalenergy(eint);
 } // recover_internal_energy
 
+/**
+ * @brief      Adds the external force to the acceleration of one particle,
+ *             for the passes on a subset of the particles; the passes on all
+ *             the particles use external_force::add_acceleration
+ * @param      particle
+ */
+void
+add_external_acceleration(body & particle) {
+  particle.setAcceleration(
+    particle.getAcceleration() + external_force::acceleration(particle));
+} // add_external_acceleration
+
+/**
+ * @brief      Adds dissipative drag to acceleration
+ *             (used in particles relaxation step)
+ * @param      particle
+ */
+void
+add_drag_acceleration(body & particle) {
+  using namespace param;
+  point_t acc = particle.getAcceleration();
+  const point_t vel = particle.getVelocity();
+  acc += external_force::acceleration_drag(vel);
+  particle.setAcceleration(acc);
+} // add_drag_acceleration
+
+/**
+ * @brief      Short-range repulsion force
+ *
+ *     (dv_a)                             (  r_b - r_a       )
+ *     (----)   += -gamma_repulsion  sum_b( ---------- * m_b )
+ *     ( dt )_i                           (  |r_ab|^3        )
+ *
+ *             Artificial force to prevent particles from clumping
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Vector of neighbor particles
+ */
+void
+add_short_range_repulsion(body & particle, std::vector<body *> & nbs) {
+  using namespace param;
+
+  // this particle (index 'a')
+  const double h_a = particle.radius();
+  const size_t id_a = particle.id();
+  const point_t pos_a = particle.coordinates();
+  point_t acc_a = particle.getAcceleration();
+
+  // neighbor particles (index 'b')
+  const int n_nb = nbs.size();
+  double h_b, m_b;
+  point_t pos_b;
+  point_t acc_r = 0.0;
+
+  for(int b = 0; b < nbs.size(); ++b) {
+    const body * const nb = nbs[b];
+    if(nb->id() == id_a)
+      continue;
+    h_b = nb->radius();
+    pos_b = boundary::nearest_image(pos_a, nb->coordinates());
+    double h_ab = .5 * (h_a + h_b);
+    double r_ab = flecsi::magnitude(pos_a - pos_b);
+    if(r_ab > h_ab * relaxation_repulsion_radius)
+      continue;
+    m_b = nb->mass();
+    acc_r += m_b * (pos_a - pos_b) / (r_ab * r_ab * r_ab);
+  }
+  acc_r *= relaxation_repulsion_gamma;
+  particle.setAcceleration(acc_a + acc_r);
+} // add_short_range_repulsion
+
+// Passes over the neighbors, instantiated for each kernel type of kernels.h:
+// the kernel is inlined in the loops over the neighbors (see
+// physics::select)
+namespace passes {
+
+/**
+ * @brief      Computes the density in "vanilla sph" formulation
+ *             [Rosswog'09, eq.(13)]:
+ *
+ *             $\rho_a =\sum_b {m_b W_ab(r_ab, (h_a + h_b)/2)}$
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Vector of neighbor particles
+ */
+template<typename KERNEL, typename NBS>
+void
+compute_density(body & particle, NBS & nbs) {
+  using namespace kernels;
+  const double h_a = particle.radius();
+  const point_t pos_a = particle.coordinates();
+  const int n_nb = nbs.size();
+  mpi_assert(n_nb > 0);
+
+  double rho_a = 0.0;
+  if(sph_simd::enabled<KERNEL>())
+    rho_a = sph_simd::density<KERNEL>(particle, nbs);
+  else {
+    double r_a_[n_nb], m_[n_nb], h_[n_nb];
+    for(int b = 0; b < n_nb; ++b) {
+      const body * const nb = nbs[b];
+      m_[b] = nb->mass();
+      h_[b] = nb->radius();
+      point_t pos_b = boundary::nearest_image(pos_a, nb->coordinates());
+      r_a_[b] = flecsi::magnitude(pos_a - pos_b);
+    }
+
+    for(int b = 0; b < n_nb; ++b) { // Vectorized
+      double Wab = KERNEL::w(r_a_[b], .5 * (h_a + h_[b]));
+      rho_a += m_[b] * Wab;
+    } // for
+  }
+  if(not(rho_a > 0)) {
+    std::cout << "Density of a particle is not a positive number: "
+              << "rho = " << rho_a << std::endl;
+    std::cout << "Failed particle id: " << particle.id() << std::endl;
+    std::cerr << "particle position: " << particle.coordinates() << std::endl;
+    std::cerr << "particle velocity: " << particle.getVelocity() << std::endl;
+    std::cerr << "particle acceleration: "
+              << particle.getAcceleration() + particle.getGAcceleration()
+              << std::endl;
+    std::cerr << "smoothing length:  " << particle.radius() << std::endl;
+    assert(false);
+  }
+  particle.setDensity(rho_a);
+} // compute_density
+
+/**
+ * @brief      Solve the smoothing length and the density together, with
+ *             Newton-Raphson iterations on [Rosswog'09, eqs.(13,51)]:
+ *
+ *             f(h_a) = rho_a(h_a) - m_a (sph_eta kernel_width / h_a)^D = 0
+ *
+ *             The neighbors keep their smoothing length h_b. They come from
+ *             a search padded by sph_h_search_padding and the iterations
+ *             reuse this list: h_a stays below the padded radius, in which
+ *             the list is complete. The solution is stored in next_radius
+ *             and only applied after the traversal (see
+ *             update_smoothinglength_solved): all the particles see the
+ *             same h_b whatever the order of the traversal and the ranks.
+ *             The list is then reduced to the unpadded neighbors.
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Vector of neighbor particles, padded search
+ */
+template<typename KERNEL, typename NBS>
+void
+compute_density_smoothinglength(body & particle, NBS & nbs) {
+  const point_t pos_a = particle.coordinates();
+  const double h_max = sph_h_search_padding * particle.radius();
+  const double C_a =
+    particle.mass() * std::pow(sph_eta * kernels::kernel_width, gdimension);
+  const int n_nb = nbs.size();
+  mpi_assert(n_nb > 0);
+
+  double r_[n_nb], m_[n_nb], h_[n_nb];
+  point_t pos_ab_[n_nb];
+  for(int b = 0; b < n_nb; ++b) {
+    const body * const nb = nbs[b];
+    m_[b] = nb->mass();
+    h_[b] = nb->radius();
+    pos_ab_[b] = pos_a - boundary::nearest_image(pos_a, nb->coordinates());
+    r_[b] = flecsi::magnitude(pos_ab_[b]);
+  }
+
+  double h_a = particle.radius(), rho_a;
+  uint64_t it = 0;
+  for(;; ++it) {
+    // density and its derivative with h_a, dh_ab/dh_a = 1/2:
+    // dW/dh = -(D W + r.grad W) / h
+    double drho_a = 0.0;
+    rho_a = 0.0;
+    for(int b = 0; b < n_nb; ++b) {
+      const double h_ab = .5 * (h_a + h_[b]);
+      const double Wab = KERNEL::w(r_[b], h_ab);
+      const point_t DiWab = KERNEL::gradient(pos_ab_[b], h_ab);
+      rho_a += m_[b] * Wab;
+      drho_a -=
+        .5 * m_[b] * (gdimension * Wab + dot(pos_ab_[b], DiWab)) / h_ab;
+    }
+    const double f = rho_a - C_a / std::pow(h_a, gdimension);
+    if(std::fabs(f) <= sph_h_tolerance * rho_a ||
+       it == uint64_t(sph_h_iterations))
+      break;
+    const double df = drho_a + gdimension * C_a / std::pow(h_a, gdimension + 1);
+    h_a = std::min(h_max, std::max(.5 * h_a, h_a - f / df));
+  }
+  h_solves++;
+  h_iterations += it;
+  h_iterations_max = std::max(h_iterations_max, it);
+
+  if(not(rho_a > 0)) {
+    std::cout << "Density of a particle is not a positive number: "
+              << "rho = " << rho_a << std::endl;
+    std::cout << "Failed particle id: " << particle.id() << std::endl;
+    std::cerr << "smoothing length:  " << h_a << std::endl;
+    assert(false);
+  }
+  particle.setDensity(rho_a);
+  particle.set_next_radius(h_a);
+
+  // neighbors of the unpadded search, symmetric
+  const double h_old = particle.radius();
+  size_t n = 0;
+  for(int b = 0; b < n_nb; ++b) {
+    if(r_[b] <= std::max(h_old, h_[b]))
+      nbs[n++] = nbs[b];
+  }
+  nbs.resize(n);
+  particle.setNeighbors(n);
+} // compute_density_smoothinglength
+
+/**
+ * @brief      Largest rung among the neighbors of a particle, for the
+ *             neighbor limiter of the block timesteps (integration.h)
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Vector of neighbor particles
+ */
+template<typename NBS>
+void
+compute_neighbor_rung(body & particle, NBS & nbs) {
+  int rung = particle.getRung();
+  for(size_t b = 0; b < nbs.size(); ++b)
+    rung = std::max(rung, nbs[b]->getRung());
+  particle.setNeighborRung(rung);
+}
+
 /**
  * @brief      Compute the density, EOS and soundspeed in one place
- * to save on gathering the neighbors
+ * to save on gathering the neighbors. With eos_batched, the EOS is left to
+ * compute_eos_batched after the traversal and the signal speed to the
+ * acceleration pass. With block timesteps, the largest neighbor rung is
+ * gathered as well.
  *
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename KERNEL, typename NBS>
 void
-compute_density_pressure_soundspeed(body & particle,
-  std::vector<body *> & nbs) {
-  compute_density(particle, nbs);
+compute_density_pressure_soundspeed(body & particle, NBS & nbs) {
+  if(smoothinglength_solved())
+    compute_density_smoothinglength<KERNEL>(particle, nbs);
+  else
+    compute_density<KERNEL>(particle, nbs);
   if(evolve_internal_energy and thermokinetic_formulation)
     recover_internal_energy(particle);
-  eos::compute_pressure(particle);
-  eos::compute_soundspeed(particle);
-  compute_signalspeed(particle, nbs);
+  if(not eos_deferred()) {
+    eos::compute_pressure(particle);
+    eos::compute_soundspeed(particle);
+    compute_signalspeed(particle, nbs);
+  }
+  if(block_timesteps)
+    compute_neighbor_rung(particle, nbs);
 }
 
 /**
@@ -280,16 +541,30 @@ compute_density_pressure_soundspeed(body & particle,
  *     (----)   = -sum_b m_b ( -----  +  -----   + Pi_ab ) D_i Wab  + ext_i
  *     ( dt )_i              (rho_a^2   rho_b^2          )
  *
+ *             The external force ext_i is added after the traversal, by
+ *             external_force::add_acceleration or add_external_acceleration.
+ *             With the batched EOS, the signal speed is computed here, with
+ *             the new sound speeds of the neighbors.
+ *
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename KERNEL, typename NBS>
 void
-compute_acceleration(body & particle, std::vector<body *> & nbs) {
+compute_acceleration(body & particle, NBS & nbs) {
   using namespace param;
   using namespace viscosity;
   using namespace kernels;
 
-  // Reset the acceleration
+  if(eos_deferred())
+    compute_signalspeed(particle, nbs);
+  if(sph_simd::enabled<KERNEL>()) {
+    point_t acc_a = sph_simd::acceleration<KERNEL>(particle, nbs);
+    particle.setAcceleration(acc_a);
+    particle.setGAcceleration(0);
+    particle.setGPotential(0);
+    return;
+  }
 
   // this particle (index 'a')
   const double h_a = particle.radius(), rho_a = particle.getDensity(),
@@ -306,7 +581,7 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
     const body * const nb = nbs[b];
     rho_[b] = nb->getDensity();
     P_[b] = nb->getPressure();
-    pos_[b] = nb->coordinates();
+    pos_[b] = boundary::nearest_image(pos_a, nb->coordinates());
     v12_[b] = nb->getVelocityhalf();
     c_[b] = nb->getSoundspeed();
     h_[b] = nb->radius();
@@ -321,7 +596,7 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
     double mu_ab = mu(h_ab, v12_ab, pos_ab);
     Pi_a_[b] =
       artificial_viscosity(.5 * (rho_a + rho_[b]), .5 * (c_a + c_[b]), mu_ab);
-    DiWa_[b] = sph_kernel_gradient(pos_a - pos_[b], h_ab);
+    DiWa_[b] = KERNEL::gradient(pos_a - pos_[b], h_ab);
   }
 
   // compute the final answer
@@ -331,70 +606,10 @@ compute_acceleration(body & particle, std::vector<body *> & nbs) {
     const double Prho2_b = P_[b] / (rho_[b] * rho_[b]);
     acc_a += -m_[b] * (Prho2_a + Prho2_b + Pi_a_[b]) * DiWa_[b];
   }
-  acc_a += external_force::acceleration(particle);
   particle.setAcceleration(acc_a);
   particle.setGAcceleration(0);
   particle.setGPotential(0);
-} // compute_hydro_acceleration
-
-/**
- * @brief      Adds dissipative drag to acceleration
- *             (used in particles relaxation step)
- * @param      particle
- */
-void
-add_drag_acceleration(body & particle) {
-  using namespace param;
-  point_t acc = particle.getAcceleration();
-  const point_t vel = particle.getVelocity();
-  acc += external_force::acceleration_drag(vel);
-  particle.setAcceleration(acc);
-} // add_drag_acceleration
-
-/**
- * @brief      Short-range repulsion force
- *
- *     (dv_a)                             (  r_b - r_a       )
- *     (----)   += -gamma_repulsion  sum_b( ---------- * m_b )
- *     ( dt )_i                           (  |r_ab|^3        )
- *
- *             Artificial force to prevent particles from clumping
- *
- * @param      particle  The particle body
- * @param      nbs       Vector of neighbor particles
- */
-void
-add_short_range_repulsion(body & particle, std::vector<body *> & nbs) {
-  using namespace param;
-
-  // this particle (index 'a')
-  const double h_a = particle.radius();
-  const size_t id_a = particle.id();
-  const point_t pos_a = particle.coordinates();
-  point_t acc_a = particle.getAcceleration();
-
-  // neighbor particles (index 'b')
-  const int n_nb = nbs.size();
-  double h_b, m_b;
-  point_t pos_b;
-  point_t acc_r = 0.0;
-
-  for(int b = 0; b < nbs.size(); ++b) {
-    const body * const nb = nbs[b];
-    if(nb->id() == id_a)
-      continue;
-    h_b = nb->radius();
-    pos_b = nb->coordinates();
-    double h_ab = .5 * (h_a + h_b);
-    double r_ab = flecsi::magnitude(pos_a - pos_b);
-    if(r_ab > h_ab * relaxation_repulsion_radius)
-      continue;
-    m_b = nb->mass();
-    acc_r += m_b * (pos_a - pos_b) / (r_ab * r_ab * r_ab);
-  }
-  acc_r *= relaxation_repulsion_gamma;
-  particle.setAcceleration(acc_a + acc_r);
-} // add_short_range_repulsion
+} // compute_acceleration
 
 /**
  * @brief      Calculates the dudt, time derivative of internal energy.
@@ -407,13 +622,18 @@ add_short_range_repulsion(body & particle, std::vector<body *> & nbs) {
  * @param      particle  The particle body
  * @param      nbs       Vector of neighbor particles
  */
+template<typename KERNEL, typename NBS>
 void
-compute_dudt(body & particle, std::vector<body *> & nbs) {
+compute_dudt(body & particle, NBS & nbs) {
   // Do not change internal energy in relaxation phase
   if(iteration < relaxation_steps) {
     particle.setDudt(0.0);
     return;
   }
+  if(sph_simd::enabled<KERNEL>()) {
+    particle.setDudt(sph_simd::dudt<KERNEL>(particle, nbs));
+    return;
+  }
 
   using namespace viscosity;
   using namespace kernels;
@@ -434,7 +654,7 @@ compute_dudt(body & particle, std::vector<body *> & nbs) {
     const body * const nb = nbs[b];
     rho_[b] = nb->getDensity();
     P_[b] = nb->getPressure();
-    pos_[b] = nb->coordinates();
+    pos_[b] = boundary::nearest_image(pos_a, nb->coordinates());
     vel_[b] = nb->getVelocity();
     v12_[b] = nb->getVelocityhalf();
     c_[b] = nb->getSoundspeed();
@@ -451,7 +671,7 @@ compute_dudt(body & particle, std::vector<body *> & nbs) {
     double mu_ab = mu(h_ab, v12_ab, pos_ab);
     Pi_a_[b] =
       artificial_viscosity(.5 * (rho_a + rho_[b]), .5 * (c_a + c_[b]), mu_ab);
-    point_t DiWab = sph_kernel_gradient(pos_ab, h_ab);
+    point_t DiWab = KERNEL::gradient(pos_ab, h_ab);
     vab_dot_DiWa_[b] = dot(vel_ab, DiWab);
   }
 
@@ -479,8 +699,9 @@ compute_dudt(body & particle, std::vector<body *> & nbs) {
  * @param      srch  The source's body holder
  * @param      nbsh  The neighbors' body holders
  */
+template<typename KERNEL, typename NBS>
 void
-compute_dedt(body & particle, std::vector<body *> & nbs) {
+compute_dedt(body & particle, NBS & nbs) {
   using namespace viscosity;
   using namespace kernels;
 
@@ -491,6 +712,10 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
                 v12_a = particle.getVelocityhalf(),
                  ga_a = particle.getGAcceleration();
   const double gv = dot(ga_a,vel_a);
+  if(sph_simd::enabled<KERNEL>()) {
+    particle.setDedt(sph_simd::dedt<KERNEL>(particle, nbs) + gv);
+    return;
+  }
 
   // neighbor particles (index 'b')
   const int n_nb = nbs.size();
@@ -502,7 +727,7 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
     const body * const nb = nbs[b];
     rho_[b] = nb->getDensity();
     P_[b] = nb->getPressure();
-    pos_[b] = nb->coordinates();
+    pos_[b] = boundary::nearest_image(pos_a, nb->coordinates());
     vel_[b] = nb->getVelocity();
     v12_[b] = nb->getVelocityhalf();
     c_[b] = nb->getSoundspeed();
@@ -520,7 +745,7 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
     Pi_a_[b] =
       artificial_viscosity(.5 * (rho_a + rho_[b]), .5 * (c_a + c_[b]), mu_ab);
 
-    point_t DiWab = sph_kernel_gradient(pos_ab, h_ab);
+    point_t DiWab = KERNEL::gradient(pos_ab, h_ab);
     va_dot_DiWa_[b] = dot(vel_a, DiWab);
     vb_dot_DiWa_[b] = dot(vel_[b], DiWab);
   }
@@ -536,6 +761,426 @@ compute_dedt(body & particle, std::vector<body *> & nbs) {
   particle.setDedt(dedt);
 } // compute_dedt
 
+/**
+ * @brief      Acceleration and time derivative of the energy in one sweep
+ *             over the neighbors: the viscosity and the kernel gradients of
+ *             compute_acceleration are reused by compute_dudt (or
+ *             compute_dedt, without the work of gravity: see
+ *             add_gravity_dedt). Both use the half-step velocities, which
+ *             are the velocities of the first iteration. The signal speed
+ *             is computed as in compute_acceleration.
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Vector of neighbor particles
+ */
+template<typename KERNEL, typename NBS>
+void
+compute_acceleration_energy(body & particle, NBS & nbs) {
+  using namespace param;
+  using namespace viscosity;
+  using namespace kernels;
+
+  const bool relaxation = iteration < relaxation_steps;
+  if(eos_deferred())
+    compute_signalspeed(particle, nbs);
+  if(sph_simd::enabled<KERNEL>()) {
+    point_t acc_a;
+    double dudt, dedt;
+    sph_simd::acceleration_energy<KERNEL>(particle, nbs, acc_a, dudt, dedt);
+    particle.setAcceleration(acc_a);
+    particle.setGAcceleration(0);
+    particle.setGPotential(0);
+    if(thermokinetic_formulation)
+      particle.setDedt(dedt);
+    else
+      particle.setDudt(relaxation ? 0.0 : dudt);
+    return;
+  }
+
+  // this particle (index 'a')
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               P_a = particle.getPressure(), c_a = particle.getSoundspeed();
+  const point_t pos_a = particle.coordinates(),
+                v12_a = particle.getVelocityhalf();
+
+  // neighbor particles (index 'b')
+  const int n_nb = nbs.size();
+  double rho_[n_nb], P_[n_nb], h_[n_nb], m_[n_nb], c_[n_nb], Pi_a_[n_nb];
+  point_t pos_[n_nb], v12_[n_nb], DiWa_[n_nb];
+
+  for(int b = 0; b < n_nb; ++b) {
+    const body * const nb = nbs[b];
+    rho_[b] = nb->getDensity();
+    P_[b] = nb->getPressure();
+    pos_[b] = boundary::nearest_image(pos_a, nb->coordinates());
+    v12_[b] = nb->getVelocityhalf();
+    c_[b] = nb->getSoundspeed();
+    h_[b] = nb->radius();
+    m_[b] = nb->mass() * (pos_[b] != pos_a); // if same particle, m_b->0
+  }
+
+  // precompute viscosity and kernel gradients
+  for(int b = 0; b < n_nb; ++b) { // Vectorized
+    const point_t v12_ab = v12_a - v12_[b];
+    const point_t pos_ab = pos_a - pos_[b];
+    double h_ab = .5 * (h_a + h_[b]);
+    double mu_ab = mu(h_ab, v12_ab, pos_ab);
+    Pi_a_[b] =
+      artificial_viscosity(.5 * (rho_a + rho_[b]), .5 * (c_a + c_[b]), mu_ab);
+    DiWa_[b] = KERNEL::gradient(pos_a - pos_[b], h_ab);
+  }
+
+  // acceleration
+  const double Prho2_a = P_a / (rho_a * rho_a);
+  point_t acc_a = 0.0;
+  for(int b = 0; b < n_nb; ++b) { // Vectorized
+    const double Prho2_b = P_[b] / (rho_[b] * rho_[b]);
+    acc_a += -m_[b] * (Prho2_a + Prho2_b + Pi_a_[b]) * DiWa_[b];
+  }
+  particle.setAcceleration(acc_a);
+  particle.setGAcceleration(0);
+  particle.setGPotential(0);
+
+  // energy
+  if(thermokinetic_formulation) {
+    double dedt = 0;
+    for(int b = 0; b < n_nb; ++b) { // Vectorized
+      const double Prho2_b = P_[b] / (rho_[b] * rho_[b]);
+      const double va_dot_DiWa = dot(v12_a, DiWa_[b]);
+      const double vb_dot_DiWa = dot(v12_[b], DiWa_[b]);
+      dedt -= m_[b] * (Prho2_a * vb_dot_DiWa + va_dot_DiWa * Prho2_b +
+                        .5 * Pi_a_[b] * (vb_dot_DiWa + va_dot_DiWa));
+    }
+    particle.setDedt(dedt);
+  }
+  else if(relaxation)
+    particle.setDudt(0.0);
+  else {
+    double dudt_pressure = 0.0, dudt_visc = 0.0;
+    for(int b = 0; b < n_nb; ++b) { // Vectorized
+      const double vab_dot_DiWa = dot(v12_a - v12_[b], DiWa_[b]);
+      dudt_pressure += m_[b] * vab_dot_DiWa;
+      dudt_visc += m_[b] * vab_dot_DiWa * Pi_a_[b];
+    }
+    particle.setDudt(Prho2_a * dudt_pressure + .5 * dudt_visc);
+  }
+} // compute_acceleration_energy
+
+/**
+ * @brief      Half-pair version of compute_acceleration: the local
+ *             neighbors nbs[0, nlocal) receive the opposite contribution
+ *             of each pair (Newton's third law), the remote neighbors
+ *             nbs[nlocal, size) only contribute to the particle. The sums
+ *             start from reset_acceleration. With the batched EOS, the
+ *             signal speed is the maximum over the pairs, symmetric too.
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Local neighbors after the particle, then remote ones
+ * @param      nlocal    Number of local neighbors
+ */
+template<typename KERNEL>
+void
+compute_acceleration_pairs(body & particle,
+  std::vector<body *> & nbs,
+  const size_t & nlocal) {
+  using namespace viscosity;
+
+  // this particle (index 'a')
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               P_a = particle.getPressure(), c_a = particle.getSoundspeed(),
+               m_a = particle.mass();
+  const point_t pos_a = particle.coordinates(),
+                v12_a = particle.getVelocityhalf();
+  const double Prho2_a = P_a / (rho_a * rho_a);
+
+  const bool signalspeed = eos_deferred();
+  const point_t vel_a = particle.getVelocity();
+  double vsig_a = particle.getSignalspeed();
+
+  point_t acc_a = 0.0;
+  for(size_t b = 0; b < nbs.size(); ++b) {
+    body * const nb = nbs[b];
+    const double rho_b = nb->getDensity(), c_b = nb->getSoundspeed();
+    const point_t pos_ab =
+      pos_a - boundary::nearest_image(pos_a, nb->coordinates());
+    const point_t v12_ab = v12_a - nb->getVelocityhalf();
+    const double h_ab = .5 * (h_a + nb->radius());
+    const double Pi_ab = artificial_viscosity(
+      .5 * (rho_a + rho_b), .5 * (c_a + c_b), mu(h_ab, v12_ab, pos_ab));
+    const double Prho2_b = nb->getPressure() / (rho_b * rho_b);
+    const point_t f_ab =
+      (Prho2_a + Prho2_b + Pi_ab) * KERNEL::gradient(pos_ab, h_ab);
+    acc_a -= nb->mass() * f_ab;
+    if(b < nlocal)
+      nb->setAcceleration(nb->getAcceleration() + m_a * f_ab);
+    if(signalspeed) {
+      // see compute_signalspeed
+      const double vsig_ab = std::max(c_a, c_b) -
+        std::min(dot(vel_a - nb->getVelocity(), pos_ab) / magnitude(pos_ab),
+          0.0);
+      vsig_a = std::max(vsig_a, vsig_ab);
+      if(b < nlocal)
+        nb->setSignalspeed(std::max(nb->getSignalspeed(), vsig_ab));
+    }
+  }
+  particle.setAcceleration(particle.getAcceleration() + acc_a);
+  particle.setSignalspeed(vsig_a);
+} // compute_acceleration_pairs
+
+/**
+ * @brief      Half-pair version of compute_dudt (see
+ *             compute_acceleration_pairs), the sums start from reset_dudt
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Local neighbors after the particle, then remote ones
+ * @param      nlocal    Number of local neighbors
+ */
+template<typename KERNEL>
+void
+compute_dudt_pairs(body & particle,
+  std::vector<body *> & nbs,
+  const size_t & nlocal) {
+  // Do not change internal energy in relaxation phase
+  if(iteration < relaxation_steps)
+    return;
+
+  using namespace viscosity;
+
+  // this particle (index 'a')
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               P_a = particle.getPressure(), c_a = particle.getSoundspeed(),
+               m_a = particle.mass();
+  const point_t pos_a = particle.coordinates(), vel_a = particle.getVelocity(),
+                v12_a = particle.getVelocityhalf();
+  const double Prho2_a = P_a / (rho_a * rho_a);
+
+  double dudt_a = 0.0;
+  for(size_t b = 0; b < nbs.size(); ++b) {
+    body * const nb = nbs[b];
+    const double rho_b = nb->getDensity();
+    const point_t pos_ab =
+      pos_a - boundary::nearest_image(pos_a, nb->coordinates());
+    const point_t v12_ab = v12_a - nb->getVelocityhalf();
+    const double h_ab = .5 * (h_a + nb->radius());
+    const double Pi_ab = artificial_viscosity(.5 * (rho_a + rho_b),
+      .5 * (c_a + nb->getSoundspeed()), mu(h_ab, v12_ab, pos_ab));
+    // symmetric in a and b
+    const double vab_dot_DiWab =
+      dot(vel_a - nb->getVelocity(), KERNEL::gradient(pos_ab, h_ab));
+    dudt_a += nb->mass() * (Prho2_a + .5 * Pi_ab) * vab_dot_DiWab;
+    if(b < nlocal) {
+      const double Prho2_b = nb->getPressure() / (rho_b * rho_b);
+      nb->setDudt(nb->getDudt() + m_a * (Prho2_b + .5 * Pi_ab) * vab_dot_DiWab);
+    }
+  }
+  particle.setDudt(particle.getDudt() + dudt_a);
+} // compute_dudt_pairs
+
+/**
+ * @brief      Half-pair version of compute_dedt (see
+ *             compute_acceleration_pairs), the sums start from reset_dedt
+ *
+ * @param      particle  The particle body
+ * @param      nbs       Local neighbors after the particle, then remote ones
+ * @param      nlocal    Number of local neighbors
+ */
+template<typename KERNEL>
+void
+compute_dedt_pairs(body & particle,
+  std::vector<body *> & nbs,
+  const size_t & nlocal) {
+  using namespace viscosity;
+
+  // this particle (index 'a')
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               P_a = particle.getPressure(), c_a = particle.getSoundspeed(),
+               m_a = particle.mass();
+  const point_t pos_a = particle.coordinates(), vel_a = particle.getVelocity(),
+                v12_a = particle.getVelocityhalf();
+  const double Prho2_a = P_a / (rho_a * rho_a);
+
+  double dedt_a = 0.0;
+  for(size_t b = 0; b < nbs.size(); ++b) {
+    body * const nb = nbs[b];
+    const double rho_b = nb->getDensity();
+    const point_t pos_ab =
+      pos_a - boundary::nearest_image(pos_a, nb->coordinates());
+    const point_t v12_ab = v12_a - nb->getVelocityhalf();
+    const double h_ab = .5 * (h_a + nb->radius());
+    const double Pi_ab = artificial_viscosity(.5 * (rho_a + rho_b),
+      .5 * (c_a + nb->getSoundspeed()), mu(h_ab, v12_ab, pos_ab));
+    const double Prho2_b = nb->getPressure() / (rho_b * rho_b);
+    const point_t DiWab = KERNEL::gradient(pos_ab, h_ab);
+    const double va_dot_DiWab = dot(vel_a, DiWab),
+                 vb_dot_DiWab = dot(nb->getVelocity(), DiWab),
+                 visc = .5 * Pi_ab * (va_dot_DiWab + vb_dot_DiWab);
+    dedt_a -= nb->mass() *
+              (Prho2_a * vb_dot_DiWab + Prho2_b * va_dot_DiWab + visc);
+    if(b < nlocal)
+      nb->setDedt(nb->getDedt() +
+                  m_a * (Prho2_b * va_dot_DiWab + Prho2_a * vb_dot_DiWab +
+                          visc));
+  }
+  particle.setDedt(particle.getDedt() + dedt_a);
+} // compute_dedt_pairs
+
+} // namespace passes
+
+// Passes selected for the kernel of the run by physics::select(), on the
+// neighbors as a vector of pointers or as the index span of the SPH
+// traversals (see tree_topology::traversal_sph_if)
+using neighbor_span_t = flecsi::topology::neighbor_span<body>;
+struct pass_t {
+  void (*vector)(body & particle, std::vector<body *> & nbs) = nullptr;
+  void (*span)(body & particle, neighbor_span_t & nbs) = nullptr;
+  void operator()(body & particle, std::vector<body *> & nbs) const {
+    vector(particle, nbs);
+  }
+  void operator()(body & particle, neighbor_span_t & nbs) const {
+    span(particle, nbs);
+  }
+};
+#define PHYSICS_PASS(NAME, KERNEL)                                             \
+  pass_t {                                                                     \
+    passes::NAME<KERNEL, std::vector<body *>>,                                 \
+      passes::NAME<KERNEL, neighbor_span_t>                                    \
+  }
+#ifdef sph_kernel
+using kernel_t = kernels::analytic<sph_kernel>;
+pass_t compute_density = PHYSICS_PASS(compute_density, kernel_t);
+pass_t compute_density_pressure_soundspeed =
+  PHYSICS_PASS(compute_density_pressure_soundspeed, kernel_t);
+pass_t compute_acceleration = PHYSICS_PASS(compute_acceleration, kernel_t);
+pass_t compute_dudt = PHYSICS_PASS(compute_dudt, kernel_t);
+pass_t compute_dedt = PHYSICS_PASS(compute_dedt, kernel_t);
+pass_t compute_acceleration_energy =
+  PHYSICS_PASS(compute_acceleration_energy, kernel_t);
+#else
+pass_t compute_density;
+pass_t compute_density_pressure_soundspeed;
+pass_t compute_acceleration;
+pass_t compute_dudt;
+pass_t compute_dedt;
+pass_t compute_acceleration_energy;
+#endif
+
+// Half-pair passes, see body_system::apply_in_smoothinglength_pairs
+typedef void (*pair_pass_t)(body & particle,
+  std::vector<body *> & nbs,
+  const size_t & nlocal);
+#ifdef sph_kernel
+pair_pass_t compute_acceleration_pairs =
+  passes::compute_acceleration_pairs<kernel_t>;
+pair_pass_t compute_dudt_pairs = passes::compute_dudt_pairs<kernel_t>;
+pair_pass_t compute_dedt_pairs = passes::compute_dedt_pairs<kernel_t>;
+#else
+pair_pass_t compute_acceleration_pairs = nullptr;
+pair_pass_t compute_dudt_pairs = nullptr;
+pair_pass_t compute_dedt_pairs = nullptr;
+#endif
+
+template<typename KERNEL>
+void
+set_passes() {
+  compute_density = PHYSICS_PASS(compute_density, KERNEL);
+  compute_density_pressure_soundspeed =
+    PHYSICS_PASS(compute_density_pressure_soundspeed, KERNEL);
+  compute_acceleration = PHYSICS_PASS(compute_acceleration, KERNEL);
+  compute_dudt = PHYSICS_PASS(compute_dudt, KERNEL);
+  compute_dedt = PHYSICS_PASS(compute_dedt, KERNEL);
+  compute_acceleration_energy =
+    PHYSICS_PASS(compute_acceleration_energy, KERNEL);
+  compute_acceleration_pairs = passes::compute_acceleration_pairs<KERNEL>;
+  compute_dudt_pairs = passes::compute_dudt_pairs<KERNEL>;
+  compute_dedt_pairs = passes::compute_dedt_pairs<KERNEL>;
+}
+
+/**
+ * @brief      Select the instantiation of the passes for the sph_kernel
+ *             and sph_kernel_tabulated parameters, once for the run
+ */
+void
+select() {
+  if(sph_kernel_tabulated) {
+    set_passes<kernels::tabulated>();
+    return;
+  }
+#ifndef sph_kernel
+  switch(sph_kernel) {
+    case(cubic_spline):
+      set_passes<kernels::analytic<cubic_spline>>();
+      break;
+    case(quintic_spline):
+      set_passes<kernels::analytic<quintic_spline>>();
+      break;
+    case(wendland_c2):
+      set_passes<kernels::analytic<wendland_c2>>();
+      break;
+    case(wendland_c4):
+      set_passes<kernels::analytic<wendland_c4>>();
+      break;
+    case(wendland_c6):
+      set_passes<kernels::analytic<wendland_c6>>();
+      break;
+    case(sinc_ker):
+      set_passes<kernels::analytic<sinc_ker>>();
+      break;
+    case(gaussian):
+      set_passes<kernels::analytic<gaussian>>();
+      break;
+    case(super_gaussian):
+      set_passes<kernels::analytic<super_gaussian>>();
+      break;
+    default:
+      log_fatal("Bad kernel parameter" << std::endl);
+  } // switch(sph_kernel)
+#endif
+}
+
+/**
+ * @brief      Start the sums of compute_acceleration_pairs: acceleration
+ *             and gravitation reset, and signal speed with the batched EOS
+ * @param      particle
+ */
+void
+reset_acceleration(body & particle) {
+  particle.setAcceleration(0);
+  particle.setGAcceleration(0);
+  particle.setGPotential(0);
+  if(eos_deferred())
+    particle.setSignalspeed(0);
+} // reset_acceleration
+
+/**
+ * @brief      Start the sums of compute_dudt_pairs
+ * @param      particle
+ */
+void
+reset_dudt(body & particle) {
+  particle.setDudt(0.0);
+} // reset_dudt
+
+/**
+ * @brief      Start the sums of compute_dedt_pairs: work of gravity
+ * @param      particle
+ */
+void
+reset_dedt(body & particle) {
+  particle.setDedt(dot(particle.getGAcceleration(), particle.getVelocity()));
+} // reset_dedt
+
+/**
+ * @brief      Adds the work of gravity to the dedt of
+ *             compute_acceleration_energy, with the half-step velocity
+ * @param      particle
+ */
+void
+add_gravity_dedt(body & particle) {
+  const double gv =
+    dot(particle.getGAcceleration(), particle.getVelocityhalf());
+  particle.setDedt(particle.getDedt() + gv);
+} // add_gravity_dedt
+
 /**
  * @brief      Adds energy dissipation rate due to artificial
  *             particle relaxation drag force
@@ -25,6 +25,7 @@
 #define _eforce_h_
 
 #include <boost/algorithm/string.hpp>
+#include <tuple>
 
 #include "density_profiles.h"
 #include "params.h"
@@ -36,10 +37,28 @@ namespace external_force {
 
 // acceleration and potential function types and pointers
 typedef double (*potential_t)(const point_t &);
-typedef point_t (*acceleration_t)(const body &);
+typedef point_t (*acceleration_t)(const point_t &);
+typedef void (*add_acceleration_t)(std::vector<body> &);
 static std::vector<potential_t> vec_potentials;
 static std::vector<acceleration_t> vec_accelerations;
 
+//! extforce_wall_powerindex if it is a small integer, -1 otherwise
+static int wall_powerindex = -1;
+
+/**
+ * @brief      x^(n - shift) for the power index n of the walls: repeated
+ *             products for an integer index, pow otherwise
+ */
+inline double
+wall_pow(const double & x, const int & shift) {
+  if(wall_powerindex < shift)
+    return pow(x, param::extforce_wall_powerindex - shift);
+  double p = 1.0;
+  for(int i = shift; i < wall_powerindex; ++i)
+    p *= x;
+  return p;
+}
+
 /**
  * @brief      1D walls: steep power-law-like potentials
  * @param      rp  Point coordinates
@@ -50,11 +69,10 @@ potential_square_well(const point_t & rp) {
   using namespace param;
   const static double box[3] = {.5 * box_length, .5 * box_width,
     .5 * box_height},
-                      pw_n = extforce_wall_powerindex,
                       pw_a = extforce_wall_steepness;
 
-  double phi = (((rp[I] < -box[I]) ? pow(-rp[I] - box[I], pw_n) : 0.0) +
-                 ((rp[I] > box[I]) ? pow(rp[I] - box[I], pw_n) : 0.0)) *
+  double phi = (((rp[I] < -box[I]) ? wall_pow(-rp[I] - box[I], 0) : 0.0) +
+                 ((rp[I] > box[I]) ? wall_pow(rp[I] - box[I], 0) : 0.0)) *
                pw_a;
   return phi;
 }
@@ -64,17 +82,16 @@ potential_t potential_walls_z = potential_square_well<2>;
 
 template<int I = 0>
 point_t
-acceleration_square_well(const body & particle) {
+acceleration_square_well(const point_t & rp) {
   using namespace param;
   point_t a = 0.0;
-  point_t rp = particle.coordinates();
   const static double box[3] = {.5 * box_length, .5 * box_width,
     .5 * box_height},
                       pw_n = extforce_wall_powerindex,
                       pw_a = extforce_wall_steepness;
 
-  a[I] = (((rp[I] < -box[I]) ? pow(-rp[I] - box[I], pw_n - 1) : 0.0) -
-           ((rp[I] > box[I]) ? pow(rp[I] - box[I], pw_n - 1) : 0.0)) *
+  a[I] = (((rp[I] < -box[I]) ? wall_pow(-rp[I] - box[I], 1) : 0.0) -
+           ((rp[I] > box[I]) ? wall_pow(rp[I] - box[I], 1) : 0.0)) *
          pw_n * pw_a;
   return a;
 }
@@ -84,13 +101,12 @@ acceleration_t acceleration_walls_z = acceleration_square_well<2>;
 
 /**
  * @brief      Round or spherical boundary wall
- * @param      particle  The particle being accelerated
+ * @param      rp  Coordinates of the particle being accelerated
  */
 point_t
-acceleration_spherical_wall(const body & particle) {
+acceleration_spherical_wall(const point_t & rp) {
   using namespace param;
   point_t a = 0.0;
-  point_t rp = particle.coordinates();
   const double pw_n = extforce_wall_powerindex;
   const double pw_a = extforce_wall_steepness;
   double r = rp[0] * rp[0];
@@ -98,7 +114,7 @@ acceleration_spherical_wall(const body & particle) {
     r += rp[i] * rp[i];
   r = sqrt(r);
   if(r > sphere_radius) {
-    const double ar = pw_n * pw_a * pow(r - sphere_radius, pw_n - 1);
+    const double ar = pw_n * pw_a * wall_pow(r - sphere_radius, 1);
     for(unsigned short i = 0; i < gdimension; ++i)
       a[i] = -rp[i] / r * ar;
   }
@@ -109,29 +125,27 @@ double
 potential_spherical_wall(const point_t & rp) {
   using namespace param;
   double phi = 0.0;
-  const double pw_n = extforce_wall_powerindex;
   const double pw_a = extforce_wall_steepness;
   double r = rp[0] * rp[0];
   for(unsigned short i = 1; i < gdimension; ++i)
     r += rp[i] * rp[i];
   r = sqrt(r);
   if(r > sphere_radius)
-    phi = pw_a * pow(r - sphere_radius, pw_n);
+    phi = pw_a * wall_pow(r - sphere_radius, 0);
   return phi;
 }
 
 /**
  * @brief      External force support for parabolic
  *             sphericall-symmetric density
- * @param      particle  The particle being accelerated
+ * @param      rp  Coordinates of the particle being accelerated
  */
 point_t
-acceleration_spherical_density_support(const body & particle) {
+acceleration_spherical_density_support(const point_t & rp) {
   using namespace param;
   point_t a = 0.0;
   static const double K0 = pressure_initial / pow(rho_initial, poly_gamma),
                       rho0 = density_profiles::spherical_density_profile(0.);
-  point_t rp = particle.coordinates();
   double r = rp[0] * rp[0];
   for(unsigned short i = 1; i < gdimension; ++i)
     r += rp[i] * rp[i];
@@ -147,7 +161,7 @@ acceleration_spherical_density_support(const body & particle) {
     for(short int i = 0; i < gdimension; ++i)
       a[i] = a_r * rp[i] / r;
   }
-  return a + acceleration_spherical_wall(particle);
+  return a + acceleration_spherical_wall(rp);
 }
 
 double
@@ -173,10 +187,10 @@ potential_spherical_density_support(const point_t & rp) {
  * @brief      Add uniform constant gravity acceleration
  * 	         in y-direction (or x-direction if number of
  * 	         dimensions == 1)
- * @param      particle  The particle being accelerated
+ * @param      rp  Coordinates of the particle being accelerated
  */
 point_t
-acceleration_gravity(const body & particle) {
+acceleration_gravity(const point_t & rp) {
   static const double grav = param::gravity_acceleration_constant;
   point_t acc = 0.0;
   if(gdimension > 1)
@@ -211,15 +225,14 @@ potential_gravity(const point_t & rp) {
  *  - airfoil_attack_angle:   angle of attack - rotation from initial position
  *                            which is parallel to the x-axis.
  *
- * @param      particle  The particle being accelerated
+ * @param      rp  Coordinates of the particle being accelerated
  */
 point_t
-acceleration_airfoil(const body & particle) {
+acceleration_airfoil(const point_t & rp) {
   using namespace param;
   point_t a = 0.0;
   assert(gdimension > 1);
 
-  point_t rp = particle.coordinates();
   const double x1 = rp[0] - airfoil_anchor_x, y1 = rp[1] - airfoil_anchor_y,
                alpha = airfoil_attack_angle * M_PI / 180.0,
                pw_n = extforce_wall_powerindex, pw_a = extforce_wall_steepness;
@@ -235,12 +248,12 @@ acceleration_airfoil(const body & particle) {
   double phi = SQ(upper_surface) - SQ(y - camber_line) + 0.002;
   if(inside_bounding_box && phi > 0.0) {
     double a0, a1;
-    a0 = pw_n * pw_a * pow(phi, pw_n - 1) *
+    a0 = pw_n * pw_a * wall_pow(phi, 1) *
          (2. * (y - camber_line) *
              (-airfoil_camber * M_PI / 2. * cos(M_PI / 2. * x)) -
            airfoil_thickness * airfoil_thickness * 2 * x *
              (airfoil_size * airfoil_size - 2 * x * x));
-    a1 = pw_n * pw_a * pow(phi, pw_n - 1) * 2. * (y - camber_line);
+    a1 = pw_n * pw_a * wall_pow(phi, 1) * 2. * (y - camber_line);
     a[0] = a0 * cos(alpha) - a1 * sin(alpha);
     a[1] = a0 * sin(alpha) + a1 * cos(alpha);
   }
@@ -254,7 +267,6 @@ potential_airfoil(const point_t & rp) {
   assert(gdimension > 1);
 
   static const double alpha = airfoil_attack_angle * M_PI / 180.0,
-                      pw_n = extforce_wall_powerindex,
                       pw_a = extforce_wall_steepness;
   const double x1 = rp[0] - airfoil_anchor_x, y1 = rp[1] - airfoil_anchor_y;
   const double x = x1 * cos(alpha) + y1 * sin(alpha),
@@ -268,7 +280,7 @@ potential_airfoil(const point_t & rp) {
   double camber_line = airfoil_camber * sin(M_PI * x / 2.);
   double aux = SQ(upper_surface) - SQ(y - camber_line) + 0.002;
   if(inside_bounding_box && aux > 0.0)
-    phi = pw_a * pow(aux, pw_n);
+    phi = pw_a * wall_pow(aux, 0);
   return phi;
 }
 
@@ -276,12 +288,11 @@ potential_airfoil(const point_t & rp) {
  * @brief      Add orbital gravitational and centrifugal acceleration
  *             in x-direction
  *
- * @param      particle  The particle being accelerated
+ * @param      rp  Coordinates of the particle being accelerated
  */
 point_t
-acceleration_orbit(const body & particle) {
+acceleration_orbit(const point_t & rp) {
   using namespace param;
-  point_t rp = particle.coordinates();
 
   static const double grav = gravitational_constant, a_sp = orbital_separation,
                       m_ns = mass_neutron_star, m_wd = mass_white_dwarf;
@@ -328,32 +339,190 @@ potential_poison(const point_t & rp) {
   return param::zero_potential_poison_value;
 }
 
+/**
+ * @brief      No acceleration, for the potential-only terms
+ * @param      rp  Point coordinates
+ */
+point_t
+acceleration_zero(const point_t & rp) {
+  return point_t(0.0);
+}
+
+/**
+ * @brief      One external force: acceleration A and potential P. The
+ *             functions are template arguments, their calls are inlined.
+ */
+template<unsigned BIT, acceleration_t A, potential_t P>
+struct force_t {
+  static constexpr unsigned bit = BIT;
+  static point_t acceleration(const point_t & rp) {
+    return A(rp);
+  }
+  static double potential(const point_t & rp) {
+    return P(rp);
+  }
+};
+
+using walls_x_t = force_t<1 << 0,
+  acceleration_square_well<0>,
+  potential_square_well<0>>;
+using walls_y_t = force_t<1 << 1,
+  acceleration_square_well<1>,
+  potential_square_well<1>>;
+using walls_z_t = force_t<1 << 2,
+  acceleration_square_well<2>,
+  potential_square_well<2>>;
+using spherical_wall_t = force_t<1 << 3,
+  acceleration_spherical_wall,
+  potential_spherical_wall>;
+using airfoil_t = force_t<1 << 4, acceleration_airfoil, potential_airfoil>;
+using spherical_density_support_t = force_t<1 << 5,
+  acceleration_spherical_density_support,
+  potential_spherical_density_support>;
+using gravity_t = force_t<1 << 6, acceleration_gravity, potential_gravity>;
+using orbit_t = force_t<1 << 7, acceleration_orbit, potential_orbit>;
+using poison_t = force_t<1 << 8, acceleration_zero, potential_poison>;
+
+/**
+ * @brief      Sum of the external forces F, compiled into one function
+ */
+template<typename... F>
+struct composition_t {
+  static constexpr unsigned mask = (0u | ... | F::bit);
+  static point_t acceleration(const point_t & rp) {
+    point_t a = 0.0;
+    ((a += F::acceleration(rp)), ...);
+    return a;
+  }
+  static double potential(const point_t & rp) {
+    return (0.0 + ... + F::potential(rp));
+  }
+  static void add_acceleration(std::vector<body> & bodies) {
+    if constexpr(sizeof...(F) > 0)
+      for(auto & b : bodies)
+        b.setAcceleration(
+          b.getAcceleration() + acceleration(b.coordinates()));
+  }
+};
+
+/**
+ * @brief      Any other combination: sum over the selected functions
+ */
+struct runtime_composition_t {
+  static point_t acceleration(const point_t & rp) {
+    point_t a = 0.0;
+    for(auto p : vec_accelerations)
+      a += (*p)(rp);
+    return a;
+  }
+  static double potential(const point_t & rp) {
+    double phi = 0.0;
+    for(auto p : vec_potentials)
+      phi += (*p)(rp);
+    return phi;
+  }
+  static void add_acceleration(std::vector<body> & bodies) {
+    for(auto & b : bodies)
+      b.setAcceleration(b.getAcceleration() + acceleration(b.coordinates()));
+  }
+};
+
+// compiled combinations: the single forces and the ones of the examples
+// in data/, the others are summed at runtime
+using compiled_t = std::tuple<composition_t<>,
+  composition_t<walls_x_t>,
+  composition_t<walls_y_t>,
+  composition_t<walls_z_t>,
+  composition_t<spherical_wall_t>,
+  composition_t<airfoil_t>,
+  composition_t<spherical_density_support_t>,
+  composition_t<gravity_t>,
+  composition_t<orbit_t>,
+  composition_t<poison_t>,
+  composition_t<walls_x_t, walls_y_t>,
+  composition_t<walls_y_t, walls_z_t>,
+  composition_t<walls_x_t, walls_y_t, walls_z_t>,
+  composition_t<walls_y_t, gravity_t>,
+  composition_t<walls_x_t, walls_y_t, gravity_t>,
+  composition_t<walls_x_t, walls_y_t, walls_z_t, gravity_t>,
+  composition_t<airfoil_t, walls_x_t, walls_y_t>>;
+
+// the selected composition
+static acceleration_t acceleration_ = composition_t<>::acceleration;
+static potential_t potential_ = composition_t<>::potential;
+static add_acceleration_t add_acceleration_ = composition_t<>::add_acceleration;
+
+/**
+ * @brief      Use the composition C
+ */
+template<typename C>
+void
+set_composition() {
+  acceleration_ = C::acceleration;
+  potential_ = C::potential;
+  add_acceleration_ = C::add_acceleration;
+}
+
+/**
+ * @brief      Use the compiled combination of the forces in mask, if any
+ * @return     false if the combination is not compiled
+ */
+template<size_t I = 0>
+bool
+set_compiled_composition(const unsigned & mask) {
+  if constexpr(I < std::tuple_size<compiled_t>::value) {
+    using composition = typename std::tuple_element<I, compiled_t>::type;
+    if(composition::mask == mask) {
+      set_composition<composition>();
+      return true;
+    }
+    return set_compiled_composition<I + 1>(mask);
+  }
+  return false;
+}
+
 /**
  * @brief      Total external force at a point 'srch'
  * @param      particle  Accelerated particle
  */
-point_t
+inline point_t
 acceleration(const body & particle) {
-  point_t a = 0.0;
-  for(auto p : vec_accelerations)
-    a += (*p)(particle);
-  return a;
+  return acceleration_(particle.coordinates());
 }
 
 /**
  * @brief      Total external potential
  * @param      coords  Coordinates of where to compute the potential
  */
-double
+inline double
 potential(const point_t & coords) {
-  double phi = 0.0;
-  for(auto p : vec_potentials)
-    phi += (*p)(coords);
-  return phi;
+  return potential_(coords);
+}
+
+/**
+ * @brief      Add the total external force to the acceleration of all the
+ *             bodies, in one pass after the hydro traversal
+ * @param      bodies  Accelerated particles
+ */
+inline void
+add_acceleration(std::vector<body> & bodies) {
+  add_acceleration_(bodies);
 }
 
 /**
- * @brief      External force selector
+ * @brief      Add the force F to the selection
+ */
+template<typename F>
+void
+select_force(unsigned & mask) {
+  vec_potentials.push_back(F::potential);
+  vec_accelerations.push_back(F::acceleration);
+  mask |= F::bit;
+}
+
+/**
+ * @brief      External force selector: the combination of forces is
+ *             resolved to a compiled composition when possible
  * @param      efstr    ext. force string
  */
 void
@@ -361,6 +530,12 @@ select(const std::string & efstr) {
 
   vec_potentials.clear();
   vec_accelerations.clear();
+  set_composition<composition_t<>>();
+
+  const double pw_n = param::extforce_wall_powerindex;
+  wall_powerindex = (pw_n == std::floor(pw_n) and pw_n >= 1. and pw_n <= 16.)
+                      ? int(pw_n)
+                      : -1;
 
   if(boost::iequals(efstr, "zero") or boost::iequals(efstr, "none"))
     return; // trivial case
@@ -370,67 +545,71 @@ select(const std::string & efstr) {
   // parse efstr: external force specification string is a comma-separated
   // list of potentials / accelerations which need to be added up: e.g.
   // "spherical wall,walls:xyz,gravity"
+  unsigned mask = 0;
+  bool duplicate = false;
   std::vector<string> split_efstr;
   boost::split(split_efstr, efstr, boost::is_any_of(","));
   for(auto it = split_efstr.begin(); it != split_efstr.end(); ++it) {
+    const unsigned previous = mask;
     if(boost::iequals(*it, "spherical wall")) {
-      vec_potentials.push_back(potential_spherical_wall);
-      vec_accelerations.push_back(acceleration_spherical_wall);
+      select_force<spherical_wall_t>(mask);
     }
     else if(boost::iequals(*it, "airfoil")) {
-      vec_potentials.push_back(potential_airfoil);
-      vec_accelerations.push_back(acceleration_airfoil);
+      select_force<airfoil_t>(mask);
     }
     else if(boost::iequals(*it, "spherical density support")) {
       density_profiles::select();
-      vec_potentials.push_back(potential_spherical_density_support);
-      vec_accelerations.push_back(acceleration_spherical_density_support);
+      select_force<spherical_density_support_t>(mask);
     }
     else if(boost::iequals(*it, "gravity")) {
-      vec_potentials.push_back(potential_gravity);
-      vec_accelerations.push_back(acceleration_gravity);
+      select_force<gravity_t>(mask);
     }
     else if(boost::iequals(*it, "orbit")) {
-      vec_potentials.push_back(potential_orbit);
-      vec_accelerations.push_back(acceleration_orbit);
+      select_force<orbit_t>(mask);
     }
     else if(boost::iequals(it->substr(0, 6), "walls:")) {
       // parse in which directions to place the walls
       // this can be e.g. "walls:xyz" or "walls:y" etc.
-      const char * cxyz = it->substr(6).c_str();
-      char imx = min(3, (int)it->substr(6).length());
-      for(int i = 0; i < imx; ++i) {
-        switch(cxyz[i]) {
+      const std::string xyz = it->substr(6);
+      const size_t imx = min(size_t(3), xyz.length());
+      for(size_t i = 0; i < imx; ++i) {
+        const unsigned walls = mask;
+        switch(xyz[i]) {
           case 'x':
           case 'X':
-            vec_potentials.push_back(potential_walls_x);
-            vec_accelerations.push_back(acceleration_walls_x);
+            select_force<walls_x_t>(mask);
             break;
           case 'y':
           case 'Y':
-            vec_potentials.push_back(potential_walls_y);
-            vec_accelerations.push_back(acceleration_walls_y);
+            select_force<walls_y_t>(mask);
             break;
           case 'z':
           case 'Z':
-            vec_potentials.push_back(potential_walls_z);
-            vec_accelerations.push_back(acceleration_walls_z);
+            select_force<walls_z_t>(mask);
             break;
           default:
             log_fatal("ERROR: bad external_force_type" << std::endl);
             assert(false);
         }
+        duplicate = duplicate || mask == walls;
       }
+      continue;
     }
     else if(boost::iequals(*it, "poison")) {
       // zero potential shift
       vec_potentials.push_back(potential_poison);
+      mask |= poison_t::bit;
     }
     else {
       log_fatal("ERROR: bad external_force_type" << std::endl);
     }
+    duplicate = duplicate || mask == previous;
   } // for it in split_efstr
 
+  // a force given twice is counted twice, as in the runtime sum
+  if(duplicate or not set_compiled_composition(mask))
+    set_composition<runtime_composition_t>();
+
 } // select()
 
 /**
@@ -37,6 +37,7 @@
 #endif
 
 #include "eos_consts.h"
+#include "eos_tab.h"
 
 namespace eos {
 using namespace param;
@@ -51,6 +52,21 @@ constexpr double quartic(const double& x){
   return ((x) * (x) * (x) * (x));
 }
 
+/**
+ * @brief      Particle fields for the batched evaluation of the EOS:
+ *             arrays of n values, the first four are read, pressure and
+ *             sound speed are written
+ */
+struct arrays_t {
+  size_t n;
+  const double * density;
+  const double * internalenergy;
+  const double * electronfraction;
+  const double * adiabatic;
+  double * pressure;
+  double * soundspeed;
+};
+
 template<param::eos_type_keyword>
 class eos_t{};
 
@@ -142,6 +158,23 @@ public:
     particle.setInternalenergy(eps);
   }
 
+  /**
+  * @brief      Pressure and sound speed of arrays of particles
+  *
+  * @param      a     The particle arrays
+  */
+  static void
+  compute_arrays(const arrays_t & a) {
+    const double gam = poly_gamma;
+#pragma omp simd
+    for(size_t i = 0; i < a.n; ++i) {
+      const double rho = a.density[i];
+      const double P = a.adiabatic[i]*pow(rho, gam);
+      a.pressure[i] = P;
+      a.soundspeed[i] = sqrt(gam*P/square(rho));
+    }
+  }
+
 }; // ...<eos_polytropic>
 
 
@@ -206,6 +239,22 @@ public:
   compute_adiabatic(body & particle){
     eos_t<param::eos_polytropic>::compute_adiabatic(particle);
   }
+
+  /**
+  * @brief      Pressure and sound speed of arrays of particles
+  *
+  * @param      a     The particle arrays
+  */
+  static void
+  compute_arrays(const arrays_t & a) {
+    const double gam = poly_gamma;
+#pragma omp simd
+    for(size_t i = 0; i < a.n; ++i) {
+      const double eps = a.internalenergy[i];
+      a.pressure[i] = (gam - 1.)*a.density[i]*eps;
+      a.soundspeed[i] = sqrt(gam*(gam - 1.)*eps);
+    }
+  }
 }; // ...<eos_ideal>
 
 
@@ -310,6 +359,26 @@ public:
     particle.setInternalenergy(eps);
   }
 
+  /**
+  * @brief      Pressure and sound speed of arrays of particles: the cube
+  *             root and the square root are shared by both
+  *
+  * @param      a     The particle arrays
+  */
+  static void
+  compute_arrays(const arrays_t & a) {
+#pragma omp simd
+    for(size_t i = 0; i < a.n; ++i) {
+      const double x = cbrt(a.density[i]*a.electronfraction[i]/B_wd_nm);
+      const double x2 = square(x);
+      const double sq = sqrt(x2 + 1.);
+      a.pressure[i] = A_wd*(x*(2.*x2 - 3.)*sq + 3.*asinh(x));
+      const double numer = (1. + x2)*(6.*x2 - 3.) + 3. + x2*(2.*x2 - 3.);
+      const double denom = (1. + x2)*(6.*x2 + 1.) - 1. + x2*(2.*x2 + 1.);
+      a.soundspeed[i] = sqrt(numer/(3.*denom)) * C_LIGHT_CGS;
+    }
+  }
+
 }; // ...<eos_wd>
 
 template<>
@@ -414,12 +483,112 @@ public:
     particle.setInternalenergy(eps);
   }
 
+  /**
+  * @brief      Pressure and sound speed of arrays of particles, without
+  *             branches: the segment only selects the constants
+  *
+  * @param      a     The particle arrays
+  */
+  static void
+  compute_arrays(const arrays_t & a) {
+    const double K2_K1 = pow(rho_thr, poly_gamma - poly_gamma2);
+#pragma omp simd
+    for(size_t i = 0; i < a.n; ++i) {
+      const double rho = a.density[i];
+      const bool low = rho < rho_thr;
+      const double gam = low ? poly_gamma : poly_gamma2;
+      const double K = low ? a.adiabatic[i] : a.adiabatic[i]*K2_K1;
+      const double P = K*pow(rho, gam);
+      a.pressure[i] = P;
+      a.soundspeed[i] = sqrt(gam*P/square(rho));
+    }
+  }
+
 };
 
 // declare static member of a templated class
 template<>
 double eos_t<param::eos_ppt>::rho_thr;
 
+/**
+* @brief      Tabulated equation of state (see eos_tab.h), loaded from
+*             eos_tab_file_path when selected. Pressure, sound speed and
+*             temperature are interpolated in (rho, eps, Ye), the internal
+*             energy in (rho, T, Ye).
+*/
+table_t table;
+
+template<>
+class eos_t<param::eos_tab>{
+public:
+  /**
+  * @brief      Load the table once, shared by the ranks of each node
+  */
+  static void read_data() {
+    if(not table.load(eos_tab_file_path)) {
+      std::cerr << "Could not load the EOS table " << eos_tab_file_path
+                << std::endl;
+      MPI_Finalize();
+      exit(0);
+    }
+  }
+
+  /**
+  * @brief      Temperature consistent with the initial internal energy
+  *
+  * @param      particle
+  */
+  static void init(body & particle) {
+    compute_temperature(particle);
+  }
+
+  static void
+  compute_pressure(body & particle) {
+    particle.setPressure(table.pressure(particle.getDensity(),
+      particle.getInternalenergy(), particle.getElectronfraction()));
+  }
+
+  static void
+  compute_soundspeed(body & particle) {
+    particle.setSoundspeed(table.soundspeed(particle.getDensity(),
+      particle.getInternalenergy(), particle.getElectronfraction()));
+  }
+
+  static void
+  compute_temperature(body & particle) {
+    particle.setTemperature(table.temperature(particle.getDensity(),
+      particle.getInternalenergy(), particle.getElectronfraction()));
+  }
+
+  /**
+  * @brief      Compute specific internal energy from the temperature
+  *
+  * @param      particle
+  */
+  static void
+  compute_internal_energy(body & particle) {
+    particle.setInternalenergy(table.internal_energy(particle.getDensity(),
+      particle.getTemperature(), particle.getElectronfraction()));
+  }
+
+  /**
+  * @brief      Pressure and sound speed of arrays of particles, one table
+  *             lookup per particle
+  *
+  * @param      a     The particle arrays
+  */
+  static void
+  compute_arrays(const arrays_t & a) {
+    for(size_t i = 0; i < a.n; ++i) {
+      const table_t::cell_t & c = table.locate(
+        a.density[i], a.internalenergy[i], a.electronfraction[i]);
+      a.pressure[i] = exp(table.interpolate(table_t::logpress, c));
+      a.soundspeed[i] =
+        sqrt(std::max(0., table.interpolate(table_t::cs2, c)));
+    }
+  }
+}; // ...<eos_tab>
+
 template<>
 class eos_t<param::eos_no_eos>{
 public:
@@ -427,11 +596,13 @@ public:
   static void compute_pressure(body& particle){}
   static void compute_soundspeed(body& particle){}
   static void compute_internal_energy(body& particle){}
+  static void compute_arrays(const arrays_t &){}
 };
 
 // eos function types and pointers
 typedef void (*compute_quantity_t)(body &);
 typedef void (*read_data_t)();
+typedef void (*compute_arrays_t)(const arrays_t &);
 
 #ifdef eos_type
 #  define read_data            eos_t<eos_type>::read_data
@@ -439,6 +610,7 @@ typedef void (*read_data_t)();
 #  define compute_pressure     eos_t<eos_type>::compute_pressure
 #  define compute_soundspeed   eos_t<eos_type>::compute_soundspeed
 #  define compute_temperature  eos_t<eos_type>compute_temperature
+#  define compute_arrays       eos_t<eos_type>::compute_arrays
 #else
 read_data_t read_data = nullptr;
 compute_quantity_t init = nullptr;
@@ -446,11 +618,13 @@ compute_quantity_t compute_pressure = nullptr;
 compute_quantity_t compute_soundspeed = nullptr;
 compute_quantity_t compute_temperature = nullptr;
 compute_quantity_t compute_internal_energy = nullptr;
+compute_arrays_t compute_arrays = nullptr;
 #endif
 
 /**
  * @brief  Installs the 'compute_pressure' and 'compute_soundspeed'
- *         function pointers, depending on the value of eos_type
+ *         function pointers, depending on the value of eos_type.
+ *         The tabulated EOS loads its table here.
  */
 void
 select() {
@@ -463,30 +637,45 @@ select() {
       compute_pressure = eos_t<eos_polytropic>::compute_pressure;
       compute_soundspeed = eos_t<eos_polytropic>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_polytropic>::compute_internal_energy;
+      compute_arrays = eos_t<eos_polytropic>::compute_arrays;
       break;
     case(eos_ideal):
       init = eos_t<eos_ideal>::init;
       compute_pressure = eos_t<eos_ideal>::compute_pressure;
       compute_soundspeed = eos_t<eos_ideal>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_ideal>::compute_internal_energy;
+      compute_arrays = eos_t<eos_ideal>::compute_arrays;
       break;
     case(eos_wd):
       init = eos_t<eos_wd>::init;
       compute_pressure = eos_t<eos_wd>::compute_pressure;
       compute_soundspeed = eos_t<eos_wd>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_wd>::compute_internal_energy;
+      compute_arrays = eos_t<eos_wd>::compute_arrays;
       break;
     case(eos_ppt):
       init = eos_t<eos_ppt>::init;
       compute_pressure = eos_t<eos_ppt>::compute_pressure;
       compute_soundspeed = eos_t<eos_ppt>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_ppt>::compute_internal_energy;
+      compute_arrays = eos_t<eos_ppt>::compute_arrays;
+      break;
+    case(eos_tab):
+      read_data = eos_t<eos_tab>::read_data;
+      init = eos_t<eos_tab>::init;
+      compute_pressure = eos_t<eos_tab>::compute_pressure;
+      compute_soundspeed = eos_t<eos_tab>::compute_soundspeed;
+      compute_temperature = eos_t<eos_tab>::compute_temperature;
+      compute_internal_energy = eos_t<eos_tab>::compute_internal_energy;
+      compute_arrays = eos_t<eos_tab>::compute_arrays;
+      read_data();
       break;
     case(eos_no_eos):
       init = eos_t<eos_no_eos>::init;
       compute_pressure = eos_t<eos_no_eos>::compute_pressure;
       compute_soundspeed = eos_t<eos_no_eos>::compute_soundspeed;
       compute_internal_energy = eos_t<eos_no_eos>::compute_internal_energy;
+      compute_arrays = eos_t<eos_no_eos>::compute_arrays;
       break;
     default:
       std::cerr << "Undefined eos type" << std::endl;
@@ -0,0 +1,404 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2018 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file eos_tab.h
+ * @brief Table of the equation of state in the stellar collapse format
+ *        (see tools/dummyTabEOS/TabGamma.py), in CGS units.
+ *
+ * The file gives log10(P), log10(eps + energy_shift) and cs^2 on a grid
+ * uniform in log10(rho), log10(T) and Ye, with T in MeV. The hydro needs the
+ * pressure and the sound speed as functions of (rho, eps, Ye): when loading,
+ * the table is resampled once on a grid uniform in log10(rho),
+ * log10(eps + energy_shift) and Ye, so that every lookup is a trilinear
+ * interpolation (bilinear with a single Ye) with the cell index computed
+ * from the precomputed inverse spacing, without any search. The logarithms
+ * are converted to natural logarithms when loading.
+ *
+ * The table is read by one rank per node and kept in a MPI shared memory
+ * window: the other ranks of the node read the same copy.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <hdf5.h>
+#include <mpi.h>
+
+namespace eos {
+
+class table_t
+{
+public:
+  // tabulated fields: logenergy on the (ln rho, ln T, Ye) grid, the others
+  // on the (ln rho, ln(eps + energy_shift), Ye) grid
+  enum field_t { logenergy, logpress, cs2, logtemp, nfields };
+
+  /**
+   * @brief Uniform grid in three dimensions, the first one is the fastest
+   */
+  struct grid_t {
+    size_t n[3];
+    double x0[3];
+    double inv_dx[3];
+  };
+
+  bool loaded() const {
+    return data_ != nullptr;
+  }
+
+  /**
+   * @brief      Read and resample the table on the first rank of each node,
+   *             share it with the other ranks of the node
+   *
+   * @param      filename  The HDF5 file of the table
+   *
+   * @return     false if the file can not be used
+   */
+  bool load(const std::string & filename) {
+    free();
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+      MPI_INFO_NULL, &node_comm_);
+    int node_rank;
+    MPI_Comm_rank(node_comm_, &node_rank);
+
+    std::vector<double> values;
+    header_t header = {};
+    if(node_rank == 0)
+      read_(filename, header, values);
+    MPI_Bcast(&header, sizeof(header_t), MPI_BYTE, 0, node_comm_);
+    if(header.size == 0) {
+      MPI_Comm_free(&node_comm_);
+      return false;
+    }
+    grid_temp_ = header.grid_temp;
+    grid_energy_ = header.grid_energy;
+    energy_shift_ = header.energy_shift;
+    size_ = header.size;
+
+    const MPI_Aint win_size =
+      node_rank == 0 ? nfields * size_ * sizeof(double) : 0;
+    double * base;
+    MPI_Win_allocate_shared(win_size, sizeof(double), MPI_INFO_NULL,
+      node_comm_, &base, &win_);
+    MPI_Aint bytes;
+    int disp_unit;
+    MPI_Win_shared_query(win_, 0, &bytes, &disp_unit, &data_);
+    MPI_Win_fence(0, win_);
+    if(node_rank == 0)
+      std::copy(values.begin(), values.end(), data_);
+    MPI_Win_fence(0, win_);
+    generation_ = ++generations_();
+    return true;
+  }
+
+  /**
+   * @brief      Release the shared window
+   */
+  void free() {
+    if(not loaded())
+      return;
+    MPI_Win_free(&win_);
+    MPI_Comm_free(&node_comm_);
+    data_ = nullptr;
+  }
+
+  /**
+   * @brief      Cell of the (rho, eps, Ye) grid and interpolation weights
+   */
+  struct cell_t {
+    double rho, eps, ye;
+    size_t offset;
+    double w[3];
+    uint64_t generation;
+  };
+
+  /**
+   * @brief      Locate (rho, eps, Ye) in the grid. The pressure and the sound
+   *             speed of a particle are computed one after the other: the
+   *             last cell of each thread is reused for the same arguments.
+   *             The cell is shared by all the tables, the generation of the
+   *             load is unique over all of them.
+   */
+  const cell_t & locate(const double & rho,
+    const double & eps,
+    const double & ye) const {
+    static thread_local cell_t cell = {};
+    if(rho == cell.rho and eps == cell.eps and ye == cell.ye and
+       generation_ == cell.generation)
+      return cell;
+    cell.rho = rho;
+    cell.eps = eps;
+    cell.ye = ye;
+    cell.generation = generation_;
+    cell.offset = locate_(grid_energy_, std::log(rho),
+      std::log(eps + energy_shift_), ye, cell.w);
+    return cell;
+  }
+
+  /**
+   * @brief      Interpolate a field of the (rho, eps, Ye) grid in a cell
+   */
+  double interpolate(const field_t & f, const cell_t & cell) const {
+    return interpolate_(grid_energy_, field_(f) + cell.offset, cell.w);
+  }
+
+  /**
+   * @brief      Pressure, sound speed and temperature as functions of the
+   *             density, specific internal energy and electron fraction
+   */
+  double pressure(const double & rho,
+    const double & eps,
+    const double & ye) const {
+    return std::exp(interpolate(logpress, locate(rho, eps, ye)));
+  }
+  double soundspeed(const double & rho,
+    const double & eps,
+    const double & ye) const {
+    return std::sqrt(std::max(0., interpolate(cs2, locate(rho, eps, ye))));
+  }
+  double temperature(const double & rho,
+    const double & eps,
+    const double & ye) const {
+    return std::exp(interpolate(logtemp, locate(rho, eps, ye)));
+  }
+
+  /**
+   * @brief      Specific internal energy as a function of the density,
+   *             temperature and electron fraction
+   */
+  double internal_energy(const double & rho,
+    const double & temp,
+    const double & ye) const {
+    double w[3];
+    const size_t offset =
+      locate_(grid_temp_, std::log(rho), std::log(temp), ye, w);
+    return std::exp(interpolate_(grid_temp_, field_(logenergy) + offset, w)) -
+           energy_shift_;
+  }
+
+  const grid_t & grid() const {
+    return grid_energy_;
+  }
+  double energy_shift() const {
+    return energy_shift_;
+  }
+
+private:
+  struct header_t {
+    grid_t grid_temp;
+    grid_t grid_energy;
+    double energy_shift;
+    size_t size;
+  };
+
+  /**
+   * @brief      Number of tables loaded by the program
+   */
+  static std::atomic<uint64_t> & generations_() {
+    static std::atomic<uint64_t> generations(0);
+    return generations;
+  }
+
+  const double * field_(const field_t & f) const {
+    return data_ + f * size_;
+  }
+
+  /**
+   * @brief      Offset of the cell of (x, y, z) and the weights, clamped to
+   *             the table
+   */
+  static size_t locate_(const grid_t & g,
+    const double & x,
+    const double & y,
+    const double & z,
+    double w[3]) {
+    const double p[3] = {x, y, z};
+    size_t offset = 0, stride = 1;
+    for(int d = 0; d < 3; ++d) {
+      size_t i = 0;
+      w[d] = 0.;
+      if(g.n[d] > 1) {
+        const double s = std::min(
+          std::max((p[d] - g.x0[d]) * g.inv_dx[d], 0.), double(g.n[d] - 1));
+        i = std::min(size_t(s), g.n[d] - 2);
+        w[d] = s - i;
+      }
+      offset += i * stride;
+      stride *= g.n[d];
+    }
+    return offset;
+  }
+
+  /**
+   * @brief      Bilinear interpolation in the first two dimensions,
+   *             trilinear if the grid has more than one point in the third
+   */
+  static double interpolate_(const grid_t & g,
+    const double * c,
+    const double w[3]) {
+    const size_t sy = g.n[0], sz = g.n[0] * g.n[1];
+    double v = (1. - w[1]) * ((1. - w[0]) * c[0] + w[0] * c[1]) +
+               w[1] * ((1. - w[0]) * c[sy] + w[0] * c[sy + 1]);
+    if(g.n[2] > 1) {
+      c += sz;
+      v = (1. - w[2]) * v +
+          w[2] * ((1. - w[1]) * ((1. - w[0]) * c[0] + w[0] * c[1]) +
+                   w[1] * ((1. - w[0]) * c[sy] + w[0] * c[sy + 1]));
+    }
+    return v;
+  }
+
+  /**
+   * @brief      Uniform grid from the values of an axis of the table
+   */
+  static bool make_axis_(grid_t & g,
+    const int & d,
+    const std::vector<double> & x) {
+    g.n[d] = x.size();
+    g.x0[d] = x.empty() ? 0. : x[0];
+    g.inv_dx[d] = 0.;
+    if(x.size() < 2)
+      return not x.empty();
+    const double dx = (x.back() - x[0]) / (x.size() - 1);
+    if(not(dx > 0.))
+      return false;
+    for(size_t i = 0; i < x.size(); ++i)
+      if(std::fabs(x[i] - x[0] - i * dx) > 1.e-6 * dx)
+        return false;
+    g.inv_dx[d] = 1. / dx;
+    return true;
+  }
+
+  static bool read_dataset_(const hid_t & file,
+    const char * name,
+    std::vector<double> & values) {
+    hid_t dataset = H5Dopen2(file, name, H5P_DEFAULT);
+    if(dataset < 0)
+      return false;
+    hid_t space = H5Dget_space(dataset);
+    values.resize(H5Sget_simple_extent_npoints(space));
+    herr_t status = H5Dread(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL,
+      H5P_DEFAULT, values.data());
+    H5Sclose(space);
+    H5Dclose(dataset);
+    return status >= 0;
+  }
+
+  /**
+   * @brief      Read the file and resample the pressure, sound speed and
+   *             temperature in (log rho, log(eps + energy_shift), Ye).
+   *             header.size is zero on failure.
+   */
+  static void read_(const std::string & filename,
+    header_t & header,
+    std::vector<double> & values) {
+    header.size = 0;
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if(file < 0) {
+      std::cerr << "EOS table: can not open " << filename << std::endl;
+      return;
+    }
+    std::vector<double> lrho, ltemp, ye, shift, le, lp, c2;
+    bool ok = read_dataset_(file, "logrho", lrho) &&
+              read_dataset_(file, "logtemp", ltemp) &&
+              read_dataset_(file, "ye", ye) &&
+              read_dataset_(file, "energy_shift", shift) &&
+              read_dataset_(file, "logenergy", le) &&
+              read_dataset_(file, "logpress", lp) &&
+              read_dataset_(file, "cs2", c2);
+    H5Fclose(file);
+    grid_t & gt = header.grid_temp;
+    ok = ok && make_axis_(gt, 0, lrho) && make_axis_(gt, 1, ltemp) &&
+         make_axis_(gt, 2, ye) && gt.n[0] > 1 && gt.n[1] > 1;
+    const size_t size = lrho.size() * ltemp.size() * ye.size();
+    ok = ok && le.size() == size && lp.size() == size && c2.size() == size;
+    if(not ok) {
+      std::cerr << "EOS table: " << filename
+                << " is not a table in the stellar collapse format"
+                << " on a uniform grid" << std::endl;
+      return;
+    }
+
+    // energy axis over the whole range of the table, same number of points
+    const size_t nr = gt.n[0], nt = gt.n[1], nye = gt.n[2];
+    grid_t & ge = header.grid_energy;
+    ge = gt;
+    const double le_min = *std::min_element(le.begin(), le.end());
+    const double le_max = *std::max_element(le.begin(), le.end());
+    const double dle = (le_max - le_min) / (nt - 1);
+    ge.x0[1] = le_min;
+    ge.inv_dx[1] = 1. / dle;
+
+    // log(eps) increases with T along each column: march the temperature
+    // cells with the energy of the new grid
+    values.assign(nfields * size, 0.);
+    double * v_le = values.data() + logenergy * size;
+    double * v_lp = values.data() + logpress * size;
+    double * v_c2 = values.data() + cs2 * size;
+    double * v_lt = values.data() + logtemp * size;
+    std::copy(le.begin(), le.end(), v_le);
+    for(size_t k = 0; k < nye; ++k)
+      for(size_t i = 0; i < nr; ++i) {
+        const size_t col = i + k * nr * nt;
+        size_t j = 0;
+        for(size_t m = 0; m < nt; ++m) {
+          const double e = le_min + m * dle;
+          while(j < nt - 2 && le[col + (j + 1) * nr] < e)
+            ++j;
+          const double e0 = le[col + j * nr], e1 = le[col + (j + 1) * nr];
+          const double w =
+            std::min(std::max(e1 > e0 ? (e - e0) / (e1 - e0) : 0., 0.), 1.);
+          const size_t s0 = col + j * nr, s1 = s0 + nr, d = col + m * nr;
+          v_lp[d] = (1. - w) * lp[s0] + w * lp[s1];
+          v_c2[d] = (1. - w) * c2[s0] + w * c2[s1];
+          v_lt[d] = ltemp[j] + w * (ltemp[j + 1] - ltemp[j]);
+        } // for m
+      } // for i
+    // natural logarithms for the lookups
+    for(size_t f = logenergy; f < nfields; ++f)
+      if(f != cs2)
+        for(size_t i = f * size; i < (f + 1) * size; ++i)
+          values[i] *= M_LN10;
+    for(grid_t * g : {&gt, &ge})
+      for(int d = 0; d < 2; ++d) {
+        g->x0[d] *= M_LN10;
+        g->inv_dx[d] /= M_LN10;
+      }
+    header.energy_shift = shift[0];
+    header.size = size;
+  }
+
+  grid_t grid_temp_ = {};
+  grid_t grid_energy_ = {};
+  double energy_shift_ = 0.;
+  size_t size_ = 0;
+  double * data_ = nullptr;
+  uint64_t generation_ = 0;
+  MPI_Win win_;
+  MPI_Comm node_comm_;
+}; // class table_t
+
+} // namespace eos
@@ -23,12 +23,35 @@
 
 #pragma once
 
+#include <cmath>
+
 #include "params.h"
 #include "tree.h"
 
 namespace fmm {
 using namespace param;
 double gc = gravitational_constant;
+// Split scale of the TreePM force (pm.h), 0 for the pure tree gravitation
+double r_split = 0.;
+// Gravity subcycling: times of the last two FMM solves and number of solves
+double gsolve_time = 0.;
+double gsolve_time_prev = 0.;
+int64_t gsolve_count = 0;
+
+/*
+ * @brief Short-range factors of the TreePM split for the potential and the
+ *        acceleration at distance d, both 1 without split
+ */
+inline void
+split_factors(const double & d, double & fpot, double & facc) {
+  fpot = 1.;
+  facc = 1.;
+  if(r_split > 0.) {
+    double u = d / (2. * r_split);
+    fpot = std::erfc(u);
+    facc = fpot + 2. * u / std::sqrt(M_PI) * std::exp(-u * u);
+  }
+}
 
 /*
  * @brief Compute gravitation interaction between two points
@@ -40,8 +63,11 @@ gravitation_p2p(double & gpot,
   const point_t & dist_coordinates,
   const double & sm) {
   double dist = flecsi::distance(local_coordinates,dist_coordinates);
-  gpot += -gc*sm/dist;
-  point_t res =-gc*sm/(dist*dist*dist)*(local_coordinates - dist_coordinates);
+  double fpot, facc;
+  split_factors(dist, fpot, facc);
+  gpot += -gc*sm*fpot/dist;
+  point_t res =-gc*sm*facc/(dist*dist*dist)*
+    (local_coordinates - dist_coordinates);
   return res;
 }
 
@@ -56,10 +82,12 @@ gravitation_fc(double & pc,
   const point_t & dist_coordinates = source->coordinates();
   const double M = source->mass();
   double d = flecsi::distance(local_coordinates,dist_coordinates);
-  double d3 = d*d*d;
+  double fpot, facc;
+  split_factors(d, fpot, facc);
+  double d3 = d*d*d/facc;
   point_t r = local_coordinates - dist_coordinates;
 
-  pc += -gc*M/d;
+  pc += -gc*M*fpot/d;
   for(int m = 0; m < gdimension; ++m) {
     fc[m] += -gc*M*r[m]/d3; // Monopole
   }
@@ -76,9 +104,11 @@ gravitation_fc(double & pc,
   const point_t & dist_coordinates = source->coordinates();
   const double M = source->mass();
   double d = flecsi::distance(local_coordinates,dist_coordinates);
-  double d3 = d*d*d;
+  double fpot, facc;
+  split_factors(d, fpot, facc);
+  double d3 = d*d*d/facc;
   point_t r = local_coordinates-dist_coordinates;
-  pc += -gc*M/d;
+  pc += -gc*M*fpot/d;
   for(int m = 0; m < gdimension; ++m){
     fc[m] += -gc*M*r[m]/d3; // Monopole
   }
@@ -158,4 +188,113 @@ taylor_p2c(node * sink, const body * source) {
   gravitation_fc(sink->pc(), sink->fc(), sink->coordinates(), source);
 }
 
+/**
+ * @brief Mutual node-node interaction: a single evaluation of the monopole
+ *        term updates the Taylor expansion coefficients of both nodes.
+ *        Used for pairs of locally owned nodes in the mutual FMM traversal.
+ */
+void
+taylor_c2c_mutual(node * n1, node * n2) {
+  point_t r = n1->coordinates() - n2->coordinates();
+  double d = flecsi::magnitude(r);
+  double fpot, facc;
+  split_factors(d, fpot, facc);
+  double gd = gc * fpot / d;
+  double gd3 = gc * facc / (d * d * d);
+  n1->pc() += -gd * n2->mass();
+  n2->pc() += -gd * n1->mass();
+  for(int m = 0; m < gdimension; ++m) {
+    n1->fc()[m] += -gd3 * n2->mass() * r[m];
+    n2->fc()[m] += gd3 * n1->mass() * r[m];
+  }
+}
+
+/**
+ * @brief Mutual node-particle interaction: update the Taylor expansion
+ *        coefficients of the node and directly add the monopole contribution
+ *        of the node to the particle.
+ */
+void
+taylor_p2c_mutual(node * sink, body * source) {
+  point_t r = sink->coordinates() - source->coordinates();
+  double d = flecsi::magnitude(r);
+  double fpot, facc;
+  split_factors(d, fpot, facc);
+  double gd = gc * fpot / d;
+  double gd3 = gc * facc / (d * d * d);
+  sink->pc() += -gd * source->mass();
+  for(int m = 0; m < gdimension; ++m) {
+    sink->fc()[m] += -gd3 * source->mass() * r[m];
+  }
+  source->setGPotential(source->getGPotential() - gd * sink->mass());
+  source->setGAcceleration(
+    source->getGAcceleration() + gd3 * sink->mass() * r);
+}
+
+/**
+ * @brief Mutual particle-particle interaction: the pair distance is computed
+ *        once and both particles are updated
+ */
+void
+fmm_p2p_mutual(body * p, body * q) {
+  if(p->id() == q->id())
+    return;
+  point_t r = p->coordinates() - q->coordinates();
+  double d = flecsi::magnitude(r);
+  double fpot, facc;
+  split_factors(d, fpot, facc);
+  double gd = gc * fpot / d;
+  double gd3 = gc * facc / (d * d * d);
+  p->setGPotential(p->getGPotential() - gd * q->mass());
+  q->setGPotential(q->getGPotential() - gd * p->mass());
+  p->setGAcceleration(p->getGAcceleration() - gd3 * q->mass() * r);
+  q->setGAcceleration(q->getGAcceleration() + gd3 * p->mass() * r);
+}
+
+/**
+ * @brief Record the time of an FMM solve, before gravity_save
+ */
+void
+gravity_solved(const double & time) {
+  gsolve_time_prev = gsolve_time;
+  gsolve_time = time;
+  ++gsolve_count;
+}
+
+/**
+ * @brief Store the gravitational field of a particle after an FMM solve, the
+ *        acceleration of the previous solve is kept
+ */
+void
+gravity_save(body & particle) {
+  particle.setGSolve(particle.coordinates(), particle.getGAcceleration(),
+    particle.getGPotential());
+}
+
+/**
+ * @brief Extrapolate the gravitational field of a particle at time from the
+ *        last two FMM solves. The acceleration is extrapolated to first
+ *        order in time, from its variation between the two solves (held
+ *        constant after the first solve). The potential follows with the
+ *        first order expansion of interaction_c2p along the displacement of
+ *        the particle since the last solve, with the mean acceleration.
+ */
+void
+gravity_extrapolate(body & particle, const double & time) {
+  const point_t & fc = particle.getGSolveAcceleration();
+  point_t acc = fc;
+  if(gsolve_count > 1 && gsolve_time > gsolve_time_prev) {
+    const double s =
+      (time - gsolve_time) / (gsolve_time - gsolve_time_prev);
+    acc += s * (fc - particle.getGPrevAcceleration());
+  }
+  point_t r = particle.coordinates() - particle.getGSolveCoordinates();
+  double pot = particle.getGSolvePotential();
+  for(int i = 0; i < gdimension; ++i) {
+    pot += -.5 * r[i] * (fc[i] + acc[i]);
+  }
+  particle.setGPotential(pot);
+  particle.setGAcceleration(acc);
+}
+
 } // namespace fmm
@@ -26,11 +26,19 @@
 #ifndef _integration_h_
 #define _integration_h_
 
+#include <cstdint>
 #include <vector>
 
 #include "default_physics.h"
 #include "params.h"
 
+namespace physics {
+// defined in default_physics.h, after this file
+void check_nans(body &);
+void check_negativity(body &);
+void compute_dt(body &);
+} // namespace physics
+
 namespace integration {
 using namespace param;
 
@@ -109,6 +117,220 @@ leapfrog_drift(body & source) {
     source.coordinates() + physics::dt * source.getVelocity());
 }
 
+/**
+ * @brief      Fused first half of the leapfrog step, one sweep over the
+ *             particles instead of four: kick velocity and energy, save the
+ *             half-step velocity, drift
+ *
+ * @param      source  The particle
+ */
+void
+leapfrog_kick_drift(body & source) {
+  leapfrog_kick_v(source);
+  if(evolve_internal_energy) {
+    if(thermokinetic_formulation)
+      leapfrog_kick_e(source);
+    else
+      leapfrog_kick_u(source);
+  }
+  save_velocityhalf(source);
+  leapfrog_drift(source);
+}
+
+/**
+ * @brief      Fused end of the leapfrog step: last kick, NaN and negativity
+ *             checks and timestep of the particle. The last kick is the
+ *             energy one when the energy is evolved (the velocity kick comes
+ *             before the energy pass), the velocity one otherwise.
+ *
+ * @param      source  The particle
+ */
+void
+leapfrog_kick_check_dt(body & source) {
+  if(evolve_internal_energy) {
+    if(thermokinetic_formulation)
+      leapfrog_kick_e(source);
+    else
+      leapfrog_kick_u(source);
+  }
+  else
+    leapfrog_kick_v(source);
+  physics::check_nans(source);
+  physics::check_negativity(source);
+  if(adaptive_timestep)
+    physics::compute_dt(source);
+}
+
+/**
+ * Hierarchical block timesteps (block_timesteps): the particles of rung k
+ * advance with the step initial_dt / 2^k, k < block_timestep_rungs. Time is
+ * counted in ticks of the smallest step and the steps of a particle start
+ * at the multiples of its length: a particle is kicked and computes its
+ * forces only at the ends of its steps (block_starts and block_ends, the
+ * predicates of body_system::apply_all_if). All the particles are drifted
+ * at every substep, from block_tick to block_tick_next, the next end of a
+ * step.
+ * Neighbor limiter: a particle stays at most block_timestep_rung_gap rungs
+ * below its neighbors. The rungs follow at the end of the steps
+ * (block_set_rung); a particle that a faster neighbor reaches in the middle
+ * of its step is woken, its step ends at the current substep (block_wake).
+ */
+uint64_t block_tick = 0;
+uint64_t block_tick_next = 0;
+
+/**
+ * @brief      Length of the block step of a particle, in ticks
+ */
+uint64_t
+block_length(const body & source) {
+  return uint64_t(1) << (block_timestep_rungs - 1 - source.getRung());
+}
+
+/**
+ * @brief      A neighbor is more than block_timestep_rung_gap rungs above
+ *             the particle, from the last density pass
+ */
+bool
+block_limited(const body & source) {
+  return source.getNeighborRung() - block_timestep_rung_gap >
+         source.getRung();
+}
+
+/**
+ * @brief      Block step of a particle: its full step, or the part of it
+ *             until the current substep when it is woken
+ */
+double
+block_dt(const body & source) {
+  const uint64_t length = block_length(source);
+  const uint64_t start = block_tick / length * length;
+  const uint64_t end = block_limited(source) ? block_tick_next : start + length;
+  return (end - start) * initial_dt / (1 << (block_timestep_rungs - 1));
+}
+
+/**
+ * @brief      The step of the particle starts at the current substep
+ */
+bool
+block_starts(const body & source) {
+  return block_tick % block_length(source) == 0;
+}
+
+/**
+ * @brief      The step of the particle ends with the current substep, at
+ *             its end or woken by the neighbor limiter
+ */
+bool
+block_ends(const body & source) {
+  return block_tick_next % block_length(source) == 0 ||
+         block_limited(source);
+}
+
+/**
+ * @brief      Leapfrog kicks with the block step of the particle: same as
+ *             leapfrog_kick_v, leapfrog_kick_u and leapfrog_kick_e
+ *
+ * @param      source  The particle
+ */
+void
+block_kick_v(body & source) {
+  source.setVelocity(source.getVelocity() +
+                     0.5 * block_dt(source) *
+                       (source.getAcceleration() + source.getGAcceleration()));
+}
+
+void
+block_kick_u(body & source) {
+  source.setInternalenergy(
+    source.getInternalenergy() + 0.5 * block_dt(source) * source.getDudt());
+}
+
+void
+block_kick_e(body & source) {
+  source.setTotalenergy(
+    source.getTotalenergy() + 0.5 * block_dt(source) * source.getDedt());
+}
+
+/**
+ * @brief      Neighbor limiter: wake a particle in the middle of its step,
+ *             after the density pass of the substep found a neighbor too
+ *             far above it. The kick one and the drifts assumed the full
+ *             step: the kick is brought back to the elapsed part of the step
+ *             and the position to the drift with this kick, the kick two of
+ *             the substep then ends the shortened step.
+ *
+ * @param      source  The particle
+ */
+void
+block_wake(body & source) {
+  const uint64_t length = block_length(source);
+  if(block_tick_next % length == 0 || !block_limited(source))
+    return;
+  const double tick = initial_dt / (1 << (block_timestep_rungs - 1));
+  const uint64_t start = block_tick / length * length;
+  const double elapsed = (block_tick_next - start) * tick;
+  const double cut = 0.5 * (length * tick - elapsed);
+  const point_t acc = source.getAcceleration() + source.getGAcceleration();
+  source.setVelocity(source.getVelocity() - cut * acc);
+  source.setVelocityhalf(source.getVelocityhalf() - cut * acc);
+  source.set_coordinates(source.coordinates() - cut * elapsed * acc);
+  if(evolve_internal_energy) {
+    if(thermokinetic_formulation)
+      source.setTotalenergy(source.getTotalenergy() - cut * source.getDedt());
+    else
+      source.setInternalenergy(
+        source.getInternalenergy() - cut * source.getDudt());
+  }
+}
+
+/**
+ * @brief      Rung of a particle at the end of its step, from its dt: the
+ *             largest block step below dt that starts at the current time,
+ *             and at most block_timestep_rung_gap rungs below its
+ *             neighbors. Stops with a fatal error when dt is below the
+ *             smallest block step, initial_dt / 2^(block_timestep_rungs - 1)
+ *
+ * @param      source  The particle
+ */
+void
+block_set_rung(body & source) {
+  int rung = 0;
+  while(rung < block_timestep_rungs - 1 &&
+        initial_dt / (1 << rung) > source.getDt())
+    ++rung;
+  if(initial_dt / (1 << rung) > source.getDt()) {
+    log_fatal("particle " << source.id() << ": dt = " << source.getDt()
+                          << " is below the smallest block step "
+                          << initial_dt / (1 << rung)
+                          << ", increase block_timestep_rungs");
+  }
+  rung = std::max(rung, source.getNeighborRung() - block_timestep_rung_gap);
+  source.setRung(rung);
+  while(block_tick_next % block_length(source) != 0)
+    source.setRung(++rung);
+}
+
+/**
+ * @brief      Move to the next substep: the earliest end of a step among
+ *             all the particles, and set the timestep of the drift
+ *
+ * @param      bodies  The local particles
+ */
+void
+block_advance(std::vector<body> & bodies) {
+  block_tick = block_tick_next;
+  uint64_t next = block_tick + (uint64_t(1) << (block_timestep_rungs - 1));
+  for(auto & b : bodies) {
+    const uint64_t length = block_length(b);
+    next = std::min(next, (block_tick / length + 1) * length);
+  }
+  mpi_utils::reduce_min(next);
+  block_tick_next = next;
+  physics::dt =
+    (next - block_tick) * initial_dt / (1 << (block_timestep_rungs - 1));
+  physics::totaltime_next = physics::totaltime + physics::dt;
+}
+
 }; // namespace integration
 
 #endif // _integration_h_
@@ -696,6 +696,76 @@ kernel_gradient<param::sinc_ker, gdimension>(const point_t & vecP,
   return result;
 }
 
+/*============================================================================*/
+/*   Kernel types of the SPH passes                                           */
+/*============================================================================*/
+/**
+ * @brief      Analytic kernel K, inlined in the SPH passes
+ */
+template<param::sph_kernel_keyword K>
+struct analytic {
+  static double w(const double & r, const double & h) {
+    return kernel<K, gdimension>(r, h);
+  }
+  static point_t gradient(const point_t & vecP, const double & h) {
+    return kernel_gradient<K, gdimension>(vecP, h);
+  }
+};
+
+// Tables of W(q) and (dW/dq)/q for q = r/h in [0,1] with h = 1, built by
+// select() from the analytic kernel. Both tables (16 KB) stay in L1.
+const int kernel_table_size = 1024;
+double kernel_table_w[kernel_table_size + 3];
+double kernel_table_g[kernel_table_size + 3];
+
+/**
+ * @brief      Tabulated kernel, linear interpolation in the tables
+ */
+struct tabulated {
+  static double w(const double & r, const double & h) {
+    const double hi = 1. / h;
+    double x = std::min(r * hi * kernel_table_size, kernel_table_size + 1.);
+    const int i = x;
+    x -= i;
+    double hd = hi;
+    for(size_t d = 1; d < gdimension; ++d)
+      hd *= hi;
+    return hd * ((1. - x) * kernel_table_w[i] + x * kernel_table_w[i + 1]);
+  }
+  static point_t gradient(const point_t & vecP, const double & h) {
+    const double hi = 1. / h;
+    double x = std::min(
+      flecsi::magnitude(vecP) * hi * kernel_table_size, kernel_table_size + 1.);
+    const int i = x;
+    x -= i;
+    double hd = hi * hi * hi;
+    for(size_t d = 1; d < gdimension; ++d)
+      hd *= hi;
+    return vecP *
+           (hd * ((1. - x) * kernel_table_g[i] + x * kernel_table_g[i + 1]));
+  }
+};
+
+/**
+ * @brief      Fill the tables from the analytic kernel and gradient; zero
+ *             beyond the support
+ */
+void
+set_kernel_table(kernel_function_t w, kernel_gradient_t gradient) {
+  const double dq = 1. / kernel_table_size;
+  for(int i = 0; i <= kernel_table_size; ++i) {
+    // The gradient factor is finite at q = 0 and the gaussians are cut at
+    // q = 1: take the limits from inside the support
+    const double q = std::min(std::max(i * dq, 1.e-6 * dq), 1. - 1.e-12);
+    point_t x = 0.0;
+    x[0] = q;
+    kernel_table_w[i] = w(q, 1.);
+    kernel_table_g[i] = gradient(x, 1.)[0] / q;
+  }
+  for(int i = kernel_table_size + 1; i < kernel_table_size + 3; ++i)
+    kernel_table_w[i] = kernel_table_g[i] = 0.;
+}
+
 #ifdef sph_kernel
 kernel_function_t sph_kernel_function = kernel<param::sph_kernel, gdimension>;
 kernel_gradient_t sph_kernel_gradient =
@@ -766,6 +836,12 @@ select() {
   else {
     log_fatal("Bad kernel parameter" << std::endl);
   }
+
+  if(sph_kernel_tabulated) {
+    set_kernel_table(sph_kernel_function, sph_kernel_gradient);
+    sph_kernel_function = tabulated::w;
+    sph_kernel_gradient = tabulated::gradient;
+  }
 }
 
 }; // namespace kernels
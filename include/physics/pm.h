@@ -0,0 +1,592 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2018 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file pm.h
+ * @brief Particle-mesh solver for the long-range part of the gravitation
+ *        (TreePM). The short-range part is computed by the FMM tree walk
+ *        with the split kernels of fmm.h.
+ *
+ * The potential of a point mass is split at the scale r_s:
+ *   -G m/r = -G m erfc(r/2r_s)/r - G m erf(r/2r_s)/r
+ * The long-range part is smooth and computed on a mesh: cloud-in-cell
+ * deposit of the masses, convolution with the long-range Green's function
+ * by FFT on a zero-padded mesh (isolated boundaries), finite differences for
+ * the acceleration and cloud-in-cell interpolation back to the particles.
+ * The FFTs are distributed by slabs among the ranks. Each rank only holds the
+ * planes of the mesh in its slab and the ghost planes of the stencils: the
+ * particles are sent to the rank holding their planes for the deposit and
+ * the interpolation, and only the ghost planes are exchanged.
+ */
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include <mpi.h>
+
+#include "fmm.h"
+
+namespace pm {
+
+using complex_t = std::complex<double>;
+
+/**
+ * @brief In place radix-2 FFT of n (power of 2) values.
+ *        sign = -1 for the forward transform, +1 for the inverse
+ *        (not normalized).
+ */
+inline void
+fft(complex_t * data, const size_t & n, const int & sign) {
+  // Bit reversal permutation
+  for(size_t i = 1, j = 0; i < n; ++i) {
+    size_t bit = n >> 1;
+    for(; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if(i < j)
+      std::swap(data[i], data[j]);
+  } // for
+  // Butterflies
+  for(size_t len = 2; len <= n; len <<= 1) {
+    const double angle = sign * 2. * M_PI / len;
+    const complex_t wlen(std::cos(angle), std::sin(angle));
+    for(size_t i = 0; i < n; i += len) {
+      complex_t w(1.);
+      for(size_t j = 0; j < len / 2; ++j) {
+        const complex_t u = data[i + j];
+        const complex_t v = data[i + j + len / 2] * w;
+        data[i + j] = u + v;
+        data[i + j + len / 2] = u - v;
+        w *= wlen;
+      } // for
+    } // for
+  } // for
+}
+
+/**
+ * @brief FFT of the n values of data separated by stride
+ */
+inline void
+fft_strided(complex_t * data,
+  const size_t & n,
+  const size_t & stride,
+  const int & sign,
+  std::vector<complex_t> & buffer) {
+  buffer.resize(n);
+  for(size_t i = 0; i < n; ++i)
+    buffer[i] = data[i * stride];
+  fft(&buffer[0], n, sign);
+  for(size_t i = 0; i < n; ++i)
+    data[i * stride] = buffer[i];
+}
+
+/**
+ * @brief Long-range gravitation on a mesh of n^3 cells covering the domain
+ */
+class pm_solver
+{
+public:
+  pm_solver() {}
+
+  /**
+   * @brief Set the number of mesh cells per direction (power of 2) and the
+   *        split scale in number of cells
+   */
+  void set_mesh(const int & n, const double & split) {
+    assert(n >= 8 && (n & (n - 1)) == 0);
+    n_ = n;
+    split_ = split;
+    ghat_size_ = 0;
+  }
+
+  /**
+   * @brief Place the mesh on the range of the particles. The cell size and
+   *        thus the split scale follow the range.
+   */
+  void set_range(const range_t & range) {
+    double length = 0.;
+    for(size_t d = 0; d < gdimension; ++d) {
+      length = std::max(length, range[1][d] - range[0][d]);
+    }
+    // Two cells of margin on each side for the CIC and the gradient stencil
+    dx_ = length / (n_ - 5);
+    for(size_t d = 0; d < gdimension; ++d) {
+      origin_[d] = range[0][d] - 2. * dx_;
+    }
+  }
+
+  /**
+   * @brief Split scale r_s of the force, to be used by the tree walk
+   */
+  double r_split() const {
+    return split_ * dx_;
+  }
+
+  /**
+   * @brief Add the long-range gravitational acceleration and potential to
+   *        the local bodies. Collective over all the ranks.
+   */
+  template<typename BODIES>
+  void solve(BODIES & bodies) {
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+    MPI_Comm_size(MPI_COMM_WORLD, &size_);
+    g0_ = ghost_begin_(rank_);
+    g1_ = ghost_end_(rank_);
+    send_particles_(bodies);
+    deposit_();
+    convolve_();
+    interpolate_();
+    receive_results_(bodies);
+  }
+
+private:
+  //! Index in the local planes [g0_, g1_) of the mesh
+  size_t index_(const size_t & i, const size_t & j, const size_t & k) const {
+    return ((i - g0_) * n_ + j) * n_ + k;
+  }
+
+  // Planes of the physical mesh in the slab of rank r
+  size_t plane_begin_(const int & r) const {
+    return std::min(slab_begin_(r), n_);
+  }
+  size_t plane_end_(const int & r) const {
+    return std::min(slab_end_(r), n_);
+  }
+
+  // Planes held by rank r: the CIC deposit of its particles reaches the next
+  // plane, the gradient stencil two planes before and three after
+  size_t ghost_begin_(const int & r) const {
+    const size_t p0 = plane_begin_(r);
+    return p0 == plane_end_(r) ? p0 : std::max(p0, size_t(2)) - 2;
+  }
+  size_t ghost_end_(const int & r) const {
+    const size_t p1 = plane_end_(r);
+    return plane_begin_(r) == p1 ? p1 : std::min(p1 + 3, n_);
+  }
+
+  //! Rank whose slab holds the plane
+  int owner_(const size_t & plane) const {
+    return int(((plane + 1) * size_ - 1) / (2 * n_));
+  }
+
+  /**
+   * @brief Position of a particle in mesh units. The particles must be in
+   *        the range given to set_range, cells [2, n-3] of the mesh: stops
+   *        with a fatal error otherwise. Only the rounding at the edges of
+   *        the range is clamped.
+   */
+  void mesh_position_(const point_t & coordinates,
+    std::array<int, 3> & cell,
+    std::array<double, 3> & frac) const {
+    const double tolerance = 1.e-9;
+    for(size_t d = 0; d < 3; ++d) {
+      double x = (coordinates[d] - origin_[d]) / dx_;
+      if(!(x > 2. - tolerance && x < n_ - 3. + tolerance)) {
+        log_fatal("PM: particle at " << coordinates
+                                     << " outside of the mesh range");
+      }
+      x = std::min(std::max(x, 2.), n_ - 3. - 1.e-12);
+      cell[d] = int(x);
+      frac[d] = x - cell[d];
+    } // for
+  }
+
+  /**
+   * @brief Send the position and mass of the particles to the ranks holding
+   *        their first plane of the CIC. The order by destination is kept
+   *        to receive the results.
+   */
+  template<typename BODIES>
+  void send_particles_(BODIES & bodies) {
+    std::array<int, 3> c;
+    std::array<double, 3> f;
+    std::vector<int> dest(bodies.size());
+    scount_.assign(size_, 0);
+    for(size_t i = 0; i < bodies.size(); ++i) {
+      mesh_position_(bodies[i].coordinates(), c, f);
+      dest[i] = owner_(c[0]);
+      scount_[dest[i]] += 4;
+    } // for
+    rcount_.resize(size_);
+    MPI_Alltoall(&scount_[0], 1, MPI_INT, &rcount_[0], 1, MPI_INT,
+      MPI_COMM_WORLD);
+    displacements_(scount_, sdispl_);
+    displacements_(rcount_, rdispl_);
+
+    std::vector<int> pos(sdispl_);
+    std::vector<double> send(4 * bodies.size());
+    order_.resize(bodies.size());
+    for(size_t i = 0; i < bodies.size(); ++i) {
+      const int p = pos[dest[i]];
+      pos[dest[i]] += 4;
+      order_[p / 4] = i;
+      for(size_t d = 0; d < 3; ++d)
+        send[p + d] = bodies[i].coordinates()[d];
+      send[p + 3] = bodies[i].mass();
+    } // for
+    particles_.resize(rdispl_[size_ - 1] + rcount_[size_ - 1]);
+    MPI_Alltoallv(send.data(), &scount_[0], &sdispl_[0], MPI_DOUBLE,
+      particles_.data(), &rcount_[0], &rdispl_[0], MPI_DOUBLE,
+      MPI_COMM_WORLD);
+  }
+
+  /**
+   * @brief Send the acceleration and potential back to the ranks of the
+   *        particles and add them
+   */
+  template<typename BODIES>
+  void receive_results_(BODIES & bodies) {
+    std::vector<double> recv(4 * bodies.size());
+    MPI_Alltoallv(results_.data(), &rcount_[0], &rdispl_[0], MPI_DOUBLE,
+      recv.data(), &scount_[0], &sdispl_[0], MPI_DOUBLE, MPI_COMM_WORLD);
+    for(size_t q = 0; q < order_.size(); ++q) {
+      auto & b = bodies[order_[q]];
+      point_t acc = b.getGAcceleration();
+      for(size_t d = 0; d < 3; ++d)
+        acc[d] += recv[4 * q + d];
+      b.setGAcceleration(acc);
+      b.setGPotential(b.getGPotential() + recv[4 * q + 3]);
+    } // for
+  }
+
+  static void displacements_(const std::vector<int> & count,
+    std::vector<int> & displ) {
+    displ.resize(count.size());
+    for(size_t r = 0; r < count.size(); ++r)
+      displ[r] = r ? displ[r - 1] + count[r - 1] : 0;
+  }
+
+  /**
+   * @brief Exchange the ghost planes of the mesh with the ranks holding
+   *        them in their slab. With sum, the ghost planes are added to the
+   *        planes of the owners (deposit), otherwise they are filled by the
+   *        owners (potential).
+   */
+  void exchange_planes_(std::vector<double> & mesh, const bool & sum) {
+    const size_t plane = n_ * n_;
+    // Planes sent by rank r: its ghosts, or its slab
+    auto sent = [&](const int & r) {
+      return sum ? std::array<size_t, 2>{ghost_begin_(r), ghost_end_(r)}
+                 : std::array<size_t, 2>{plane_begin_(r), plane_end_(r)};
+    };
+    // Planes received by rank r
+    auto received = [&](const int & r) {
+      return sum ? std::array<size_t, 2>{plane_begin_(r), plane_end_(r)}
+                 : std::array<size_t, 2>{ghost_begin_(r), ghost_end_(r)};
+    };
+    auto overlap = [](const std::array<size_t, 2> & a,
+                     const std::array<size_t, 2> & b) {
+      const size_t first = std::max(a[0], b[0]);
+      const size_t last = std::max(first, std::min(a[1], b[1]));
+      return std::array<size_t, 2>{first, last};
+    };
+    std::vector<std::array<size_t, 2>> to(size_), from(size_);
+    std::vector<int> scount(size_), rcount(size_), sdispl, rdispl;
+    for(int r = 0; r < size_; ++r) {
+      to[r] = r == rank_ ? std::array<size_t, 2>{0, 0}
+                         : overlap(sent(rank_), received(r));
+      from[r] = r == rank_ ? std::array<size_t, 2>{0, 0}
+                           : overlap(sent(r), received(rank_));
+      scount[r] = (to[r][1] - to[r][0]) * plane;
+      rcount[r] = (from[r][1] - from[r][0]) * plane;
+    } // for
+    displacements_(scount, sdispl);
+    displacements_(rcount, rdispl);
+    std::vector<double> send(sdispl[size_ - 1] + scount[size_ - 1]);
+    std::vector<double> recv(rdispl[size_ - 1] + rcount[size_ - 1]);
+    for(int r = 0; r < size_; ++r)
+      if(scount[r])
+        std::copy(&mesh[index_(to[r][0], 0, 0)],
+          &mesh[index_(to[r][0], 0, 0)] + scount[r], &send[sdispl[r]]);
+    MPI_Alltoallv(send.data(), &scount[0], &sdispl[0], MPI_DOUBLE,
+      recv.data(), &rcount[0], &rdispl[0], MPI_DOUBLE, MPI_COMM_WORLD);
+    for(int r = 0; r < size_; ++r) {
+      double * dst = rcount[r] ? &mesh[index_(from[r][0], 0, 0)] : nullptr;
+      for(int v = 0; v < rcount[r]; ++v)
+        dst[v] = sum ? dst[v] + recv[rdispl[r] + v] : recv[rdispl[r] + v];
+    } // for
+  }
+
+  /**
+   * @brief Cloud-in-cell deposit of the masses of the particles received
+   *        in the local planes, then the ghost planes to their owners
+   */
+  void deposit_() {
+    mass_.assign((g1_ - g0_) * n_ * n_, 0.);
+    std::array<int, 3> c;
+    std::array<double, 3> f;
+    point_t x;
+    for(size_t p = 0; p < particles_.size(); p += 4) {
+      for(size_t d = 0; d < 3; ++d)
+        x[d] = particles_[p + d];
+      mesh_position_(x, c, f);
+      for(int a = 0; a < 8; ++a) {
+        double w = particles_[p + 3];
+        for(size_t d = 0; d < 3; ++d) {
+          w *= (a >> d) & 1 ? f[d] : 1. - f[d];
+        }
+        mass_[index_(c[0] + (a & 1), c[1] + (a >> 1 & 1),
+          c[2] + (a >> 2 & 1))] += w;
+      } // for
+    } // for
+    exchange_planes_(mass_, true);
+  }
+
+  /**
+   * @brief Long-range Green's function at the distance r, for the split
+   *        scale rs
+   */
+  static double green_(const double & r, const double & rs) {
+    if(r == 0.)
+      return -fmm::gc / (rs * std::sqrt(M_PI));
+    return -fmm::gc * std::erf(r / (2. * rs)) / r;
+  }
+  double green_(const double & r) const {
+    return green_(r, split_ * dx_);
+  }
+
+  /**
+   * @brief Transform of the Green's function on the padded mesh, in the
+   *        y-slab. With the split scale in cells, the Green's function
+   *        scales as 1/dx: it is computed once for a unit cell, for the
+   *        mesh size, the split and the partition of the slabs.
+   *        Collective over all the ranks.
+   */
+  void green_transform_() {
+    const size_t m = 2 * n_;
+    if(ghat_size_ == size_)
+      return;
+    const size_t x0 = slab_begin_(rank_);
+    std::vector<complex_t> gslab(nx_ * m * m);
+    for(size_t i = 0; i < nx_; ++i) {
+      const size_t gi = x0 + i;
+      const double ri = std::min(gi, m - gi);
+      for(size_t j = 0; j < m; ++j) {
+        const double rj = std::min(j, m - j);
+        for(size_t k = 0; k < m; ++k) {
+          const double rk = std::min(k, m - k);
+          gslab[(i * m + j) * m + k] =
+            green_(std::sqrt(ri * ri + rj * rj + rk * rk), split_);
+        } // for
+      } // for
+    } // for
+    ghat_.resize(ny_ * m * m);
+    forward_(gslab, ghat_);
+    ghat_size_ = size_;
+  }
+
+  /**
+   * @brief Forward FFT along z and y of the local x-planes, transposition
+   *        to y-slabs and FFT along x. The result is stored as
+   *        [j - y0][i][k] in the y-slab.
+   */
+  void forward_(std::vector<complex_t> & xslab,
+    std::vector<complex_t> & yslab) {
+    const size_t m = 2 * n_;
+    for(size_t i = 0; i < nx_; ++i) {
+      complex_t * plane = &xslab[i * m * m];
+      for(size_t j = 0; j < m; ++j)
+        fft(plane + j * m, m, -1);
+      for(size_t k = 0; k < m; ++k)
+        fft_strided(plane + k, m, m, -1, buffer_);
+    } // for
+    transpose_(xslab, yslab, true);
+    for(size_t j = 0; j < ny_; ++j)
+      for(size_t k = 0; k < m; ++k)
+        fft_strided(&yslab[j * m * m + k], m, m, -1, buffer_);
+  }
+
+  /**
+   * @brief Inverse of forward_, not normalized
+   */
+  void backward_(std::vector<complex_t> & yslab,
+    std::vector<complex_t> & xslab) {
+    const size_t m = 2 * n_;
+    for(size_t j = 0; j < ny_; ++j)
+      for(size_t k = 0; k < m; ++k)
+        fft_strided(&yslab[j * m * m + k], m, m, 1, buffer_);
+    transpose_(yslab, xslab, false);
+    for(size_t i = 0; i < nx_; ++i) {
+      complex_t * plane = &xslab[i * m * m];
+      for(size_t k = 0; k < m; ++k)
+        fft_strided(plane + k, m, m, 1, buffer_);
+      for(size_t j = 0; j < m; ++j)
+        fft(plane + j * m, m, 1);
+    } // for
+  }
+
+  /**
+   * @brief Exchange between the x-slab layout [i - x0][j][k] and the y-slab
+   *        layout [j - y0][i][k] of the padded mesh
+   */
+  void transpose_(std::vector<complex_t> & in,
+    std::vector<complex_t> & out,
+    bool to_y) {
+    const size_t m = 2 * n_;
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    // x and y slabs use the same partition: the block exchanged with rank r
+    // holds our planes times its planes
+    const size_t nlocal = to_y ? nx_ : ny_;
+    std::vector<int> count(size), displ(size);
+    for(int r = 0; r < size; ++r) {
+      count[r] = 2 * nlocal * (slab_end_(r) - slab_begin_(r)) * m;
+      displ[r] = r ? displ[r - 1] + count[r - 1] : 0;
+    } // for
+    // Pack the blocks by destination rank: [a][b][k], a the local planes and
+    // b the planes of the destination in the other direction
+    std::vector<complex_t> send(in.size()), recv(out.size());
+    size_t pos = 0;
+    for(int r = 0; r < size; ++r) {
+      for(size_t a = 0; a < nlocal; ++a) {
+        for(size_t b = slab_begin_(r); b < slab_end_(r); ++b) {
+          const complex_t * src = &in[(a * m + b) * m];
+          std::copy(src, src + m, &send[pos]);
+          pos += m;
+        } // for
+      } // for
+    } // for
+    MPI_Alltoallv(&send[0], &count[0], &displ[0], MPI_DOUBLE, &recv[0],
+      &count[0], &displ[0], MPI_DOUBLE, MPI_COMM_WORLD);
+    // Unpack: the block of rank r holds its planes a for our planes b
+    pos = 0;
+    for(int r = 0; r < size; ++r) {
+      for(size_t a = slab_begin_(r); a < slab_end_(r); ++a) {
+        for(size_t b = 0; b < nlocal; ++b) {
+          std::copy(&recv[pos], &recv[pos] + m, &out[(b * m + a) * m]);
+          pos += m;
+        } // for
+      } // for
+    } // for
+  }
+
+  // Slabs of the padded mesh: same partition in x and y
+  size_t slab_begin_(const int & r) const {
+    return (2 * n_ * r) / size_;
+  }
+  size_t slab_end_(const int & r) const {
+    return slab_begin_(r + 1);
+  }
+
+  /**
+   * @brief Convolution of the mass with the long-range Green's function on
+   *        the zero-padded mesh. Each rank transforms its slab and receives
+   *        the ghost planes of the potential.
+   */
+  void convolve_() {
+    const size_t m = 2 * n_;
+    const size_t x0 = slab_begin_(rank_);
+    nx_ = ny_ = slab_end_(rank_) - slab_begin_(rank_);
+
+    green_transform_();
+    std::vector<complex_t> xslab(nx_ * m * m), yslab(ny_ * m * m);
+    for(size_t i = 0; i < nx_ && x0 + i < n_; ++i)
+      for(size_t j = 0; j < n_; ++j)
+        for(size_t k = 0; k < n_; ++k)
+          xslab[(i * m + j) * m + k] = mass_[index_(x0 + i, j, k)];
+    forward_(xslab, yslab);
+    const double scale = 1. / dx_;
+    for(size_t idx = 0; idx < yslab.size(); ++idx)
+      yslab[idx] *= scale * ghat_[idx];
+    backward_(yslab, xslab);
+
+    // Potential of the physical mesh in the slab, then the ghost planes
+    const double norm = 1. / double(m * m * m);
+    potential_.assign((g1_ - g0_) * n_ * n_, 0.);
+    for(size_t i = 0; i < nx_ && x0 + i < n_; ++i)
+      for(size_t j = 0; j < n_; ++j)
+        for(size_t k = 0; k < n_; ++k)
+          potential_[index_(x0 + i, j, k)] =
+            xslab[(i * m + j) * m + k].real() * norm;
+    exchange_planes_(potential_, false);
+  }
+
+  /**
+   * @brief Fourth order finite difference of the potential at a mesh point
+   */
+  double gradient_(const size_t & i,
+    const size_t & j,
+    const size_t & k,
+    const size_t & d) const {
+    const size_t s = d == 0 ? n_ * n_ : (d == 1 ? n_ : 1);
+    const size_t c = index_(i, j, k);
+    return (8. * (potential_[c + s] - potential_[c - s]) -
+             (potential_[c + 2 * s] - potential_[c - 2 * s])) /
+           (12. * dx_);
+  }
+
+  /**
+   * @brief Cloud-in-cell interpolation of the acceleration and potential
+   *        at the particles received
+   */
+  void interpolate_() {
+    std::array<int, 3> c;
+    std::array<double, 3> f;
+    point_t x;
+    results_.resize(particles_.size());
+    for(size_t p = 0; p < particles_.size(); p += 4) {
+      for(size_t d = 0; d < 3; ++d)
+        x[d] = particles_[p + d];
+      mesh_position_(x, c, f);
+      double acc[3] = {0., 0., 0.};
+      double pot = 0.;
+      for(int a = 0; a < 8; ++a) {
+        const size_t i = c[0] + (a & 1), j = c[1] + (a >> 1 & 1),
+                     k = c[2] + (a >> 2 & 1);
+        double w = 1.;
+        for(size_t d = 0; d < 3; ++d) {
+          w *= (a >> d) & 1 ? f[d] : 1. - f[d];
+        }
+        pot += w * potential_[index_(i, j, k)];
+        for(size_t d = 0; d < 3; ++d) {
+          acc[d] -= w * gradient_(i, j, k, d);
+        }
+      } // for
+      for(size_t d = 0; d < 3; ++d)
+        results_[p + d] = acc[d];
+      // The mesh potential includes the self-interaction of the particle
+      results_[p + 3] = pot - green_(0.) * particles_[p + 3];
+    } // for
+  }
+
+  size_t n_ = 64;
+  double split_ = 1.25;
+  double dx_ = 1.;
+  point_t origin_;
+  size_t nx_ = 0, ny_ = 0;
+  int rank_ = 0, size_ = 1;
+  size_t g0_ = 0, g1_ = 0; // Planes held by this rank
+  std::vector<double> mass_;
+  std::vector<double> potential_;
+  std::vector<complex_t> buffer_;
+  // Transform of the Green's function for a unit cell, and the number of
+  // ranks of its slabs (0 when it has to be computed)
+  std::vector<complex_t> ghat_;
+  int ghat_size_ = 0;
+  // Particles received (position, mass), results sent back (acceleration,
+  // potential), and the order of the local particles by destination
+  std::vector<double> particles_, results_;
+  std::vector<size_t> order_;
+  std::vector<int> scount_, sdispl_, rcount_, rdispl_;
+}; // class pm_solver
+
+} // namespace pm
@@ -0,0 +1,669 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file sph_simd.h
+ * @brief Explicitly vectorized SPH interactions of one particle with its
+ *        neighbors.
+ *
+ * The neighbors are gathered in a tile of arrays, one per component, padded
+ * to the SIMD width. The passes then work on std::experimental::simd vectors
+ * with the kernel inlined, instead of calling the kernel function pointers
+ * for each pair. Without <experimental/simd> (or with FLECSPH_NO_SIMD) the
+ * same code is compiled on scalars.
+ * The passes are instantiated for each kernel by physics::select. The
+ * kernels with a vector implementation are the polynomial ones and the
+ * gaussians; the sinc kernel keeps the scalar passes of default_physics.h.
+ *
+ * With FLECSPH_SPH_MIXED_PRECISION=1 (see app/drivers/CMakeLists.txt) the
+ * pair geometry is in single precision: the position differences are stored
+ * in float relative to the particle and the distances are computed in float.
+ * Relative to h this is accurate enough; the kernels, the sums and the
+ * positions stay in double. These passes are then used whatever the value
+ * of sph_simd_kernels. The float lanes only pay off when the build vectorizes
+ * wider than two doubles (-march=native): at the default SIMD width the
+ * conversions make the mixed passes a few percent slower than the double
+ * ones (see the sph_simd.mixed_precision test).
+ */
+
+#ifndef _PHYSICS_SPH_SIMD_H_
+#define _PHYSICS_SPH_SIMD_H_
+
+#include <cmath>
+#include <vector>
+
+#if __has_include(<experimental/simd>) && !defined(FLECSPH_NO_SIMD)
+#include <experimental/simd>
+#define FLECSPH_SIMD
+#endif
+
+#include "kernels.h"
+#include "params.h"
+#include "tree.h"
+#include "boundary.h"
+
+#ifndef FLECSPH_SPH_MIXED_PRECISION
+#define FLECSPH_SPH_MIXED_PRECISION 0
+#endif
+
+namespace sph_simd {
+
+// Precision of the position differences and distances of the pairs
+#if FLECSPH_SPH_MIXED_PRECISION
+using geometry_t = float;
+#else
+using geometry_t = double;
+#endif
+
+#ifdef FLECSPH_SIMD
+namespace stdx = std::experimental;
+using vdouble = stdx::native_simd<double>;
+using vmask = vdouble::mask_type;
+constexpr size_t width = vdouble::size();
+
+inline vdouble
+vselect(const vmask & m, const vdouble & a, const vdouble & b) {
+  vdouble r = b;
+  stdx::where(m, r) = a;
+  return r;
+}
+inline vdouble
+vload(const double * p) {
+  return vdouble(p, stdx::element_aligned);
+}
+inline vdouble
+vload(const float * p) {
+  return vdouble(p, stdx::element_aligned);
+}
+inline double
+vsum(const vdouble & v) {
+  return stdx::reduce(v);
+}
+template<typename F>
+inline vdouble
+vlanes(const F & f, const vdouble & a, const vdouble & b) {
+  return vdouble([&](auto i) { return f(a[i], b[i]); });
+}
+#else
+using vdouble = double;
+using vmask = bool;
+constexpr size_t width = 1;
+
+inline double
+vselect(const bool & m, const double & a, const double & b) {
+  return m ? a : b;
+}
+inline double
+vload(const double * p) {
+  return *p;
+}
+inline double
+vload(const float * p) {
+  return *p;
+}
+inline double
+vsum(const double & v) {
+  return v;
+}
+template<typename F>
+inline double
+vlanes(const F & f, const double & a, const double & b) {
+  return f(a, b);
+}
+#endif
+
+/**
+ * @brief h^N by multiplications
+ */
+template<int N>
+inline vdouble
+hpow(const vdouble & h) {
+  vdouble r = h;
+  for(int i = 1; i < N; ++i)
+    r *= h;
+  return r;
+}
+
+/**
+ * @brief Vector kernels: W(r,h) and the gradient factor g(r,h) such that
+ *        D_i W = (x_a - x_b) g. Same expressions as kernels.h.
+ */
+template<typename KERNEL>
+struct kernel_t {
+  // No vector version: the scalar kernel on each lane
+  static constexpr bool vectorized = false;
+  static vdouble w(const vdouble & r, const vdouble & h) {
+    return vlanes(KERNEL::w, r, h);
+  }
+  static vdouble g(const vdouble & r, const vdouble & h) {
+    return vlanes(
+      [](const double & r, const double & h) {
+        point_t x = 0.0;
+        x[0] = r;
+        return r > 0. ? KERNEL::gradient(x, h)[0] / r
+                      : 0.;
+      },
+      r, h);
+  }
+};
+
+template<>
+struct kernel_t<kernels::analytic<param::cubic_spline>> {
+  static constexpr bool vectorized = true;
+  static vdouble w(const vdouble & r, const vdouble & h) {
+    const double s = kernels::cubic_spline_sigma[gdimension - 1];
+    const vdouble rh = 2. * r / h, t = 2. - rh;
+    const vdouble w1 = 1. - 1.5 * rh * rh + .75 * rh * rh * rh;
+    const vdouble w2 = .25 * t * t * t;
+    const vdouble res = vselect(rh < 1., w1, w2) * (s / hpow<gdimension>(h));
+    return vselect(rh < 2., res, vdouble(0.));
+  }
+  static vdouble g(const vdouble & r, const vdouble & h) {
+    const double s = 2. * kernels::cubic_spline_sigma[gdimension - 1];
+    const vdouble rh = 2. * r / h, t = 2. - rh;
+    const vdouble dw =
+      vselect(rh < 1., -3. * rh + 9. / 4. * rh * rh, -.75 * t * t);
+    const vdouble res =
+      s / hpow<gdimension + 1>(h) * dw / (r + kernels::TINY);
+    return vselect(rh < 2., res, vdouble(0.));
+  }
+};
+
+template<>
+struct kernel_t<kernels::analytic<param::quintic_spline>> {
+  static constexpr bool vectorized = true;
+  static vdouble w(const vdouble & r, const vdouble & h) {
+    using std::max;
+    const double s = kernels::quintic_spline_sigma[gdimension - 1];
+    const vdouble rh = 3. * r / h;
+    const vdouble t3 = max(3. - rh, vdouble(0.)),
+                  t2 = max(2. - rh, vdouble(0.)),
+                  t1 = max(1. - rh, vdouble(0.));
+    const vdouble p3 = t3 * t3 * t3 * t3 * t3, p2 = t2 * t2 * t2 * t2 * t2,
+                  p1 = t1 * t1 * t1 * t1 * t1;
+    return (p3 - 6. * p2 + 15. * p1) * (s / hpow<gdimension>(h));
+  }
+  static vdouble g(const vdouble & r, const vdouble & h) {
+    using std::max;
+    const double s = 3. * kernels::quintic_spline_sigma[gdimension - 1];
+    const vdouble rh = 3. * r / h;
+    const vdouble t3 = max(3. - rh, vdouble(0.)),
+                  t2 = max(2. - rh, vdouble(0.)),
+                  t1 = max(1. - rh, vdouble(0.));
+    const vdouble dw = -5. * t3 * t3 * t3 * t3 + 30. * t2 * t2 * t2 * t2 -
+                       75. * t1 * t1 * t1 * t1;
+    return s / hpow<gdimension + 1>(h) * dw / (r + kernels::TINY);
+  }
+};
+
+template<>
+struct kernel_t<kernels::analytic<param::wendland_c2>> {
+  static constexpr bool vectorized = true;
+  static vdouble w(const vdouble & r, const vdouble & h) {
+    const double s = kernels::wendland_c2_sigma[gdimension - 1];
+    const vdouble rh = r / h, t = 1. - rh, t2 = t * t;
+    vdouble res;
+    if constexpr(gdimension == 1)
+      res = t2 * t * (3. * rh + 1.);
+    else
+      res = t2 * t2 * (4. * rh + 1.);
+    return vselect(rh < 1., res * (s / hpow<gdimension>(h)), vdouble(0.));
+  }
+  static vdouble g(const vdouble & r, const vdouble & h) {
+    const vdouble rh = r / h, t = 1. - rh, t2 = t * t;
+    vdouble dw;
+    double s;
+    if constexpr(gdimension == 1) {
+      s = kernels::wendland_c2_sigma[0];
+      dw = -12. * rh * t2;
+    }
+    else {
+      s = 2. * kernels::wendland_c2_sigma[gdimension - 1];
+      dw = -10. * rh * t2 * t;
+    }
+    const vdouble res =
+      s / hpow<gdimension + 1>(h) * dw / (r + kernels::TINY);
+    return vselect(rh < 1., res, vdouble(0.));
+  }
+};
+
+template<>
+struct kernel_t<kernels::analytic<param::wendland_c4>> {
+  static constexpr bool vectorized = true;
+  static vdouble w(const vdouble & r, const vdouble & h) {
+    const double s = kernels::wendland_c4_sigma[gdimension - 1];
+    const vdouble rh = r / h, t = 1. - rh, t2 = t * t;
+    vdouble res;
+    if constexpr(gdimension == 1)
+      res = t2 * t2 * t * (1. + rh * (5. + rh * 8.));
+    else
+      res = t2 * t2 * t2 * (1. + rh * (6. + rh * 35. / 3.));
+    return vselect(rh < 1., res * (s / hpow<gdimension>(h)), vdouble(0.));
+  }
+  static vdouble g(const vdouble & r, const vdouble & h) {
+    const double s = 14. * kernels::wendland_c4_sigma[gdimension - 1];
+    const vdouble rh = r / h, t = 1. - rh, t2 = t * t;
+    vdouble dw;
+    if constexpr(gdimension == 1)
+      dw = -rh * t2 * t2 * (1. + 4. * rh);
+    else
+      dw = -4. / 3. * rh * t2 * t2 * t * (1. + 5. * rh);
+    const vdouble res =
+      s / hpow<gdimension + 1>(h) * dw / (r + kernels::TINY);
+    return vselect(rh < 1., res, vdouble(0.));
+  }
+};
+
+template<>
+struct kernel_t<kernels::analytic<param::wendland_c6>> {
+  static constexpr bool vectorized = true;
+  static vdouble w(const vdouble & r, const vdouble & h) {
+    const double s = kernels::wendland_c6_sigma[gdimension - 1];
+    const vdouble rh = r / h, t = 1. - rh, t2 = t * t, t4 = t2 * t2;
+    vdouble res;
+    if constexpr(gdimension == 1)
+      res = t4 * t2 * t * (1. + rh * (7. + rh * (19. + rh * 21.)));
+    else
+      res = t4 * t4 * (1. + rh * (8. + rh * (25. + rh * 32.)));
+    return vselect(rh < 1., res * (s / hpow<gdimension>(h)), vdouble(0.));
+  }
+  static vdouble g(const vdouble & r, const vdouble & h) {
+    const double s = kernels::wendland_c6_sigma[gdimension - 1];
+    const vdouble rh = r / h, t = 1. - rh, t2 = t * t, t3 = t2 * t;
+    vdouble dw;
+    if constexpr(gdimension == 1)
+      dw = -6. * rh * t3 * t3 * (3. + rh * (18. + rh * 35.));
+    else
+      dw = -22. * rh * t2 * t2 * t3 * (1. + rh * (7. + rh * 16.));
+    const vdouble res =
+      s / hpow<gdimension + 1>(h) * dw / (r + kernels::TINY);
+    return vselect(rh < 1., res, vdouble(0.));
+  }
+};
+
+template<>
+struct kernel_t<kernels::analytic<param::gaussian>> {
+  static constexpr bool vectorized = true;
+  static vdouble w(const vdouble & r, const vdouble & h) {
+    using std::exp;
+    const double s = kernels::gaussian_sigma[gdimension - 1];
+    const vdouble rh = 3. * r / h;
+    const vdouble res = s / hpow<gdimension>(h) * exp(-rh * rh);
+    return vselect(rh <= 3., res, vdouble(0.));
+  }
+  static vdouble g(const vdouble & r, const vdouble & h) {
+    using std::exp;
+    const double s = 3. * kernels::gaussian_sigma[gdimension - 1];
+    const vdouble rh = 3. * r / h;
+    const vdouble dw = -2. * rh * exp(-rh * rh);
+    const vdouble res =
+      s / hpow<gdimension + 1>(h) * dw / (r + kernels::TINY);
+    return vselect(rh < 3., res, vdouble(0.));
+  }
+};
+
+template<>
+struct kernel_t<kernels::analytic<param::super_gaussian>> {
+  static constexpr bool vectorized = true;
+  static vdouble w(const vdouble & r, const vdouble & h) {
+    using std::exp;
+    const double s = kernels::super_gaussian_sigma[gdimension - 1];
+    const vdouble rh = 3. * r / h, rh2 = rh * rh;
+    const vdouble res =
+      s / hpow<gdimension>(h) * exp(-rh2) * (gdimension / 2.0 + 1. - rh2);
+    return vselect(rh < 3., res, vdouble(0.));
+  }
+  static vdouble g(const vdouble & r, const vdouble & h) {
+    using std::exp;
+    const double s = 3. * kernels::super_gaussian_sigma[gdimension - 1];
+    const vdouble rh = 3. * r / h;
+    const vdouble dw =
+      exp(-rh * rh) * (2. * rh * rh * rh - (gdimension + 4.) * rh);
+    const vdouble res =
+      s / hpow<gdimension + 1>(h) * dw / (r + kernels::TINY);
+    return vselect(rh < 3., res, vdouble(0.));
+  }
+};
+
+/**
+ * @brief Neighbors of a particle in arrays padded to the SIMD width. The
+ *        positions and half-step velocities are stored relative to the
+ *        particle, the positions in the precision G. The padding has no mass.
+ */
+template<typename G>
+class tile_t
+{
+public:
+  /**
+   * @brief Gather the neighbors of the particle; the hydro fields are only
+   *        gathered if needed
+   */
+  template<typename NBS>
+  void gather(const body & particle, const NBS & nbs, const bool & hydro) {
+    const point_t pos_a = particle.coordinates(),
+                  v12_a = particle.getVelocityhalf();
+    size = nbs.size();
+    padded = (size + width - 1) / width * width;
+    resize_(hydro);
+    for(size_t b = 0; b < size; ++b) {
+      const body * const nb = nbs[b];
+      const point_t pos_b =
+        boundary::nearest_image(pos_a, nb->coordinates());
+      for(size_t d = 0; d < gdimension; ++d)
+        dx[d][b] = pos_a[d] - pos_b[d];
+      h[b] = nb->radius();
+      m[b] = nb->mass();
+      if(!hydro)
+        continue;
+      m[b] *= (pos_b != pos_a); // if same particle, m_b->0
+      const point_t v12_ab = v12_a - nb->getVelocityhalf();
+      const point_t vel_b = nb->getVelocity();
+      for(size_t d = 0; d < gdimension; ++d) {
+        dv12[d][b] = v12_ab[d];
+        vel[d][b] = vel_b[d];
+      }
+      rho[b] = nb->getDensity();
+      P[b] = nb->getPressure();
+      c[b] = nb->getSoundspeed();
+    } // for
+    for(size_t b = size; b < padded; ++b) {
+      for(size_t d = 0; d < gdimension; ++d)
+        dx[d][b] = 0.;
+      h[b] = particle.radius();
+      m[b] = 0.;
+      if(!hydro)
+        continue;
+      for(size_t d = 0; d < gdimension; ++d)
+        dv12[d][b] = vel[d][b] = 0.;
+      rho[b] = particle.getDensity();
+      P[b] = c[b] = 0.;
+    } // for
+  }
+
+  size_t size = 0, padded = 0;
+  std::vector<G> dx[gdimension];
+  std::vector<double> dv12[gdimension], vel[gdimension];
+  std::vector<double> h, m, rho, P, c;
+
+private:
+  void resize_(const bool & hydro) {
+    if(h.size() >= padded && (!hydro || rho.size() >= padded))
+      return;
+    for(size_t d = 0; d < gdimension; ++d)
+      dx[d].resize(padded);
+    h.resize(padded);
+    m.resize(padded);
+    if(!hydro)
+      return;
+    for(size_t d = 0; d < gdimension; ++d) {
+      dv12[d].resize(padded);
+      vel[d].resize(padded);
+    }
+    rho.resize(padded);
+    P.resize(padded);
+    c.resize(padded);
+  }
+}; // class tile_t
+
+using tile = tile_t<geometry_t>;
+
+// One tile per thread, reused from one particle to the next
+template<typename G = geometry_t>
+inline tile_t<G> &
+thread_tile() {
+  static thread_local tile_t<G> t;
+  return t;
+}
+
+/**
+ * @brief Squared distance r2 and distance r to the neighbors b..b+width,
+ *        computed in the precision of the tile
+ */
+template<typename G>
+inline void
+distance(const tile_t<G> & t, const size_t & b, vdouble & r2, vdouble & r) {
+  using std::sqrt;
+#ifdef FLECSPH_SIMD
+  using vgeometry = stdx::rebind_simd_t<G, vdouble>;
+  vgeometry r2_g = G(0);
+  for(size_t d = 0; d < gdimension; ++d) {
+    const vgeometry dx(&t.dx[d][b], stdx::element_aligned);
+    r2_g += dx * dx;
+  }
+  r2 = stdx::static_simd_cast<vdouble>(r2_g);
+  r = stdx::static_simd_cast<vdouble>(sqrt(r2_g));
+#else
+  G r2_g = 0;
+  for(size_t d = 0; d < gdimension; ++d)
+    r2_g += t.dx[d][b] * t.dx[d][b];
+  r2 = r2_g;
+  r = sqrt(r2_g);
+#endif
+}
+
+/**
+ * @brief Artificial viscosity Pi_ab of the neighbors b..b+width, see
+ *        viscosity::mu and viscosity::artificial_viscosity
+ */
+template<typename G>
+inline vdouble
+viscosity(const tile_t<G> & t,
+  const size_t & b,
+  const vdouble & r2,
+  const vdouble & h_ab,
+  const double & rho_a,
+  const double & c_a) {
+  using namespace param;
+  vdouble dot = 0.;
+  for(size_t d = 0; d < gdimension; ++d)
+    dot += vload(&t.dv12[d][b]) * vload(&t.dx[d][b]);
+  vdouble mu_ab =
+    h_ab * dot / (r2 + sph_viscosity_epsilon * h_ab * h_ab + kernels::TINY);
+  mu_ab = vselect(dot < 0., mu_ab, vdouble(0.));
+  const vdouble rho_ab = .5 * (rho_a + vload(&t.rho[b]));
+  const vdouble c_ab = .5 * (c_a + vload(&t.c[b]));
+  return (-sph_viscosity_alpha * c_ab + sph_viscosity_beta * mu_ab) * mu_ab /
+         rho_ab;
+}
+
+/**
+ * @brief Density of the particle, see physics::compute_density
+ */
+template<typename KERNEL, typename G = geometry_t, typename NBS>
+double
+density(const body & particle, const NBS & nbs) {
+  tile_t<G> & t = thread_tile<G>();
+  t.gather(particle, nbs, false);
+  const double h_a = particle.radius();
+  vdouble rho = 0.;
+  for(size_t b = 0; b < t.padded; b += width) {
+    vdouble r2, r;
+    distance(t, b, r2, r);
+    const vdouble h_ab = .5 * (h_a + vload(&t.h[b]));
+    rho += vload(&t.m[b]) * kernel_t<KERNEL>::w(r, h_ab);
+  }
+  return vsum(rho);
+}
+
+/**
+ * @brief Hydro acceleration of the particle, see
+ *        physics::compute_acceleration
+ */
+template<typename KERNEL, typename G = geometry_t, typename NBS>
+point_t
+acceleration(const body & particle, const NBS & nbs) {
+  tile_t<G> & t = thread_tile<G>();
+  t.gather(particle, nbs, true);
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               c_a = particle.getSoundspeed();
+  const double Prho2_a = particle.getPressure() / (rho_a * rho_a);
+  vdouble acc[gdimension];
+  for(size_t d = 0; d < gdimension; ++d)
+    acc[d] = 0.;
+  for(size_t b = 0; b < t.padded; b += width) {
+    vdouble r2, r;
+    distance(t, b, r2, r);
+    const vdouble h_ab = .5 * (h_a + vload(&t.h[b]));
+    const vdouble Pi_ab = viscosity(t, b, r2, h_ab, rho_a, c_a);
+    const vdouble rho_b = vload(&t.rho[b]);
+    const vdouble Prho2_b = vload(&t.P[b]) / (rho_b * rho_b);
+    const vdouble f = -vload(&t.m[b]) * (Prho2_a + Prho2_b + Pi_ab) *
+                      kernel_t<KERNEL>::g(r, h_ab);
+    for(size_t d = 0; d < gdimension; ++d)
+      acc[d] += f * vload(&t.dx[d][b]);
+  }
+  point_t result;
+  for(size_t d = 0; d < gdimension; ++d)
+    result[d] = vsum(acc[d]);
+  return result;
+}
+
+/**
+ * @brief Time derivative of the internal energy, see physics::compute_dudt
+ */
+template<typename KERNEL, typename G = geometry_t, typename NBS>
+double
+dudt(const body & particle, const NBS & nbs) {
+  tile_t<G> & t = thread_tile<G>();
+  t.gather(particle, nbs, true);
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               c_a = particle.getSoundspeed();
+  const point_t vel_a = particle.getVelocity();
+  vdouble dudt_pressure = 0., dudt_visc = 0.;
+  for(size_t b = 0; b < t.padded; b += width) {
+    vdouble r2, r;
+    distance(t, b, r2, r);
+    const vdouble h_ab = .5 * (h_a + vload(&t.h[b]));
+    const vdouble Pi_ab = viscosity(t, b, r2, h_ab, rho_a, c_a);
+    vdouble vab_dot_dx = 0.;
+    for(size_t d = 0; d < gdimension; ++d)
+      vab_dot_dx += (vel_a[d] - vload(&t.vel[d][b])) * vload(&t.dx[d][b]);
+    const vdouble mvab_dot_DiWa =
+      vload(&t.m[b]) * vab_dot_dx * kernel_t<KERNEL>::g(r, h_ab);
+    dudt_pressure += mvab_dot_DiWa;
+    dudt_visc += mvab_dot_DiWa * Pi_ab;
+  }
+  return particle.getPressure() / (rho_a * rho_a) * vsum(dudt_pressure) +
+         .5 * vsum(dudt_visc);
+}
+
+/**
+ * @brief Time derivative of the thermokinetic energy without the
+ *        gravitational work, see physics::compute_dedt
+ */
+template<typename KERNEL, typename G = geometry_t, typename NBS>
+double
+dedt(const body & particle, const NBS & nbs) {
+  tile_t<G> & t = thread_tile<G>();
+  t.gather(particle, nbs, true);
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               c_a = particle.getSoundspeed();
+  const double Prho2_a = particle.getPressure() / (rho_a * rho_a);
+  const point_t vel_a = particle.getVelocity();
+  vdouble dedt = 0.;
+  for(size_t b = 0; b < t.padded; b += width) {
+    vdouble r2, r;
+    distance(t, b, r2, r);
+    const vdouble h_ab = .5 * (h_a + vload(&t.h[b]));
+    const vdouble Pi_ab = viscosity(t, b, r2, h_ab, rho_a, c_a);
+    const vdouble g = kernel_t<KERNEL>::g(r, h_ab);
+    vdouble va_dot_DiWa = 0., vb_dot_DiWa = 0.;
+    for(size_t d = 0; d < gdimension; ++d) {
+      const vdouble dx = vload(&t.dx[d][b]);
+      va_dot_DiWa += vel_a[d] * dx;
+      vb_dot_DiWa += vload(&t.vel[d][b]) * dx;
+    }
+    va_dot_DiWa *= g;
+    vb_dot_DiWa *= g;
+    const vdouble rho_b = vload(&t.rho[b]);
+    const vdouble Prho2_b = vload(&t.P[b]) / (rho_b * rho_b);
+    dedt -= vload(&t.m[b]) *
+            (Prho2_a * vb_dot_DiWa + va_dot_DiWa * Prho2_b +
+              .5 * Pi_ab * (vb_dot_DiWa + va_dot_DiWa));
+  }
+  return vsum(dedt);
+}
+
+/**
+ * @brief Acceleration and time derivatives of the internal and of the
+ *        thermokinetic energy in one loop, with the half-step velocities, see
+ *        physics::compute_acceleration_energy
+ */
+template<typename KERNEL, typename G = geometry_t, typename NBS>
+void
+acceleration_energy(const body & particle,
+  const NBS & nbs,
+  point_t & acceleration,
+  double & dudt,
+  double & dedt) {
+  tile_t<G> & t = thread_tile<G>();
+  t.gather(particle, nbs, true);
+  const double h_a = particle.radius(), rho_a = particle.getDensity(),
+               c_a = particle.getSoundspeed();
+  const double Prho2_a = particle.getPressure() / (rho_a * rho_a);
+  const point_t v12_a = particle.getVelocityhalf();
+  vdouble acc[gdimension];
+  for(size_t d = 0; d < gdimension; ++d)
+    acc[d] = 0.;
+  vdouble dudt_pressure = 0., dudt_visc = 0., de = 0.;
+  for(size_t b = 0; b < t.padded; b += width) {
+    vdouble r2, r;
+    distance(t, b, r2, r);
+    const vdouble h_ab = .5 * (h_a + vload(&t.h[b]));
+    const vdouble Pi_ab = viscosity(t, b, r2, h_ab, rho_a, c_a);
+    const vdouble rho_b = vload(&t.rho[b]);
+    const vdouble Prho2_b = vload(&t.P[b]) / (rho_b * rho_b);
+    const vdouble m_b = vload(&t.m[b]);
+    const vdouble g = kernel_t<KERNEL>::g(r, h_ab);
+    const vdouble f = -m_b * (Prho2_a + Prho2_b + Pi_ab) * g;
+    vdouble va_dot_dx = 0., vab_dot_dx = 0.;
+    for(size_t d = 0; d < gdimension; ++d) {
+      const vdouble dx = vload(&t.dx[d][b]);
+      acc[d] += f * dx;
+      va_dot_dx += v12_a[d] * dx;
+      vab_dot_dx += vload(&t.dv12[d][b]) * dx;
+    }
+    const vdouble vab_dot_DiWa = vab_dot_dx * g;
+    const vdouble va_dot_DiWa = va_dot_dx * g;
+    const vdouble vb_dot_DiWa = va_dot_DiWa - vab_dot_DiWa;
+    dudt_pressure += m_b * vab_dot_DiWa;
+    dudt_visc += m_b * vab_dot_DiWa * Pi_ab;
+    de -= m_b * (Prho2_a * vb_dot_DiWa + va_dot_DiWa * Prho2_b +
+                  .5 * Pi_ab * (vb_dot_DiWa + va_dot_DiWa));
+  }
+  for(size_t d = 0; d < gdimension; ++d)
+    acceleration[d] = vsum(acc[d]);
+  dudt = Prho2_a * vsum(dudt_pressure) + .5 * vsum(dudt_visc);
+  dedt = vsum(de);
+}
+
+/**
+ * @brief Whether the passes of this file are used for the kernel: enabled
+ *        by the sph_simd_kernels parameter or by the mixed precision build,
+ *        for the kernels with a vector version
+ */
+template<typename KERNEL>
+inline bool
+enabled() {
+  return kernel_t<KERNEL>::vectorized &&
+         (param::sph_simd_kernels || FLECSPH_SPH_MIXED_PRECISION);
+}
+
+} // namespace sph_simd
+
+#endif // _PHYSICS_SPH_SIMD_H_
@@ -0,0 +1,129 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+#include <omp.h>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int argc, char * argv[]) {}
+} // namespace execution
+} // namespace flecsi
+
+// Number of particles of the benchmark
+const size_t n = 1 << 20;
+
+double
+uniform() {
+  return double(rand()) / RAND_MAX;
+}
+
+/**
+ * @brief Particles in and slightly out of the unit box, where the walls act
+ */
+void
+build_particles(std::vector<body> & bodies) {
+  srand(42);
+  bodies.resize(n);
+  for(auto & b : bodies) {
+    point_t p;
+    for(size_t d = 0; d < gdimension; ++d)
+      p[d] = 1.2 * (uniform() - .5);
+    b.set_coordinates(p);
+    b.setAcceleration(0.);
+  }
+}
+
+/**
+ * @brief The selected composition gives the sum of the individual forces,
+ *        compiled or summed at runtime, and the post-pass adds it to the
+ *        acceleration of all the particles
+ */
+TEST(eforce, composition) {
+  using namespace param;
+  using namespace external_force;
+  _box_length = _box_width = _box_height = 1.;
+  _gravity_acceleration_constant = 1.;
+  _zero_potential_poison_value = 1.;
+  _sphere_radius = .5;
+  struct expected_t {
+    std::string efstr;
+    std::vector<acceleration_t> acc;
+    std::vector<potential_t> pot;
+  };
+  const std::vector<expected_t> cases = {
+    {"walls:xyz,gravity",
+      {acceleration_square_well<0>, acceleration_square_well<1>,
+        acceleration_square_well<2>, acceleration_gravity},
+      {potential_square_well<0>, potential_square_well<1>,
+        potential_square_well<2>, potential_gravity}},
+    {"walls:y,gravity", {acceleration_square_well<1>, acceleration_gravity},
+      {potential_square_well<1>, potential_gravity}},
+    // not compiled: summed at runtime
+    {"spherical wall,gravity,poison",
+      {acceleration_spherical_wall, acceleration_gravity},
+      {potential_spherical_wall, potential_gravity, potential_poison}},
+    {"walls:yy", {acceleration_square_well<1>, acceleration_square_well<1>},
+      {potential_square_well<1>, potential_square_well<1>}}};
+
+  std::vector<body> bodies;
+  build_particles(bodies);
+  for(auto & c : cases) {
+    select(c.efstr);
+    const bool compiled = acceleration_ != runtime_composition_t::acceleration;
+    double err_acc = 0, err_pot = 0;
+    for(size_t i = 0; i < n; i += 16) {
+      const point_t & rp = bodies[i].coordinates();
+      point_t acc = 0.;
+      double pot = 0.;
+      for(auto a : c.acc)
+        acc += a(rp);
+      for(auto p : c.pot)
+        pot += p(rp);
+      err_acc = std::max(err_acc,
+        distance(acceleration(bodies[i]), acc) / (magnitude(acc) + 1.));
+      err_pot = std::max(err_pot, fabs(potential(rp) - pot) / (fabs(pot) + 1.));
+    }
+    std::cout << c.efstr << (compiled ? " (compiled)" : " (runtime)")
+              << " max relative difference: acc " << err_acc << " potential "
+              << err_pot << std::endl;
+    ASSERT_TRUE(err_acc < 1.e-12);
+    ASSERT_TRUE(err_pot < 1.e-12);
+
+    std::vector<body> post = bodies;
+    add_acceleration(post);
+    for(size_t i = 0; i < n; i += 16)
+      ASSERT_TRUE(post[i].getAcceleration() == acceleration(bodies[i]));
+  }
+  select("none");
+}
+
+/**
+ * @brief Post-pass over all the particles: compiled composition and runtime
+ *        sum over the selected functions
+ */
+TEST(eforce, throughput) {
+  using namespace external_force;
+  std::vector<body> bodies;
+  build_particles(bodies);
+  select("walls:xyz,gravity");
+  runtime_composition_t::add_acceleration(bodies);
+  double start = omp_get_wtime();
+  add_acceleration(bodies);
+  const double time_compiled = omp_get_wtime() - start;
+  start = omp_get_wtime();
+  runtime_composition_t::add_acceleration(bodies);
+  const double time_runtime = omp_get_wtime() - start;
+  std::cout << "External forces on " << n << " bodies: compiled "
+            << time_compiled << "s runtime " << time_runtime << "s"
+            << std::endl;
+  select("none");
+}
@@ -0,0 +1,88 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+#include <omp.h>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int argc, char * argv[]) {}
+} // namespace execution
+} // namespace flecsi
+
+const size_t n = 1000000;
+
+double
+uniform() {
+  return double(rand()) / RAND_MAX;
+}
+
+/**
+ * @brief Particles with random thermodynamic state in the range of the
+ *        white dwarf EOS, initialized by the selected EOS
+ */
+void
+build_particles(std::vector<body> & bodies) {
+  srand(42);
+  bodies.resize(n);
+  for(auto & b : bodies) {
+    b.setDensity(pow(10., 4. + 6. * uniform()));
+    b.setInternalenergy(1. + uniform());
+    b.setPressure(1. + uniform());
+    b.setElectronfraction(.4 + .2 * uniform());
+    eos::init(b);
+  }
+}
+
+/**
+ * @brief The batched sweep gives the per particle EOS up to round-off;
+ *        throughput of both
+ */
+TEST(eos_batched, compare_scalar) {
+  using namespace param;
+  _ppt_density_thr = 1.e7;
+  for(auto e : {eos_polytropic, eos_ideal, eos_wd, eos_ppt}) {
+    _eos_type = e;
+    eos::select();
+    std::vector<body> scalar, batched;
+    build_particles(scalar);
+    batched = scalar;
+
+    double start = omp_get_wtime();
+    for(auto & b : scalar) {
+      eos::compute_pressure(b);
+      eos::compute_soundspeed(b);
+    }
+    const double time_scalar = omp_get_wtime() - start;
+    start = omp_get_wtime();
+    physics::compute_eos_batched(batched);
+    const double time_batched = omp_get_wtime() - start;
+
+    double err_p = 0, err_cs = 0;
+    for(size_t i = 0; i < n; ++i) {
+      const body & s = scalar[i];
+      const body & b = batched[i];
+      err_p = std::max(
+        err_p, fabs(b.getPressure() - s.getPressure()) / s.getPressure());
+      err_cs = std::max(err_cs,
+        fabs(b.getSoundspeed() - s.getSoundspeed()) / s.getSoundspeed());
+    }
+    std::cout << "EOS " << e << " max relative difference: P " << err_p
+              << " cs " << err_cs << std::endl;
+    std::cout << "Pressure and sound speed: per particle "
+              << n / time_scalar / 1.e6 << " M/s, batched "
+              << n / time_batched / 1.e6 << " M/s" << std::endl;
+    // vector math functions may differ in the last bits
+    ASSERT_TRUE(err_p < 1.e-10);
+    ASSERT_TRUE(err_cs < 1.e-10);
+  }
+  _eos_type = eos_ideal;
+}
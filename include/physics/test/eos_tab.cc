@@ -0,0 +1,258 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mpi.h>
+#include <omp.h>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int argc, char * argv[]) {}
+} // namespace execution
+} // namespace flecsi
+
+// MPI is shared by all the tests of this file
+class mpi_environment : public ::testing::Environment
+{
+public:
+  void SetUp() override {
+    MPI_Init(nullptr, nullptr);
+  }
+  void TearDown() override {
+    MPI_Finalize();
+  }
+};
+::testing::Environment * const mpi_env =
+  ::testing::AddGlobalTestEnvironment(new mpi_environment);
+
+const char * table_file = "eos_tab_test.h5";
+
+double
+uniform() {
+  return double(rand()) / RAND_MAX;
+}
+
+std::vector<double>
+linspace(const double & a, const double & b, const size_t & n) {
+  std::vector<double> x(n);
+  for(size_t i = 0; i < n; ++i)
+    x[i] = n > 1 ? a + i * (b - a) / (n - 1) : a;
+  return x;
+}
+
+void
+write_dataset(const hid_t & file,
+  const char * name,
+  const std::vector<double> & v) {
+  hsize_t size = v.size();
+  hid_t space = H5Screate_simple(1, &size, nullptr);
+  hid_t dataset = H5Dcreate2(file, name, H5T_NATIVE_DOUBLE, space,
+    H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  H5Dwrite(
+    dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, v.data());
+  H5Dclose(dataset);
+  H5Sclose(space);
+}
+
+/**
+ * @brief Write a table in the stellar collapse format, the fields are
+ *        functions of (rho, T, Ye) giving eps, P and cs^2
+ */
+template<typename EPS, typename P, typename CS2>
+void
+write_table(const std::vector<double> & lrho,
+  const std::vector<double> & ltemp,
+  const std::vector<double> & ye,
+  EPS && eps,
+  P && press,
+  CS2 && cs2) {
+  std::vector<double> le, lp, c2;
+  for(auto y : ye)
+    for(auto lt : ltemp)
+      for(auto lr : lrho) {
+        const double rho = pow(10., lr), temp = pow(10., lt);
+        le.push_back(log10(eps(rho, temp, y)));
+        lp.push_back(log10(press(rho, temp, y)));
+        c2.push_back(cs2(rho, temp, y));
+      }
+  hid_t file =
+    H5Fcreate(table_file, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  write_dataset(file, "energy_shift", {0.});
+  write_dataset(file, "logrho", lrho);
+  write_dataset(file, "logtemp", ltemp);
+  write_dataset(file, "ye", ye);
+  write_dataset(file, "logenergy", le);
+  write_dataset(file, "logpress", lp);
+  write_dataset(file, "cs2", c2);
+  H5Fclose(file);
+}
+
+/**
+ * @brief Gamma-law table as made by tools/dummyTabEOS/TabGamma.py: P and T
+ *        are linear in log eps, they are interpolated exactly. cs^2 is
+ *        linear in eps, it is interpolated in log eps.
+ */
+TEST(eos_tab, gamma_law) {
+  using namespace param;
+  const double gam = 5. / 3.;
+  auto eps = [&](double rho, double temp, double ye) {
+    return temp * MEV / (MP * (gam - 1.));
+  };
+  auto press = [&](double rho, double temp, double ye) {
+    return (gam - 1.) * rho * eps(rho, temp, ye);
+  };
+  auto cs2 = [&](double rho, double temp, double ye) {
+    return gam * (gam - 1.) * eps(rho, temp, ye);
+  };
+
+  for(size_t nye : {1, 3}) {
+    write_table(linspace(-4., 2., 50), linspace(-3., 1., 40),
+      linspace(0., .55, nye), eps, press, cs2);
+    _eos_type = eos_tab;
+    strcpy(_eos_tab_file_path, table_file);
+    eos::select();
+
+    srand(42);
+    double err_p = 0, err_cs = 0, err_t = 0, err_e = 0;
+    for(size_t i = 0; i < 1000; ++i) {
+      body b;
+      const double temp = pow(10., -2.5 + 3. * uniform());
+      b.setDensity(pow(10., -3. + 4. * uniform()));
+      b.setElectronfraction(.55 * uniform());
+      b.setInternalenergy(eps(b.getDensity(), temp, 0.));
+      eos::compute_pressure(b);
+      eos::compute_soundspeed(b);
+      eos::compute_temperature(b);
+      const double p = press(b.getDensity(), temp, 0.);
+      const double cs = sqrt(cs2(b.getDensity(), temp, 0.));
+      err_p = std::max(err_p, fabs(b.getPressure() - p) / p);
+      err_cs = std::max(err_cs, fabs(b.getSoundspeed() - cs) / cs);
+      err_t = std::max(err_t, fabs(b.getTemperature() - temp) / temp);
+      const double e = b.getInternalenergy();
+      eos::compute_internal_energy(b);
+      err_e = std::max(err_e, fabs(b.getInternalenergy() - e) / e);
+    }
+    std::cout << "Ye points " << nye << " max relative error: P " << err_p
+              << " cs " << err_cs << " T " << err_t << " eps " << err_e
+              << std::endl;
+    ASSERT_TRUE(err_p < 1.e-10);
+    ASSERT_TRUE(err_cs < 1.e-2);
+    ASSERT_TRUE(err_t < 1.e-10);
+    ASSERT_TRUE(err_e < 1.e-10);
+  }
+  eos::table.free();
+  remove(table_file);
+}
+
+/**
+ * @brief Cold white dwarf table: accuracy and throughput with respect to the
+ *        analytic pressure and sound speed of eos_wd
+ */
+TEST(eos_tab, white_dwarf) {
+  using namespace param;
+  using eos_wd_t = eos::eos_t<eos_wd>;
+  // internal energy only used to locate the cold column
+  auto eps = [&](double rho, double temp, double ye) {
+    body b;
+    b.setDensity(rho);
+    b.setElectronfraction(ye);
+    eos_wd_t::compute_internal_energy(b);
+    return b.getInternalenergy() * (1. + temp);
+  };
+  auto press = [&](double rho, double temp, double ye) {
+    return eos_wd_t::pressure_given_rhoYe(rho, ye);
+  };
+  auto cs2 = [&](double rho, double temp, double ye) {
+    return pow(eos_wd_t::soundspeed_given_rhoYe(rho, ye), 2);
+  };
+  write_table(linspace(4., 10., 600), linspace(-3., -2., 2),
+    linspace(.4, .6, 21), eps, press, cs2);
+  _eos_type = eos_tab;
+  strcpy(_eos_tab_file_path, table_file);
+  eos::select();
+
+  srand(42);
+  const size_t n = 1000000;
+  std::vector<body> analytic(n), tabulated(n);
+  for(size_t i = 0; i < n; ++i) {
+    analytic[i].setDensity(pow(10., 4.5 + 5. * uniform()));
+    analytic[i].setElectronfraction(.4 + .2 * uniform());
+    eos_wd_t::compute_internal_energy(analytic[i]);
+    tabulated[i] = analytic[i];
+  }
+
+  double start = omp_get_wtime();
+  for(auto & b : analytic) {
+    eos_wd_t::compute_pressure(b);
+    eos_wd_t::compute_soundspeed(b);
+  }
+  const double time_analytic = omp_get_wtime() - start;
+  start = omp_get_wtime();
+  for(auto & b : tabulated) {
+    eos::compute_pressure(b);
+    eos::compute_soundspeed(b);
+  }
+  const double time_tabulated = omp_get_wtime() - start;
+
+  double err_p = 0, err_cs = 0;
+  for(size_t i = 0; i < n; ++i) {
+    const body & a = analytic[i];
+    const body & t = tabulated[i];
+    err_p = std::max(
+      err_p, fabs(t.getPressure() - a.getPressure()) / a.getPressure());
+    err_cs = std::max(err_cs,
+      fabs(t.getSoundspeed() - a.getSoundspeed()) / a.getSoundspeed());
+  }
+  std::cout << "Max relative error: P " << err_p << " cs " << err_cs
+            << std::endl;
+  std::cout << "Pressure and sound speed: analytic "
+            << n / time_analytic / 1.e6 << " M/s, tabulated "
+            << n / time_tabulated / 1.e6 << " M/s" << std::endl;
+  ASSERT_TRUE(err_p < 1.e-3);
+  ASSERT_TRUE(err_cs < 1.e-3);
+  eos::table.free();
+  remove(table_file);
+}
+
+/**
+ * @brief Two tables queried in turn with the same arguments: each one gives
+ *        its own values, the cached cell of the last lookup is not shared
+ */
+TEST(eos_tab, two_tables) {
+  using namespace param;
+  eos::table_t tables[2];
+  const double gam[2] = {5. / 3., 4. / 3.};
+  for(int k = 0; k < 2; ++k) {
+    auto eps = [&](double rho, double temp, double ye) {
+      return temp * MEV / (MP * (gam[k] - 1.));
+    };
+    auto press = [&](double rho, double temp, double ye) {
+      return (gam[k] - 1.) * rho * eps(rho, temp, ye);
+    };
+    auto cs2 = [&](double rho, double temp, double ye) {
+      return gam[k] * (gam[k] - 1.) * eps(rho, temp, ye);
+    };
+    write_table(linspace(-4., 2., 50), linspace(-3., 1., 40),
+      linspace(0., .55, 1), eps, press, cs2);
+    ASSERT_TRUE(tables[k].load(table_file));
+  }
+
+  const double rho = 1., e = 1.e-2 * MEV / MP;
+  for(int repeat = 0; repeat < 2; ++repeat)
+    for(int k = 0; k < 2; ++k) {
+      const double p = (gam[k] - 1.) * rho * e;
+      ASSERT_TRUE(fabs(tables[k].pressure(rho, e, 0.) - p) / p < 1.e-10);
+    }
+  for(auto & t : tables)
+    t.free();
+  remove(table_file);
+}
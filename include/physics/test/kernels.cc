@@ -3,6 +3,7 @@
 #include <cmath>
 #include <iostream>
 #include <mpi.h>
+#include <omp.h>
 
 #include "kernels.h"
 #include "params.h"
@@ -113,3 +114,97 @@ TEST(kernel, wendland_c2_1d) {
 
   fclose(output);
 }
+
+/**
+ * @brief Accuracy of the tabulated kernels: maximum error on W and on the
+ *        gradient along r in [0,h], relative to their maximum
+ */
+TEST(kernel, tabulated_accuracy) {
+  using namespace param;
+  const size_t nsample = 100000;
+  _sph_kernel_tabulated = true;
+  for(auto k : {cubic_spline, quintic_spline, wendland_c2, wendland_c4,
+        wendland_c6, gaussian, super_gaussian, sinc_ker}) {
+    _sph_kernel = k;
+    select();
+    double err_w = 0, err_g = 0, max_w = 0, max_g = 0;
+    point_t p = 0.0;
+    for(size_t i = 0; i < nsample; ++i) {
+      p[0] = h * i / nsample;
+      const double w = sph_kernel_function(p[0], h);
+      const double g = sph_kernel_gradient(p, h)[0];
+      double w_ref, g_ref;
+      switch(k) {
+        case(cubic_spline):
+          w_ref = kernel<cubic_spline, gdimension>(p[0], h);
+          g_ref = kernel_gradient<cubic_spline, gdimension>(p, h)[0];
+          break;
+        case(quintic_spline):
+          w_ref = kernel<quintic_spline, gdimension>(p[0], h);
+          g_ref = kernel_gradient<quintic_spline, gdimension>(p, h)[0];
+          break;
+        case(wendland_c2):
+          w_ref = kernel<wendland_c2, gdimension>(p[0], h);
+          g_ref = kernel_gradient<wendland_c2, gdimension>(p, h)[0];
+          break;
+        case(wendland_c4):
+          w_ref = kernel<wendland_c4, gdimension>(p[0], h);
+          g_ref = kernel_gradient<wendland_c4, gdimension>(p, h)[0];
+          break;
+        case(wendland_c6):
+          w_ref = kernel<wendland_c6, gdimension>(p[0], h);
+          g_ref = kernel_gradient<wendland_c6, gdimension>(p, h)[0];
+          break;
+        case(gaussian):
+          w_ref = kernel<gaussian, gdimension>(p[0], h);
+          g_ref = kernel_gradient<gaussian, gdimension>(p, h)[0];
+          break;
+        case(super_gaussian):
+          w_ref = kernel<super_gaussian, gdimension>(p[0], h);
+          g_ref = kernel_gradient<super_gaussian, gdimension>(p, h)[0];
+          break;
+        default:
+          w_ref = kernel<sinc_ker, gdimension>(p[0], h);
+          g_ref = kernel_gradient<sinc_ker, gdimension>(p, h)[0];
+      }
+      err_w = std::max(err_w, fabs(w - w_ref));
+      err_g = std::max(err_g, fabs(g - g_ref));
+      max_w = std::max(max_w, fabs(w_ref));
+      max_g = std::max(max_g, fabs(g_ref));
+    }
+    std::cout << "Tabulated kernel " << k << ": relative error W "
+              << err_w / max_w << " gradient " << err_g / max_g << std::endl;
+    ASSERT_TRUE(err_w < 1.e-5 * max_w);
+    ASSERT_TRUE(err_g < 1.e-5 * max_g);
+  }
+  _sph_kernel_tabulated = false;
+}
+
+/**
+ * @brief Speed of the analytic and tabulated kernels
+ */
+TEST(kernel, tabulated_speed) {
+  using namespace param;
+  const size_t neval = 10000000;
+  for(auto k : {wendland_c4, sinc_ker}) {
+    _sph_kernel = k;
+    double time[2], sum[2];
+    for(int tab = 0; tab < 2; ++tab) {
+      _sph_kernel_tabulated = tab;
+      select();
+      point_t p = 0.0;
+      sum[tab] = 0;
+      double start = omp_get_wtime();
+      for(size_t i = 0; i < neval; ++i) {
+        p[0] = h * (i % 1000) / 1000.;
+        sum[tab] += sph_kernel_function(p[0], h) + sph_kernel_gradient(p, h)[0];
+      }
+      time[tab] = omp_get_wtime() - start;
+    }
+    std::cout << "Kernel " << k << ": analytic " << neval / time[0] / 1.e6
+              << " Meval/s, tabulated " << neval / time[1] / 1.e6
+              << " Meval/s" << std::endl;
+    ASSERT_TRUE(fabs(sum[1] - sum[0]) < 1.e-4 * fabs(sum[0]));
+  }
+  _sph_kernel_tabulated = false;
+}
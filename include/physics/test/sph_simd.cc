@@ -0,0 +1,278 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <mpi.h>
+#include <omp.h>
+
+#include "default_physics.h"
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int argc, char * argv[]) {}
+} // namespace execution
+} // namespace flecsi
+
+// Number of particles and neighbors per particle
+const size_t n = 1000;
+const size_t n_nb = 100;
+
+double
+uniform() {
+  return double(rand()) / RAND_MAX;
+}
+
+/**
+ * @brief Random particles in the unit box with variable smoothing length and
+ *        the n_nb closest particles as neighbors (itself included)
+ */
+void
+build_particles(std::vector<body> & bodies,
+  std::vector<std::vector<body *>> & nbs) {
+  srand(42);
+  bodies.resize(n);
+  for(size_t i = 0; i < n; ++i) {
+    point_t p, v, v12;
+    for(size_t d = 0; d < gdimension; ++d) {
+      p[d] = uniform();
+      v[d] = uniform() - .5;
+      v12[d] = uniform() - .5;
+    }
+    bodies[i].set_coordinates(p);
+    bodies[i].setVelocity(v);
+    bodies[i].setVelocityhalf(v12);
+    bodies[i].set_mass(1. / n);
+    bodies[i].setDensity(1. + uniform());
+    bodies[i].setPressure(1. + uniform());
+    bodies[i].setSoundspeed(1. + uniform());
+    bodies[i].set_id(i);
+  }
+  nbs.resize(n);
+  for(size_t i = 0; i < n; ++i) {
+    std::vector<std::pair<double, body *>> dist;
+    for(auto & b : bodies)
+      dist.push_back({distance(bodies[i].coordinates(), b.coordinates()), &b});
+    std::sort(dist.begin(), dist.end(),
+      [](auto & l, auto & r) { return l.first < r.first; });
+    nbs[i].clear();
+    for(size_t j = 0; j < n_nb; ++j)
+      nbs[i].push_back(dist[j].second);
+    // Support of the kernel slightly larger than the neighborhood
+    bodies[i].set_radius((.6 + .1 * uniform()) * dist[n_nb - 1].first);
+  }
+}
+
+/**
+ * @brief Run the density, acceleration, dudt and dedt passes on all the
+ *        particles
+ */
+void
+run_passes(std::vector<body> & bodies,
+  std::vector<std::vector<body *>> & nbs) {
+  for(size_t i = 0; i < n; ++i)
+    physics::compute_density(bodies[i], nbs[i]);
+  for(size_t i = 0; i < n; ++i) {
+    physics::compute_acceleration(bodies[i], nbs[i]);
+    physics::compute_dudt(bodies[i], nbs[i]);
+    physics::compute_dedt(bodies[i], nbs[i]);
+  }
+}
+
+/**
+ * @brief Vector and scalar passes give the same results up to round-off,
+ *        for all the kernels with a vector version
+ */
+TEST(sph_simd, compare_scalar) {
+  using namespace param;
+  for(auto k : {cubic_spline, quintic_spline, wendland_c2, wendland_c4,
+        wendland_c6, gaussian, super_gaussian}) {
+    _sph_kernel = k;
+    kernels::select();
+    physics::select();
+
+    std::vector<body> scalar;
+    std::vector<std::vector<body *>> nbs_scalar;
+    build_particles(scalar, nbs_scalar);
+    _sph_simd_kernels = false;
+    run_passes(scalar, nbs_scalar);
+
+    std::vector<body> vector;
+    std::vector<std::vector<body *>> nbs_vector;
+    build_particles(vector, nbs_vector);
+    _sph_simd_kernels = true;
+    run_passes(vector, nbs_vector);
+
+    double err_rho = 0, err_acc = 0, err_dudt = 0, err_dedt = 0;
+    for(size_t i = 0; i < n; ++i) {
+      const body & s = scalar[i];
+      const body & v = vector[i];
+      err_rho = std::max(err_rho,
+        fabs(v.getDensity() - s.getDensity()) / fabs(s.getDensity()));
+      err_acc = std::max(err_acc,
+        distance(v.getAcceleration(), s.getAcceleration()) /
+          magnitude(s.getAcceleration()));
+      err_dudt = std::max(
+        err_dudt, fabs(v.getDudt() - s.getDudt()) / fabs(s.getDudt()));
+      err_dedt = std::max(
+        err_dedt, fabs(v.getDedt() - s.getDedt()) / fabs(s.getDedt()));
+    }
+    std::cout << "Kernel " << k << " max relative difference: rho "
+              << err_rho << " acc " << err_acc << " dudt " << err_dudt
+              << " dedt " << err_dedt << std::endl;
+    ASSERT_TRUE(err_rho < 1.e-12);
+    ASSERT_TRUE(err_acc < 1.e-10);
+    ASSERT_TRUE(err_dudt < 1.e-10);
+    ASSERT_TRUE(err_dedt < 1.e-10);
+  }
+  _sph_simd_kernels = false;
+}
+
+/**
+ * @brief The fused acceleration and energy pass gives the separate passes
+ *        when the velocities are the half-step velocities, scalar and vector
+ */
+TEST(sph_simd, fused_rhs) {
+  using namespace param;
+  _sph_kernel = wendland_c4;
+  kernels::select();
+  physics::select();
+  for(int simd = 0; simd < 2; ++simd) {
+    _sph_simd_kernels = simd;
+    std::vector<body> separate, fused;
+    std::vector<std::vector<body *>> nbs_separate, nbs_fused;
+    build_particles(separate, nbs_separate);
+    build_particles(fused, nbs_fused);
+    for(size_t i = 0; i < n; ++i) {
+      separate[i].setVelocityhalf(separate[i].getVelocity());
+      fused[i].setVelocityhalf(fused[i].getVelocity());
+    }
+    run_passes(separate, nbs_separate);
+    for(size_t i = 0; i < n; ++i)
+      physics::compute_density(fused[i], nbs_fused[i]);
+
+    double err_acc = 0, err_dudt = 0, err_dedt = 0;
+    const bool thermokinetic_default = thermokinetic_formulation;
+    for(int thermokinetic = 0; thermokinetic < 2; ++thermokinetic) {
+      _thermokinetic_formulation = thermokinetic;
+      for(size_t i = 0; i < n; ++i)
+        physics::compute_acceleration_energy(fused[i], nbs_fused[i]);
+    }
+    _thermokinetic_formulation = thermokinetic_default;
+    for(size_t i = 0; i < n; ++i) {
+      const body & s = separate[i];
+      const body & f = fused[i];
+      err_acc = std::max(err_acc,
+        distance(f.getAcceleration(), s.getAcceleration()) /
+          magnitude(s.getAcceleration()));
+      err_dudt = std::max(
+        err_dudt, fabs(f.getDudt() - s.getDudt()) / fabs(s.getDudt()));
+      err_dedt = std::max(
+        err_dedt, fabs(f.getDedt() - s.getDedt()) / fabs(s.getDedt()));
+    }
+    std::cout << "SIMD " << simd << " fused max relative difference: acc "
+              << err_acc << " dudt " << err_dudt << " dedt " << err_dedt
+              << std::endl;
+    ASSERT_TRUE(err_acc < 1.e-10);
+    ASSERT_TRUE(err_dudt < 1.e-10);
+    ASSERT_TRUE(err_dedt < 1.e-10);
+  }
+  _sph_simd_kernels = false;
+}
+
+/**
+ * @brief Throughput of the scalar and vector passes, in pair interactions
+ *        per second
+ */
+TEST(sph_simd, throughput) {
+  using namespace param;
+  const size_t repeat = 20;
+  _sph_kernel = wendland_c4;
+  kernels::select();
+  physics::select();
+  std::vector<body> bodies;
+  std::vector<std::vector<body *>> nbs;
+  build_particles(bodies, nbs);
+
+  double time[2];
+  for(int simd = 0; simd < 2; ++simd) {
+    _sph_simd_kernels = simd;
+    double start = omp_get_wtime();
+    for(size_t r = 0; r < repeat; ++r)
+      run_passes(bodies, nbs);
+    time[simd] = omp_get_wtime() - start;
+  }
+  _sph_simd_kernels = false;
+
+  // Four passes on all the pairs
+  const double npairs = 4. * repeat * n * n_nb;
+  std::cout << "SIMD width " << sph_simd::width << std::endl;
+  std::cout << "Scalar passes: " << npairs / time[0] / 1.e6
+            << " Mpairs/s, vector passes: " << npairs / time[1] / 1.e6
+            << " Mpairs/s" << std::endl;
+}
+
+/**
+ * @brief Mixed precision passes, with the pair geometry in float, against
+ *        the double ones: accuracy and throughput in pair interactions per
+ *        second
+ */
+TEST(sph_simd, mixed_precision) {
+  using K = kernels::analytic<param::wendland_c4>;
+  const size_t repeat = 20;
+  std::vector<body> bodies;
+  std::vector<std::vector<body *>> nbs;
+  build_particles(bodies, nbs);
+
+  std::vector<double> rho[2], dudt[2], dedt[2];
+  std::vector<point_t> acc[2];
+  double time[2];
+  for(int mixed = 0; mixed < 2; ++mixed) {
+    rho[mixed].resize(n);
+    acc[mixed].resize(n);
+    dudt[mixed].resize(n);
+    dedt[mixed].resize(n);
+    double start = omp_get_wtime();
+    for(size_t r = 0; r < repeat; ++r)
+      for(size_t i = 0; i < n; ++i) {
+        if(mixed) {
+          rho[1][i] = sph_simd::density<K, float>(bodies[i], nbs[i]);
+          sph_simd::acceleration_energy<K, float>(
+            bodies[i], nbs[i], acc[1][i], dudt[1][i], dedt[1][i]);
+        }
+        else {
+          rho[0][i] = sph_simd::density<K, double>(bodies[i], nbs[i]);
+          sph_simd::acceleration_energy<K, double>(
+            bodies[i], nbs[i], acc[0][i], dudt[0][i], dedt[0][i]);
+        }
+      }
+    time[mixed] = omp_get_wtime() - start;
+  }
+
+  double err_rho = 0, err_acc = 0, err_dudt = 0, err_dedt = 0;
+  for(size_t i = 0; i < n; ++i) {
+    err_rho = std::max(err_rho, fabs(rho[1][i] - rho[0][i]) / rho[0][i]);
+    err_acc = std::max(
+      err_acc, distance(acc[1][i], acc[0][i]) / magnitude(acc[0][i]));
+    err_dudt =
+      std::max(err_dudt, fabs(dudt[1][i] - dudt[0][i]) / fabs(dudt[0][i]));
+    err_dedt =
+      std::max(err_dedt, fabs(dedt[1][i] - dedt[0][i]) / fabs(dedt[0][i]));
+  }
+  const double npairs = 2. * repeat * n * n_nb;
+  std::cout << "Mixed precision max relative difference: rho " << err_rho
+            << " acc " << err_acc << " dudt " << err_dudt << " dedt "
+            << err_dedt << std::endl;
+  std::cout << "Double passes: " << npairs / time[0] / 1.e6
+            << " Mpairs/s, mixed precision passes: "
+            << npairs / time[1] / 1.e6 << " Mpairs/s" << std::endl;
+  // dudt and dedt cancel between the neighbors with random velocities
+  ASSERT_TRUE(err_rho < 1.e-6);
+  ASSERT_TRUE(err_acc < 1.e-5);
+  ASSERT_TRUE(err_dudt < 1.e-3);
+  ASSERT_TRUE(err_dedt < 1.e-3);
+}
@@ -93,7 +93,7 @@ compute_density(body & particle, std::vector<body *> & nbs) {
     const body * const nb = nbs[b];
     double m_b = nb->mass();
     double h_b = nb->radius();
-    point_t pos_b = nb->coordinates();
+    point_t pos_b = boundary::nearest_image(pos_a, nb->coordinates());
     double r_ab = flecsi::magnitude(pos_a - pos_b);
     double Wab = sph_kernel_function(r_ab, .5 * (h_a + h_b));
     rho_a += m_b * Wab;
@@ -211,7 +211,7 @@ wvt_acceleration_arth(body & particle, std::vector<body *> & nbs) {
     for(int b = 0; b < n_nb; ++b) {
       const body * const nb = nbs[b];
       double h_b = nb->radius();
-      point_t pos_b = nb->coordinates();
+      point_t pos_b = boundary::nearest_image(pos_a, nb->coordinates());
       double r_ab = flecsi::distance(pos_a, pos_b);
       double h_ab = 0.5 * (h_a + h_b);
       double W_ab = sph_kernel_function(r_ab, h_ab) * pow(h_ab, gdimension);
@@ -297,7 +297,7 @@ wvt_acceleration_diehl(body & particle, std::vector<body *> & nbs) {
       double h_b = nb->radius();
       double h_ab = 0.5 * (h_a + h_b);
 
-      point_t pos_b = nb->coordinates();
+      point_t pos_b = boundary::nearest_image(pos_a, nb->coordinates());
       double r_ab = flecsi::distance(pos_a, pos_b);
       double W_ab =
         SQ(h_ab / (r_ab + eps * h_ab)) - SQ(h_ab / (h_ab + eps * h_ab));
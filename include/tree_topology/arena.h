@@ -0,0 +1,230 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2019 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+#ifndef flecsi_topology_arena_h
+#define flecsi_topology_arena_h
+
+/*!
+  \file arena.h
+  \brief Bump allocator for the scratch data of the tree traversals and
+  construction. The memory is carved from large blocks and only given back
+  when the arena is rewound: a traversal opens a scope and all its scratch
+  containers are released at once at the end. After the first steps the
+  arena holds a single block large enough for a whole traversal and does
+  not allocate from the heap anymore.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace flecsi {
+namespace topology {
+
+class arena
+{
+public:
+  //! Position in the arena, to rewind to
+  struct marker {
+    size_t block;
+    size_t offset;
+  };
+
+  /**
+   * @brief Scope of scratch allocations: everything allocated in the arena
+   * during the lifetime of the scope is released at its end. The scratch
+   * containers must be declared after the scope.
+   */
+  class scope
+  {
+  public:
+    scope(arena & a) : arena_(a), mark_(a.mark()) {}
+    ~scope() {
+      arena_.rewind(mark_);
+    }
+    scope(const scope &) = delete;
+    scope & operator=(const scope &) = delete;
+
+  private:
+    arena & arena_;
+    marker mark_;
+  };
+
+  arena(const size_t & block_size = 1 << 16) : block_size_(block_size) {}
+  //! The scratch memory is not shared: a copy starts empty
+  arena(const arena & other) : block_size_(other.block_size_) {}
+  arena & operator=(const arena &) {
+    return *this;
+  }
+
+  void * allocate(const size_t & bytes, const size_t & align) {
+    ++allocations_;
+    while(true) {
+      if(current_ < blocks_.size()) {
+        const uintptr_t base =
+          reinterpret_cast<uintptr_t>(blocks_[current_].data.get());
+        const size_t start =
+          (base + offset_ + align - 1) / align * align - base;
+        if(start + bytes <= blocks_[current_].size) {
+          offset_ = start + bytes;
+          high_water_ = std::max(high_water_, position_());
+          return blocks_[current_].data.get() + start;
+        } // if
+        // The end of this block stays unused until the arena is rewound
+        if(current_ + 1 < blocks_.size()) {
+          ++current_;
+          offset_ = 0;
+          continue;
+        } // if
+      } // if
+      add_block_(std::max(block_size_, bytes + align));
+    } // while
+  }
+
+  /**
+   * @brief Only the last allocation is given back, the other ones wait for
+   * the end of their scope
+   */
+  void deallocate(void * p, const size_t & bytes) {
+    if(current_ < blocks_.size() &&
+       static_cast<char *>(p) + bytes ==
+         blocks_[current_].data.get() + offset_) {
+      offset_ -= bytes;
+    } // if
+  }
+
+  marker mark() const {
+    return {current_, offset_};
+  }
+
+  /**
+   * @brief Release everything allocated after the marker. Back at the
+   * beginning, the blocks are merged in one for the next use.
+   */
+  void rewind(const marker & m) {
+    current_ = m.block;
+    offset_ = m.offset;
+    if(current_ == 0 && offset_ == 0 && blocks_.size() > 1) {
+      const size_t total = capacity();
+      blocks_.clear();
+      add_block_(total);
+    } // if
+  }
+
+  //! Number of blocks taken from the heap since the construction
+  size_t heap_allocations() const {
+    return heap_allocations_;
+  }
+
+  //! Number of allocations served since the construction
+  size_t allocations() const {
+    return allocations_;
+  }
+
+  //! Largest extent of the scratch memory in use at once, in bytes
+  size_t high_water() const {
+    return high_water_;
+  }
+
+  //! Memory held by the arena, in bytes
+  size_t capacity() const {
+    size_t total = 0;
+    for(auto & b : blocks_)
+      total += b.size;
+    return total;
+  }
+
+private:
+  struct block_t {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  //! Bytes from the beginning of the arena to the current position
+  size_t position_() const {
+    size_t position = offset_;
+    for(size_t b = 0; b < current_; ++b)
+      position += blocks_[b].size;
+    return position;
+  }
+
+  void add_block_(const size_t & size) {
+    blocks_.push_back({std::unique_ptr<char[]>(new char[size]), size});
+    current_ = blocks_.size() - 1;
+    offset_ = 0;
+    ++heap_allocations_;
+  }
+
+  size_t block_size_;
+  std::vector<block_t> blocks_;
+  size_t current_ = 0;
+  size_t offset_ = 0;
+  size_t high_water_ = 0;
+  size_t allocations_ = 0;
+  size_t heap_allocations_ = 0;
+}; // class arena
+
+/**
+ * @brief Standard allocator on an arena, for the scratch containers
+ */
+template<typename T>
+class arena_allocator
+{
+public:
+  using value_type = T;
+
+  arena_allocator(arena & a) : arena_(&a) {}
+  template<typename U>
+  arena_allocator(const arena_allocator<U> & other)
+    : arena_(other.get_arena()) {}
+
+  T * allocate(const size_t & n) {
+    return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T * p, const size_t & n) {
+    arena_->deallocate(p, n * sizeof(T));
+  }
+
+  arena * get_arena() const {
+    return arena_;
+  }
+
+  template<typename U>
+  bool operator==(const arena_allocator<U> & other) const {
+    return arena_ == other.get_arena();
+  }
+  template<typename U>
+  bool operator!=(const arena_allocator<U> & other) const {
+    return arena_ != other.get_arena();
+  }
+
+private:
+  arena * arena_;
+}; // class arena_allocator
+
+template<typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+} // namespace topology
+} // namespace flecsi
+
+#endif // flecsi_topology_arena_h
@@ -0,0 +1,164 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2019 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+#ifndef flecsi_topology_cell_list_h
+#define flecsi_topology_cell_list_h
+
+/*!
+  \file cell_list.h
+  \brief Uniform grid of cells over the entities, for the neighbor search of
+  problems with a nearly uniform smoothing length (see
+  tree_topology::set_cell_list). The cells are at least as large as the
+  search radius: the neighbors of an entity are in the 3^D cells around its
+  own cell.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "space_vector.h"
+
+namespace flecsi {
+namespace topology {
+
+template<typename T, size_t D>
+class cell_list
+{
+public:
+  using point_t = space_vector_u<T, D>;
+
+  /**
+   * @brief Sort the entities in cells of side at least support over the box
+   * [bmin, bmax]. Along the periodic axes (period > 0) the cells tile the
+   * period and wrap around. The entities are kept in their order inside a
+   * cell, key order for the sorted entities of the tree.
+   */
+  template<typename E>
+  void build(const std::vector<E> & entities,
+    const point_t & bmin,
+    const point_t & bmax,
+    const T & support,
+    const point_t & period) {
+    size_t ncells = 1;
+    for(size_t d = 0; d < D; ++d) {
+      const T extent = period[d] > 0 ? period[d] : bmax[d] - bmin[d];
+      origin_[d] = bmin[d];
+      period_[d] = period[d];
+      n_[d] = std::max(size_t(1), size_t(extent / support));
+      ncells *= n_[d];
+    } // for
+    // Not much more cells than entities for the small supports
+    while(ncells > 2 * entities.size() + 1) {
+      ncells = 1;
+      for(size_t d = 0; d < D; ++d) {
+        n_[d] = std::max(size_t(1), n_[d] / 2);
+        ncells *= n_[d];
+      } // for
+    } // while
+    for(size_t d = 0; d < D; ++d) {
+      const T extent = period[d] > 0 ? period[d] : bmax[d] - bmin[d];
+      width_[d] = extent > 0 ? extent / n_[d] : T(1);
+    } // for
+
+    // Counting sort of the entities by cell
+    cell_.resize(entities.size());
+    start_.assign(ncells + 1, 0);
+    for(size_t i = 0; i < entities.size(); ++i) {
+      cell_[i] = cell_index_(entities[i].coordinates());
+      ++start_[cell_[i] + 1];
+    } // for
+    for(size_t c = 0; c < ncells; ++c)
+      start_[c + 1] += start_[c];
+    fill_.assign(start_.begin(), start_.end() - 1);
+    index_.resize(entities.size());
+    for(size_t i = 0; i < entities.size(); ++i)
+      index_[fill_[cell_[i]]++] = i;
+  }
+
+  /**
+   * @brief Apply F to the index of each entity in the cells around the
+   * position, each cell once
+   */
+  template<typename F>
+  void adjacent(const point_t & p, F && f) const {
+    // Distinct cells along each axis
+    size_t axis[D][3], naxis[D];
+    for(size_t d = 0; d < D; ++d) {
+      const long c = cell_coordinate_(p[d], d), n = n_[d];
+      naxis[d] = 0;
+      if(period_[d] > 0 && n <= 3) {
+        for(long k = 0; k < n; ++k)
+          axis[d][naxis[d]++] = k;
+        continue;
+      }
+      for(long k = c - 1; k <= c + 1; ++k) {
+        if(period_[d] > 0)
+          axis[d][naxis[d]++] = (k + n) % n;
+        else if(k >= 0 && k < n)
+          axis[d][naxis[d]++] = k;
+      } // for
+    } // for
+    // Loop over the product of the axes
+    size_t counter[D] = {0};
+    while(true) {
+      size_t c = 0;
+      for(size_t d = D; d-- > 0;)
+        c = c * n_[d] + axis[d][counter[d]];
+      for(size_t k = start_[c]; k < start_[c + 1]; ++k)
+        f(index_[k]);
+      size_t d = 0;
+      while(d < D && ++counter[d] == naxis[d])
+        counter[d++] = 0;
+      if(d == D)
+        break;
+    } // while
+  }
+
+  size_t ncells() const {
+    return start_.empty() ? 0 : start_.size() - 1;
+  }
+
+private:
+  long cell_coordinate_(const T & x, const size_t & d) const {
+    const long n = n_[d];
+    long c = std::floor((x - origin_[d]) / width_[d]);
+    if(period_[d] > 0)
+      return (c % n + n) % n;
+    return std::min(std::max(c, 0L), n - 1);
+  }
+
+  size_t cell_index_(const point_t & p) const {
+    size_t c = 0;
+    for(size_t d = D; d-- > 0;)
+      c = c * n_[d] + cell_coordinate_(p[d], d);
+    return c;
+  }
+
+  point_t origin_, width_, period_;
+  size_t n_[D];
+  std::vector<size_t> start_; // first entity of each cell in index_
+  std::vector<size_t> fill_;
+  std::vector<size_t> index_; // entities sorted by cell
+  std::vector<size_t> cell_; // cell of each entity
+}; // class cell_list
+
+} // namespace topology
+} // namespace flecsi
+
+#endif // flecsi_topology_cell_list_h
@@ -0,0 +1,161 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2019 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+#ifndef flecsi_topology_neighbor_span_h
+#define flecsi_topology_neighbor_span_h
+
+/*!
+  \file neighbor_span.h
+  \brief Neighbors of an entity as 32-bit indices in the local entities
+  followed by the shared (remote) ones. The SPH traversals store the lists
+  of a group in one flat buffer and hand out a span per entity, see
+  tree_topology::traversal_sph_if.
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+namespace flecsi {
+namespace topology {
+
+template<typename E>
+class neighbor_span
+{
+public:
+  using index_t = uint32_t;
+
+  /**
+   * @brief Element of a mutable span: converts to the entity pointer and
+   * assigns the index of another element, so that the passes written for a
+   * std::vector<E *> can reduce the list in place
+   */
+  class reference
+  {
+  public:
+    reference(index_t & index, const neighbor_span & span)
+      : index_(index), span_(span) {}
+    reference & operator=(const reference & other) {
+      index_ = other.index_;
+      return *this;
+    }
+    operator E *() const {
+      return span_.entity(index_);
+    }
+    E * operator->() const {
+      return span_.entity(index_);
+    }
+
+  private:
+    index_t & index_;
+    const neighbor_span & span_;
+  };
+
+  class iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = E *;
+    using difference_type = std::ptrdiff_t;
+    using pointer = E **;
+    using reference = E *;
+    iterator(const index_t * cur, const neighbor_span & span)
+      : cur_(cur), span_(&span) {}
+    E * operator*() const {
+      return span_->entity(*cur_);
+    }
+    iterator & operator++() {
+      ++cur_;
+      return *this;
+    }
+    bool operator==(const iterator & other) const {
+      return cur_ == other.cur_;
+    }
+    bool operator!=(const iterator & other) const {
+      return cur_ != other.cur_;
+    }
+
+  private:
+    const index_t * cur_;
+    const neighbor_span * span_;
+  };
+
+  /**
+   * @brief Span of the indices [first, first + size), the indices below
+   * nlocal are local entities and the others shared entities
+   */
+  neighbor_span(index_t * first,
+    const size_t & size,
+    E * local,
+    const size_t & nlocal,
+    E * shared)
+    : first_(first), size_(size), local_(local), nlocal_(nlocal),
+      shared_(shared) {}
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  E * operator[](const size_t & k) const {
+    return entity(first_[k]);
+  }
+
+  reference operator[](const size_t & k) {
+    return reference(first_[k], *this);
+  }
+
+  //! Index of the k-th neighbor in the local then shared entities
+  index_t index(const size_t & k) const {
+    return first_[k];
+  }
+
+  //! Only shrinks the span: keeps the first n neighbors
+  void resize(const size_t & n) {
+    assert(n <= size_);
+    size_ = n;
+  }
+
+  iterator begin() const {
+    return iterator(first_, *this);
+  }
+
+  iterator end() const {
+    return iterator(first_ + size_, *this);
+  }
+
+  E * entity(const index_t & i) const {
+    return i < nlocal_ ? local_ + i : shared_ + (i - nlocal_);
+  }
+
+private:
+  index_t * first_;
+  size_t size_;
+  E * local_;
+  size_t nlocal_;
+  E * shared_;
+}; // class neighbor_span
+
+} // namespace topology
+} // namespace flecsi
+
+#endif // flecsi_topology_neighbor_span_h
@@ -365,6 +365,91 @@ struct tree_geometry<T, 3> {
   }
 }; // class tree_geometry specification for 3D
 
+/*-----------------------------------------------------------------------------*
+ * class tree_periodic_geometry
+ *-----------------------------------------------------------------------------*/
+/**
+ * Geometry tests of tree_geometry in a periodic domain, minimum image
+ * convention: the period is zero along the non-periodic axes.
+ */
+template<typename T, size_t D>
+struct tree_periodic_geometry {
+  using point_t = space_vector_u<T, D>;
+  using element_t = T;
+
+  //! Separation d along an axis of period l, of the nearest image
+  static element_t image(element_t d, const element_t & l) {
+    if(l > 0)
+      d -= l * std::round(d / l);
+    return d;
+  }
+
+  //! Distance along an axis of period l from c to the nearest image of the
+  //! interval [min, max]
+  static element_t interval_distance(const element_t & c,
+    const element_t & min,
+    const element_t & max,
+    const element_t & l) {
+    element_t d = std::max(element_t(0), std::max(min - c, c - max));
+    if(l > 0) {
+      d = std::min(
+        d, std::max(element_t(0), std::max(min - c - l, c + l - max)));
+      d = std::min(
+        d, std::max(element_t(0), std::max(min - c + l, c - l - max)));
+    }
+    return d;
+  }
+
+  static element_t distance2(const point_t & p1,
+    const point_t & p2,
+    const point_t & period) {
+    element_t dist = 0;
+    for(size_t d = 0; d < D; ++d) {
+      const element_t x = image(p1[d] - p2[d], period[d]);
+      dist += x * x;
+    }
+    return dist;
+  }
+
+  //! Return true if dist^2 < radius^2
+  static bool within_distance2(const point_t & p1,
+    const point_t & p2,
+    const element_t & r,
+    const point_t & period) {
+    return distance2(p1, p2, period) <= r * r;
+  }
+
+  //! Intersection of sphere and box, with the nearest image of the box
+  static bool intersects_sphere_box(const point_t & min,
+    const point_t & max,
+    const point_t & c,
+    const element_t & r,
+    const point_t & period) {
+    element_t dist = 0;
+    for(size_t d = 0; d < D; ++d) {
+      const element_t x = interval_distance(c[d], min[d], max[d], period[d]);
+      dist += x * x;
+    }
+    return dist <= r * r;
+  }
+
+  //! Intersection between two boxes, with the nearest image of the second
+  static bool intersects_box_box(const point_t & min_b1,
+    const point_t & max_b1,
+    const point_t & min_b2,
+    const point_t & max_b2,
+    const point_t & period) {
+    for(size_t d = 0; d < D; ++d) {
+      // Distance from the center of box 2 to the box 1 grown by its size
+      const element_t h = .5 * (max_b2[d] - min_b2[d]);
+      const element_t c = .5 * (max_b2[d] + min_b2[d]);
+      if(interval_distance(c, min_b1[d] - h, max_b1[d] + h, period[d]) > 0)
+        return false;
+    }
+    return true;
+  }
+}; // class tree_periodic_geometry
+
 } // namespace topology
 } // namespace flecsi
 
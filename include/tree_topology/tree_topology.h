@@ -40,6 +40,7 @@
 #include <set>
 #include <stack>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -50,6 +51,9 @@
 #include "space_vector.h"
 
 //#include "hashtable.h"
+#include "arena.h"
+#include "cell_list.h"
+#include "neighbor_span.h"
 #include "tree_geometry.h"
 #include "tree_types.h"
 
@@ -79,6 +83,12 @@ public:
   using key_t = typename Policy::key_t;
   using entity_t = typename Policy::entity_t;
   using geometry_t = tree_geometry<element_t, dimension>;
+  using pgeometry_t = tree_periodic_geometry<element_t, dimension>;
+  using cell_list_t = cell_list<element_t, dimension>;
+  using neighbor_span_t = neighbor_span<entity_t>;
+  using index_t = typename neighbor_span_t::index_t;
+  template<typename T>
+  using scratch_vector = arena_vector<T>;
   using cofm_t = typename Policy::cofm_t;
   using hcell_t = hcell<dimension, key_t, cofm_t, entity_t>;
   using key_int_t = typename Policy::key_int_t;
@@ -127,10 +137,34 @@ private:
     DONE_COMMS = 14
   };
 
+  /**
+   * @brief Entry of the FMM interaction list cache.
+   * The recorded entries form a partition of the space of interactions:
+   * CACHE_PAIR: pair of cells where the walk stopped (MAC or p2p)
+   * CACHE_SPLIT_FIRST/SECOND: the first/second cell has been split, stands
+   * for the children that were absent (empty) at record time
+   * CACHE_SPLIT_SELF: same for the self-interaction of a cell
+   */
+  enum CACHE : int {
+    CACHE_PAIR = 0,
+    CACHE_SPLIT_FIRST = 1,
+    CACHE_SPLIT_SECOND = 2,
+    CACHE_SPLIT_SELF = 3
+  };
+  struct fmm_cache_entry_t {
+    fmm_cache_entry_t(int c1, int c2, int t, int c = 0)
+      : cell1(c1), cell2(c2), type(t), children(c){};
+    int cell1; // index in fmm_cache_keys_
+    int cell2;
+    int type;
+    int children; // mask of the children present at record time
+  };
+
 public:
   tree_topology() {
     int size;
     MPI_Comm_size(MPI_COMM_WORLD,&size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
     comms_done_.resize(size);
   }
   ~tree_topology() {}
@@ -142,6 +176,7 @@ public:
   void clean() {
     cofm_.clear();
     htable_.clear();
+    remote_owners_.clear();
     shared_entities_.clear();
     shared_nodes_.clear();
   }
@@ -163,6 +198,101 @@ public:
     range_ = range;
   }
 
+  /**
+   * @brief Maximum number of entities in a group of the SPH traversal
+   */
+  void set_sub_entities(const int & sub_entities) {
+    sub_entities_ = sub_entities;
+  }
+
+  int sub_entities() const {
+    return sub_entities_;
+  }
+
+  /**
+   * @brief Factor on the radius of the entities for the neighbor search of
+   * the SPH traversal: the neighbors are a superset of the ones in the
+   * radius, 1 by default
+   */
+  void set_search_padding(const double & padding) {
+    search_padding_ = padding;
+  }
+
+  /**
+   * @brief Periods of the domain for the SPH traversal and find_in_radius,
+   * zero along the non-periodic axes: the neighbors are searched with the
+   * minimum image convention instead of ghost copies of the entities. The
+   * entities have to be inside the periodic box.
+   */
+  void set_period(const point_t & period) {
+    period_ = period;
+    periodic_ = false;
+    for(size_t d = 0; d < dimension; ++d)
+      periodic_ = periodic_ || period[d] > 0;
+  }
+
+  /**
+   * @brief Search the neighbors of the SPH traversal in a uniform grid of
+   * cells instead of the tree, for nearly uniform radii (see cell_list.h).
+   * Only used on a single rank: the remote entities are only found by the
+   * tree traversal.
+   */
+  void set_cell_list(const bool & enable) {
+    cell_list_enabled_ = enable;
+  }
+
+  bool cell_list_enabled() const {
+    return cell_list_enabled_;
+  }
+
+  /**
+   * @brief Cells with less entities are computed directly (p2p) in the FMM
+   * traversal instead of being split
+   */
+  void set_fmm_sub_entities(const int & fmm_sub_entities) {
+    fmm_sub_entities_ = fmm_sub_entities;
+  }
+
+  int fmm_sub_entities() const {
+    return fmm_sub_entities_;
+  }
+
+  /**
+   * @brief Pairs of cells further apart than the cutoff are ignored by the
+   * FMM traversal (short-range walk of TreePM), 0 to disable
+   */
+  void set_fmm_cutoff(const double & cutoff) {
+    fmm_cutoff_ = cutoff;
+  }
+
+  /**
+   * @brief Record the interaction list of the FMM traversal and replay it in
+   * the next traversals instead of walking the tree from the root.
+   * The recording walk uses a MAC tightened by the margin, so that the
+   * recorded pairs stay valid while the particles move. Replayed pairs are
+   * checked against the MAC again and only the invalid ones are split.
+   * The list is kept until clear_fmm_cache() is called.
+   * Only used on a single rank: with several ranks, the ownership of the
+   * cells changes at every iteration.
+   */
+  void set_fmm_cache(const bool & enable, const double & margin = 0.) {
+    fmm_cache_ = enable;
+    fmm_cache_margin_ = margin;
+    clear_fmm_cache();
+  }
+
+  /**
+   * @brief Force a full FMM walk in the next traversal
+   */
+  void clear_fmm_cache() {
+    fmm_cache_list_.clear();
+    fmm_cache_keys_.clear();
+  }
+
+  size_t fmm_cache_size() const {
+    return fmm_cache_list_.size();
+  }
+
   /**
    * @brief Get the range
    */
@@ -186,42 +316,77 @@ public:
   }
 
   /**
-   * @brief Generic traversal function
+   * @brief Generic traversal function.
+   * The stack is in the scratch arena, sized for the depth of the tree.
    */
   template<typename FUNC, typename... ARGS>
   void traversal(hcell_t * cell, FUNC && func, ARGS &&... args) {
-    std::stack<hcell_t *> stk;
-    stk.push(cell);
+    scratch_vector<hcell_t *> stk(scratch_allocator_<hcell_t *>());
+    stk.reserve((max_depth_ + 1) * nchildren_);
+    stk.push_back(cell);
     while(!stk.empty()) {
-      hcell_t * cur = stk.top();
-      stk.pop();
+      hcell_t * cur = stk.back();
+      stk.pop_back();
       if(func(cur, std::forward<ARGS>(args)...)) {
         hcell_t * daughters[nchildren_] = {nullptr};
         int children = 0;
         daughters_(cur, daughters, children);
         for(int i = 0; i < children; ++i) {
-          stk.push(daughters[i]);
+          stk.push_back(daughters[i]);
         } // for
       } // if
     } // while
   }
 
+  /**
+   * @brief Arena of the scratch data of the traversals and of the tree
+   * construction, with its allocation counters
+   */
+  const arena & scratch_arena() const {
+    return scratch_arena_;
+  }
+
   /**
 ` * @brief Apply a function EF to the sub_cells using asynchronous comms.
   */
   template<typename EF, typename... ARGS>
   void traversal_sph(EF && ef, ARGS &&... args) {
+    traversal_sph_if([](const entity_t &) { return true; },
+      std::forward<EF>(ef), std::forward<ARGS>(args)...);
+  } // traversal_sph
+
+  /**
+   * @brief Apply a function EF to the local entities for which the predicate
+   * AF is true, the active ones. The sub_cells without active entity are
+   * skipped and the neighbors are only gathered for the active entities;
+   * all the entities are still found as neighbors.
+   * The neighbor lists of a sub_cell are 32-bit indices in one flat buffer.
+   * EF receives them as a neighbor_span if it accepts one, as a vector of
+   * pointers otherwise.
+   * The scratch data is taken from the arena and released at the end.
+   */
+  template<typename AF, typename EF, typename... ARGS>
+  void traversal_sph_if(AF && active, EF && ef, ARGS &&... args) {
     log_one(trace) << "Traversal SPH" << std::endl;
     double start = omp_get_wtime();
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    arena::scope scratch_scope(scratch_arena_);
+
+    if(cell_list_enabled_ && size == 1) {
+      traversal_cells_if_(active, ef, std::forward<ARGS>(args)...);
+      log_one(trace) << std::fixed << std::setprecision(3)
+                     << "Traversal SPH (cells).done: "
+                     << omp_get_wtime() - start << "s" << std::endl;
+      return;
+    }
 
     // Find all nodes of the tree with at most sub_entities_ elements
-    std::vector<key_t> cells;
+    scratch_vector<key_t> cells(scratch_allocator_<key_t>());
     traversal(
       root(),
-      [&](hcell_t * cell, std::vector<key_t> & c, const int & sent) {
+      [&](hcell_t * cell, scratch_vector<key_t> & c, const int & sent) {
         if(cell->is_node() &&
            (cell->is_shared() || get_node(cell)->sub_entities() > sent)) {
           return true;
@@ -236,14 +401,23 @@ public:
 
     // prepare comms arrays
     init_comms_(size);
-    std::stack<key_t> stk_nonlocal;
+    std::stack<key_t, scratch_vector<key_t>> stk_nonlocal(
+      scratch_allocator_<key_t>());
 
     // Traversal data
-    std::vector<std::vector<key_t>> request_keys;
+    std::vector<std::vector<key_t>> & request_keys = request_keys_;
     request_keys.resize(size);
-    std::vector<hcell_t *> * queue = new std::vector<hcell_t *>();
-    std::vector<hcell_t *> * new_queue = new std::vector<hcell_t *>();
-    std::vector<std::vector<entity_t *>> neighbors;
+    scratch_vector<hcell_t *> queue_a(scratch_allocator_<hcell_t *>());
+    scratch_vector<hcell_t *> queue_b(scratch_allocator_<hcell_t *>());
+    scratch_vector<hcell_t *> * queue = &queue_a;
+    scratch_vector<hcell_t *> * new_queue = &queue_b;
+    // Active entities of the sub_cell, entities near the sub_cell, then the
+    // neighbors of each entity
+    scratch_vector<entity_t *> cur_entities(scratch_allocator_<entity_t *>());
+    scratch_vector<index_t> candidates(scratch_allocator_<index_t>());
+    scratch_vector<index_t> neighbors(scratch_allocator_<index_t>());
+    scratch_vector<size_t> offsets(scratch_allocator_<size_t>());
+    std::vector<entity_t *> & scratch = scratch_entities_;
     hcell_t* daughters[nchildren_];
     int children;
 
@@ -285,19 +459,19 @@ public:
       bool rank_request = false;
 
       hcell_t * cur = &(htable_.find(curkey)->second);
-      std::vector<entity_t *> cur_entities;
+      cur_entities.clear();
 
       cofm_t * cur_node = nullptr;
 
       if(cur->is_node()) {
         traversal(
           cur,
-          [&](hcell_t * cell, std::vector<entity_t *> & ce) {
+          [&](hcell_t * cell, scratch_vector<entity_t *> & ce) {
             if(cell->is_node()) {
               return true;
             }
             else {
-              if(!cell->is_shared())
+              if(!cell->is_shared() && active(*get_entity(cell)))
                 ce.push_back(get_entity(cell));
             }
             return false;
@@ -306,11 +480,23 @@ public:
         cur_node = get_node(cur);
       }
       else {
-        cur_entities.push_back(get_entity(cur));
+        if(active(*get_entity(cur)))
+          cur_entities.push_back(get_entity(cur));
+      } // if
+      if(cur_entities.empty())
+        continue;
+
+      // Box of the group, extended for the padded search
+      point_t cur_bmin, cur_bmax;
+      if(cur_node != nullptr) {
+        const element_t margin = (search_padding_ - 1.) * cur_node->lap();
+        for(size_t d = 0; d < dimension; ++d) {
+          cur_bmin[d] = cur_node->bmin()[d] - margin;
+          cur_bmax[d] = cur_node->bmax()[d] + margin;
+        } // for
       } // if
 
-      neighbors.clear();
-      neighbors.resize(cur_entities.size());
+      candidates.clear();
       queue->clear();
       queue->push_back(root());
 
@@ -324,24 +510,25 @@ public:
             cofm_t * c = get_node(hcur);
             // Check if node concerned
             if(cur_node != nullptr) {
-              if(!geometry_t::intersects_box_box(
-                   c->bmin(), c->bmax(), cur_node->bmin(), cur_node->bmax())) {
+              if(!intersects_box_box_(
+                   c->bmin(), c->bmax(), cur_bmin, cur_bmax)) {
                 continue;
               }
             } // if
             // If yes, check for all entities before request
             for(int k = 0; k < cur_entities.size() && !accepted; ++k) {
-              if(geometry_t::intersects_sphere_box(c->bmin(), c->bmax(),
-                   cur_entities[k]->coordinates(), cur_entities[k]->radius())) {
+              if(intersects_sphere_box_(c->bmin(), c->bmax(),
+                   cur_entities[k]->coordinates(),
+                   search_padding_ * cur_entities[k]->radius())) {
                 accepted = true;
                 if(hcur->is_empty_node()) {
                   non_local = true;
                   if(!hcur->requested()) {
 #ifdef _DEBUG_TREE_
-                    assert(hcur->owner() != rank);
+                    assert(owner(hcur) != rank);
 #endif
                     hcur->set_requested();
-                    request_keys[hcur->owner()].push_back(hcur->key());
+                    request_keys[owner(hcur)].push_back(hcur->key());
                     rank_request = true;
                   }
                 }
@@ -364,19 +551,13 @@ public:
 #endif
             if(cur_node != nullptr) {
               element_t extent_ent =
-                std::max(e->radius(), cur_node->lap()) + cur_node->radius();
-              if(!geometry_t::within_distance2(
+                search_padding_ * std::max(e->radius(), cur_node->lap()) +
+                cur_node->radius();
+              if(!within_distance2_(
                    e->coordinates(), cur_node->coordinates(), extent_ent))
                 continue;
             }
-            for(int k = 0; k < cur_entities.size(); ++k) {
-              element_t extent =
-                std::max(cur_entities[k]->radius(), e->radius());
-              if(geometry_t::within_distance2(
-                   cur_entities[k]->coordinates(), e->coordinates(), extent)) {
-                neighbors[k].push_back(e);
-              } // if
-            } // for
+            candidates.push_back(unified_index_(hcur));
           } // if
         } // for
         if(non_local) {
@@ -399,11 +580,29 @@ public:
 
       } // while
       if(!non_local) {
+        neighbors.clear();
+        offsets.resize(cur_entities.size() + 1);
+        for(int k = 0; k < cur_entities.size(); ++k) {
+          offsets[k] = neighbors.size();
+          for(auto c : candidates) {
+            const entity_t * e = unified_entity_(c);
+            element_t extent =
+              search_padding_ *
+              std::max(cur_entities[k]->radius(), e->radius());
+            if(within_distance2_(
+                 cur_entities[k]->coordinates(), e->coordinates(), extent))
+              neighbors.push_back(c);
+          } // for
+        } // for
+        offsets[cur_entities.size()] = neighbors.size();
         for(int j = 0; j < cur_entities.size(); ++j) {
 #ifdef _DEBUG_TREE_
-          assert(neighbors[j].size() != 0);
+          assert(offsets[j + 1] != offsets[j]);
 #endif
-          ef(*cur_entities[j], neighbors[j], std::forward<ARGS>(args)...);
+          neighbor_span_t nbs = neighbor_span_(
+            neighbors.data() + offsets[j], offsets[j + 1] - offsets[j]);
+          apply_sph_(
+            ef, *cur_entities[j], nbs, scratch, std::forward<ARGS>(args)...);
         } // for
       } // if
     } // while
@@ -423,11 +622,6 @@ public:
 
     clean_comms_();
 
-    queue->clear();
-    new_queue->clear();
-    delete queue;
-    delete new_queue;
-
     MPI_Barrier(MPI_COMM_WORLD);
     double tree_timer = omp_get_wtime() - start;
     log_one(trace) << std::fixed << std::setprecision(3)
@@ -439,41 +633,184 @@ public:
                    << lost_timer_ * 100 / tree_timer << "%)"
 #endif
                    << std::endl;
-  } // traversal_sph
+  } // traversal_sph_if
+
+  /**
+   * @brief Apply a function EF(entity, neighbors, nlocal) to the sub_cells,
+   * with each pair of local entities given once: the neighbors are the local
+   * ones stored after the entity, [0, nlocal), then the remote ones. EF
+   * updates both entities of a local pair and only the entity for a remote
+   * pair. The neighbor search is symmetric (max of the two radii).
+   */
+  template<typename EF, typename... ARGS>
+  void traversal_sph_half_pairs(EF && ef, ARGS &&... args) {
+    const std::less<const entity_t *> before;
+    const entity_t * const first = entities_.data();
+    const entity_t * const last = first + entities_.size();
+    std::vector<entity_t *> & half = scratch_half_;
+    traversal_sph([&](entity_t & e, neighbor_span_t & nbs) {
+      half.clear();
+      for(auto nb : nbs) {
+        if(before(&e, nb) && before(nb, last))
+          half.push_back(nb);
+      } // for
+      const size_t nlocal = half.size();
+      for(auto nb : nbs) {
+        if(before(nb, first) || !before(nb, last))
+          half.push_back(nb);
+      } // for
+      ef(e, half, nlocal, std::forward<ARGS>(args)...);
+    });
+  } // traversal_sph_half_pairs
 
   /**
    * @brief Fast Multipole Method Traversal.
    * Perform a tree traversal and update the missing neighbors.
+   * If the mutual functions m_c2c, m_p2c and m_p2p are provided, pairs of
+   * locally owned cells are only visited once and a single evaluation
+   * updates both cells (Dehnen-style mutual interactions):
+   *   - m_c2c(node, node): update the Taylor coefficients of both nodes
+   *   - m_p2c(node, entity): update the node coefficients and the entity
+   *   - m_p2p(entity, entity): update both entities
+   * Pairs involving remote cells stay one-sided.
    */
-  template<typename C2C, typename P2C, typename P2P, typename C2P>
+  template<typename C2C,
+    typename P2C,
+    typename P2P,
+    typename C2P,
+    typename MC2C = std::nullptr_t,
+    typename MP2C = std::nullptr_t,
+    typename MP2P = std::nullptr_t>
   void traversal_fmm(const double MAC,
     C2C && t_c2c,
     P2C && t_p2c,
     P2P && f_p2p,
-    C2P && f_c2p) {
-    log_one(trace) << "Traversal FMM (" << MAC << ")" << std::endl;
+    C2P && f_c2p,
+    MC2C && m_c2c = nullptr,
+    MP2C && m_p2c = nullptr,
+    MP2P && m_p2p = nullptr) {
+    constexpr bool mutual =
+      !std::is_same<typename std::decay<MC2C>::type, std::nullptr_t>::value;
+    log_one(trace) << "Traversal FMM (" << MAC << ")"
+                   << (mutual ? " mutual" : "") << std::endl;
     double start = omp_get_wtime();
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
     init_comms_(size);
+    arena::scope scratch_scope(scratch_arena_);
 
     // Find pairs of interacting cells
-    using interaction_t = std::pair<key_t, key_t>;
-    std::vector<interaction_t> * queue = new std::vector<interaction_t>();
-    std::vector<interaction_t> * new_queue = new std::vector<interaction_t>();
-    std::vector<interaction_t> p2p;
-    std::vector<entity_t *> subs;
-    std::vector<entity_t *> neighbors;
+    using interaction_t = std::pair<hcell_t *, hcell_t *>;
+    scratch_vector<interaction_t> queue_a(scratch_allocator_<interaction_t>());
+    scratch_vector<interaction_t> queue_b(scratch_allocator_<interaction_t>());
+    scratch_vector<interaction_t> * queue = &queue_a;
+    scratch_vector<interaction_t> * new_queue = &queue_b;
+    scratch_vector<interaction_t> p2p(scratch_allocator_<interaction_t>());
+    // Sinks and sources of the p2p and c2p functions, which take std::vector
+    std::vector<entity_t *> & subs = scratch_entities_;
+    std::vector<entity_t *> & neighbors = scratch_sources_;
     hcell_t * daughters[nchildren_];
     int children;
     double lost_time;
 
-    std::vector<std::vector<key_t>> request_keys;
+    std::vector<std::vector<key_t>> & request_keys = request_keys_;
     request_keys.resize(size);
+    std::vector<std::vector<key_t>> & request_keys_subtree =
+      request_keys_subtree_;
+    request_keys_subtree.resize(size);
+
+    // Start from the interactions recorded in a previous traversal if any,
+    // otherwise walk from the root and record them
+    const bool replay = fmm_cache_ && size == 1 && !fmm_cache_list_.empty();
+    const bool record = fmm_cache_ && size == 1 && !replay;
+    double mac = MAC;
+    if(replay) {
+      // Each recorded cell is resolved once in the new tree
+      scratch_vector<hcell_t *> cells(
+        fmm_cache_keys_.size(), scratch_allocator_<hcell_t *>());
+      for(size_t k = 0; k < fmm_cache_keys_.size(); ++k) {
+        cells[k] = fmm_cache_resolve_(fmm_cache_keys_[k]);
+      } // for
+      scratch_vector<hcell_t *> new_children(scratch_allocator_<hcell_t *>());
+      for(auto & c : fmm_cache_list_) {
+        hcell_t * hc1 = cells[c.cell1];
+        hcell_t * hc2 = cells[c.cell2];
+        if(hc1 == nullptr || hc2 == nullptr)
+          continue;
+        switch(c.type) {
+          case CACHE_PAIR:
+            queue->emplace_back(hc1, hc2);
+            break;
+          case CACHE_SPLIT_FIRST:
+            fmm_cache_new_children_(
+              fmm_cache_keys_[c.cell1], hc1, c.children, new_children);
+            for(auto & hc : new_children)
+              queue->emplace_back(hc, hc2);
+            break;
+          case CACHE_SPLIT_SECOND:
+            fmm_cache_new_children_(
+              fmm_cache_keys_[c.cell2], hc2, c.children, new_children);
+            for(auto & hc : new_children)
+              queue->emplace_back(hc1, hc);
+            break;
+          case CACHE_SPLIT_SELF: {
+            // A single entity does not interact with itself, nor a region
+            // now inside a bigger entity cell
+            if(hc1->is_entity() || hc1->key() != fmm_cache_keys_[c.cell1])
+              break;
+            daughters_(hc1, daughters, children);
+            for(int k1 = 0; k1 < children; ++k1) {
+              int j1 = daughters[k1]->key().last_value();
+              for(int k2 = mutual ? k1 : 0; k2 < children; ++k2) {
+                int j2 = daughters[k2]->key().last_value();
+                if(c.children & (1 << j1) && c.children & (1 << j2))
+                  continue;
+                queue->emplace_back(daughters[k1], daughters[k2]);
+              } // for
+            } // for
+            break;
+          }
+        } // switch
+      } // for
+      log_one(trace) << "Replay " << queue->size() << "/"
+                     << fmm_cache_list_.size() << " cached interactions"
+                     << std::endl;
+    }
+    else {
+      if(record)
+        mac = MAC * (1. - fmm_cache_margin_);
+      queue->emplace_back(root(), root());
+    }
+    // Index of the recorded keys in fmm_cache_keys_
+    using cache_index_value_t = std::pair<const key_t, int>;
+    std::unordered_map<key_t, int, branch_id_hasher__<key_t>,
+      std::equal_to<key_t>, arena_allocator<cache_index_value_t>>
+      cache_index(0, branch_id_hasher__<key_t>(), std::equal_to<key_t>(),
+        scratch_allocator_<cache_index_value_t>());
+    auto cache_key = [&](const key_t & key) {
+      auto it = cache_index.find(key);
+      if(it != cache_index.end())
+        return it->second;
+      cache_index.emplace(key, fmm_cache_keys_.size());
+      fmm_cache_keys_.push_back(key);
+      return int(fmm_cache_keys_.size()) - 1;
+    };
+    auto cache_pair = [&](const key_t & k1, const key_t & k2) {
+      fmm_cache_list_.emplace_back(cache_key(k1), cache_key(k2), CACHE_PAIR);
+    };
+    auto cache_split = [&](const key_t & k1, const key_t & k2, int type,
+                         hcell_t * hc) {
+      int mask = 0;
+      for(int j = 0; j < nchildren_; ++j) {
+        mask |= hc->get_child(j) << j;
+      }
+      if(mask != (1 << nchildren_) - 1)
+        fmm_cache_list_.emplace_back(
+          cache_key(k1), cache_key(k2), type, mask);
+    };
 
-    queue->emplace_back(key_t::root(), key_t::root());
     while(not queue->empty()) {
 
       if(size > 1)
@@ -488,17 +825,21 @@ public:
         lost_time = omp_get_wtime();
 #endif
 
-        key_t khc1 = (*queue)[i].first;
-        key_t khc2 = (*queue)[i].second;
-        hcell_t * hc1 = &(htable_.find(khc1)->second);
-        hcell_t * hc2 = &(htable_.find(khc2)->second);
+        hcell_t * hc1 = (*queue)[i].first;
+        hcell_t * hc2 = (*queue)[i].second;
+        key_t khc1 = hc1->key();
+        key_t khc2 = hc2->key();
 
         assert(hc1->iam_owner());
 
         if(!hc2->is_empty_node()) {
+          // both cells are local: this pair stands for both directions
+          const bool mutual_pair = mutual && khc1 != khc2 && hc2->iam_owner();
           if(hc1->is_entity() && hc2->is_entity()) {
             // both are entities: append interaction to the p2p list
             p2p.push_back((*queue)[i]);
+            if(record)
+              cache_pair(khc1, khc2);
           }
           else { // at least one is a node
 
@@ -507,21 +848,27 @@ public:
 
               if(get_node(hc1)->sub_entities() < fmm_sub_entities_) {
                 p2p.push_back((*queue)[i]);
+                if(record)
+                  cache_pair(khc1, khc2);
               }
               else {
                 // split it for self-interaction
+                if(record)
+                  cache_split(khc1, khc2, CACHE_SPLIT_SELF, hc1);
                 daughters_(hc1, daughters, children);
                 for(int k1 = 0; k1 < children; ++k1) {
                   if(daughters[k1]->iam_owner())
-                    new_queue->emplace_back(
-                      daughters[k1]->key(), daughters[k1]->key());
+                    new_queue->emplace_back(daughters[k1], daughters[k1]);
                   for(int k2 = k1 + 1; k2 < children; ++k2) {
+                    if(mutual && daughters[k1]->iam_owner() &&
+                       daughters[k2]->iam_owner()) {
+                      new_queue->emplace_back(daughters[k1], daughters[k2]);
+                      continue;
+                    }
                     if(daughters[k1]->iam_owner())
-                      new_queue->emplace_back(
-                        daughters[k1]->key(), daughters[k2]->key());
+                      new_queue->emplace_back(daughters[k1], daughters[k2]);
                     if(daughters[k2]->iam_owner())
-                      new_queue->emplace_back(
-                        daughters[k2]->key(), daughters[k1]->key());
+                      new_queue->emplace_back(daughters[k2], daughters[k1]);
                   }
                 } // for k1
               }
@@ -555,32 +902,71 @@ public:
                 coords2 = e->coordinates();
               }
 
-              if(geometry_t::mac(coords1, radius1, coords2, radius2, MAC)) {
+              if(fmm_cutoff_ > 0. &&
+                 distance(coords1, coords2) - radius1 - radius2 >
+                   fmm_cutoff_) {
+                // beyond the cutoff: no short-range interaction
+                if(record)
+                  cache_pair(khc1, khc2);
+              }
+              else if(geometry_t::mac(
+                        coords1, radius1, coords2, radius2, mac)) {
                 assert(hc1->is_node() or hc2->is_node());
+                if(record)
+                  cache_pair(khc1, khc2);
                 if(hc1->is_node()) {
                   cofm_t * n1 = get_node(hc1);
                   if(hc2->is_node()) {
-                    t_c2c(n1, get_node(hc2));
+                    cofm_t * n2 = get_node(hc2);
+                    if(mutual_pair) {
+                      if constexpr(mutual) {
+                        m_c2c(n1, n2);
+                        n2->set_affected(true);
+                      }
+                    }
+                    else {
+                      t_c2c(n1, n2);
+                    }
                   }
                   else {
                     entity_t * e = get_entity(hc2);
-                    t_p2c(n1, e);
+                    if(mutual_pair) {
+                      if constexpr(mutual) {
+                        m_p2c(n1, e);
+                      }
+                    }
+                    else {
+                      t_p2c(n1, e);
+                    }
                   }
                   // save this node for later c2c interactions
                   n1->set_affected(true);
                 }
                 else { // hc1 is an entity
-                  neighbors.clear();
-                  subs.clear();
-                  subs.push_back(get_entity(hc1));
-                  f_p2p(subs, get_node(hc2), neighbors);
+                  if(mutual_pair) {
+                    if constexpr(mutual) {
+                      cofm_t * n2 = get_node(hc2);
+                      m_p2c(n2, get_entity(hc1));
+                      n2->set_affected(true);
+                    }
+                  }
+                  else {
+                    neighbors.clear();
+                    subs.clear();
+                    subs.push_back(get_entity(hc1));
+                    f_p2p(subs, get_node(hc2), neighbors);
+                  }
                 }
               }
               else { // nodes do not satisfy MAC
                 if(subent1 + subent2 < fmm_sub_entities_) {
                   // if not enough subentities, give up with splitting
                   p2p.push_back((*queue)[i]);
-                  std::vector<std::vector<key_t>> request_keys_subtree(size);
+                  if(record)
+                    cache_pair(khc1, khc2);
+                  // the p2p pass is one-sided for nodes: add the reverse
+                  if(mutual_pair)
+                    p2p.emplace_back(hc2, hc1);
                   bool rqst_subtree = false;
                   if(hc2->is_shared()) {
                     traversal(
@@ -596,9 +982,9 @@ public:
                         //}
                         if(cell->is_empty_node() && !cell->requested()) {
                           rqst_subtree = true;
-                          assert(cell->owner() != rank);
+                          assert(owner(cell) != rank);
                           cell->set_requested();
-                          nk[cell->owner()].push_back(cell->key());
+                          nk[owner(cell)].push_back(cell->key());
                           return false;
                         }
                         return true;
@@ -607,8 +993,11 @@ public:
                       request_keys_subtree);
                   }
                   // Send request
-                  if(rqst_subtree)
+                  if(rqst_subtree) {
                     request_(request_keys_subtree, REQUEST_SUBTREE);
+                    for(auto & k : request_keys_subtree)
+                      k.clear();
+                  }
                   // Retrieve the non local particles of this sub-tree
                 }
                 else {
@@ -616,18 +1005,25 @@ public:
                     // node that if one of the cells is an entity, then its
                     // radius will be zero; the other one must be the node with
                     // nonzero radius
+                    if(record)
+                      cache_split(khc1, khc2, CACHE_SPLIT_FIRST, hc1);
                     daughters_(hc1, daughters, children);
                     for(int k = 0; k < children; ++k) {
                       if(daughters[k]->iam_owner()) {
-                        new_queue->emplace_back(
-                          daughters[k]->key(), hc2->key());
+                        new_queue->emplace_back(daughters[k], hc2);
+                      }
+                      else if(mutual_pair) {
+                        // remote daughter: keep the hc2 side one-sided
+                        new_queue->emplace_back(hc2, daughters[k]);
                       }
                     }
                   }
                   else {
+                    if(record)
+                      cache_split(khc1, khc2, CACHE_SPLIT_SECOND, hc2);
                     daughters_(hc2, daughters, children);
                     for(int k = 0; k < children; ++k) {
-                      new_queue->emplace_back(hc1->key(), daughters[k]->key());
+                      new_queue->emplace_back(hc1, daughters[k]);
                     }
                   }
                 } // if enough subentities for splitting
@@ -639,13 +1035,13 @@ public:
           // Check if node is empty and retrieve if needed
           if(!hc2->requested()) {
 #ifdef _DEBUG_TREE_
-            assert(hc2->owner() != rank);
+            assert(owner(hc2) != rank);
 #endif
             hc2->set_requested();
-            request_keys[hc2->owner()].push_back(hc2->key());
+            request_keys[owner(hc2)].push_back(hc2->key());
             rank_request = true;
           }
-          new_queue->emplace_back(hc1->key(), hc2->key());
+          new_queue->emplace_back(hc1, hc2);
 #ifdef _DEBUG_TREE_
           lost_timer_ += omp_get_wtime() - lost_time;
 #endif
@@ -664,8 +1060,10 @@ public:
 
     if(size > 1) {
       comms_all_done_ = false;
-      std::vector<MPI_Request> done_requests(size);
-      std::vector<MPI_Status>  done_status(size);
+      scratch_vector<MPI_Request> done_requests(
+        size, scratch_allocator_<MPI_Request>());
+      scratch_vector<MPI_Status> done_status(
+        size, scratch_allocator_<MPI_Status>());
       for(int i = 0; i < size; ++i) {
         MPI_Issend(nullptr, 0, MPI_INT, i, DONE_COMMS, MPI_COMM_WORLD,
             &done_requests[i]);
@@ -679,10 +1077,10 @@ public:
 
 
     // node-node interaction
-    std::vector<hcell_t *> affected_nodes;
+    scratch_vector<hcell_t *> affected_nodes(scratch_allocator_<hcell_t *>());
     traversal(
       root(),
-      [&](hcell_t * cell, std::vector<hcell_t *> & hc) {
+      [&](hcell_t * cell, scratch_vector<hcell_t *> & hc) {
         if(!cell->iam_owner()) {
           return false; // do not expand others' nodes
         }
@@ -718,11 +1116,11 @@ public:
     }
 
     for(int i = 0; i < p2p.size(); ++i) {
-      hcell_t * hc1 = &(htable_.find(p2p[i].first)->second);
-      hcell_t * hc2 = &(htable_.find(p2p[i].second)->second);
+      hcell_t * hc1 = p2p[i].first;
+      hcell_t * hc2 = p2p[i].second;
 
       // subentities of hc1
-      std::vector<entity_t *> subs;
+      subs.clear();
       if(hc1->is_node()) {
         traversal(
           hc1,
@@ -763,12 +1161,13 @@ public:
         neighbors.push_back(get_entity(hc2));
       }
 
-      if(hc1->is_node()) {
-        f_c2p(get_node(hc1), subs);
+      if(mutual && hc1->is_entity() && hc2->is_entity() && hc1 != hc2 &&
+         hc2->iam_owner()) {
+        if constexpr(mutual) {
+          m_p2p(get_entity(hc1), get_entity(hc2));
+        }
       }
       else {
-        subs.clear();
-        subs.push_back(get_entity(hc1));
         f_p2p(subs, nullptr, neighbors);
       }
 
@@ -776,11 +1175,6 @@ public:
 
     clean_comms_();
 
-    queue->clear();
-    new_queue->clear();
-    delete queue;
-    delete new_queue;
-
     MPI_Barrier(MPI_COMM_WORLD);
     double tree_timer = omp_get_wtime() - start;
     log_one(trace) << std::fixed << std::setprecision(3)
@@ -807,13 +1201,13 @@ public:
         if(cur->is_node()) {
           cofm_t * c = get_node(cur);
           element_t extent = std::max(c->lap(), radius) + c->radius();
-          if(geometry_t::within_distance2(c->coordinates(), center, extent))
+          if(within_distance2_(c->coordinates(), center, extent))
             return true;
         }
         else {
           entity_t * e = get_entity(cur);
           element_t extent = std::max(radius, e->radius());
-          if(geometry_t::within_distance2(center, e->coordinates(), extent))
+          if(within_distance2_(center, e->coordinates(), extent))
             result.push_back(e);
         }
         return false;
@@ -849,6 +1243,16 @@ public:
     return get_node(root());
   }
 
+  /**
+   * @brief Memory of the hash table of the cells, in bytes: one allocation
+   * per cell with the value and the link, and the buckets
+   */
+  size_t htable_memory() const {
+    return htable_.size() *
+             (sizeof(typename umap_t::value_type) + sizeof(void *)) +
+           htable_.bucket_count() * sizeof(void *);
+  }
+
   /**
    * @brief Generic information for the tree topology
    */
@@ -882,6 +1286,7 @@ public:
     int size, rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    arena::scope scratch_scope(scratch_arena_);
 
     /* Exchange high and low bound */
     key_t lokey = entities_[0].key();
@@ -1012,6 +1417,16 @@ public:
     return hc->is_shared() ? &shared_entities_[idx] : &entities_[idx];
   }
 
+  /**
+   * @brief Rank owning a cell: this rank or, for the remote cells, the one
+   * recorded when the cell was received
+   */
+  int owner(const hcell_t * hc) const {
+    if(hc->iam_owner())
+      return rank_;
+    return remote_owners_.find(hc->key())->second;
+  }
+
   /**
    * @brief Return a node linked to a cell
    * This takes care of the local/shared node
@@ -1033,6 +1448,118 @@ public:
   }
 
 private:
+  /**
+   * @brief SPH traversal with the cell list: the grid is built over the
+   * entities in key order, with cells of the largest search radius, and the
+   * neighbors of each active entity are searched in the cells around it
+   */
+  template<typename AF, typename EF, typename... ARGS>
+  void traversal_cells_if_(AF && active, EF && ef, ARGS &&... args) {
+    element_t h_max = 0;
+    for(auto & e : entities_)
+      h_max = std::max(h_max, e.radius());
+    cell_list_.build(
+      entities_, range_[0], range_[1], search_padding_ * h_max, period_);
+    scratch_vector<index_t> neighbors(scratch_allocator_<index_t>());
+    std::vector<entity_t *> & scratch = scratch_entities_;
+    for(auto & e : entities_) {
+      if(!active(e))
+        continue;
+      neighbors.clear();
+      cell_list_.adjacent(e.coordinates(), [&](const size_t & j) {
+        const entity_t & nb = entities_[j];
+        const element_t extent =
+          search_padding_ * std::max(e.radius(), nb.radius());
+        if(within_distance2_(e.coordinates(), nb.coordinates(), extent))
+          neighbors.push_back(j);
+      });
+      neighbor_span_t nbs = neighbor_span_(neighbors.data(), neighbors.size());
+      apply_sph_(ef, e, nbs, scratch, std::forward<ARGS>(args)...);
+    } // for
+  }
+
+  void set_owner_(hcell_t * hc, const int & owner) {
+    hc->set_remote(owner != rank_);
+    if(owner != rank_)
+      remote_owners_[hc->key()] = owner;
+    else
+      remote_owners_.erase(hc->key());
+  }
+
+  /**
+   * @brief Index of an entity cell in the local entities followed by the
+   * shared ones, and back
+   */
+  index_t unified_index_(const hcell_t * hc) const {
+    return hc->is_shared() ? entities_.size() + hc->entity_idx()
+                           : hc->entity_idx();
+  }
+
+  entity_t * unified_entity_(const index_t & i) {
+    return i < entities_.size() ? &entities_[i]
+                                : &shared_entities_[i - entities_.size()];
+  }
+
+  neighbor_span_t neighbor_span_(index_t * first, const size_t & size) {
+    assert(entities_.size() + shared_entities_.size() <= UINT32_MAX);
+    return neighbor_span_t(first, size, entities_.data(), entities_.size(),
+      shared_entities_.data());
+  }
+
+  template<typename T>
+  arena_allocator<T> scratch_allocator_() {
+    return arena_allocator<T>(scratch_arena_);
+  }
+
+  /**
+   * @brief Call EF on an entity and its neighbors: with the span if EF takes
+   * one, with the pointers copied in the scratch vector otherwise
+   */
+  template<typename EF, typename... ARGS>
+  void apply_sph_(EF && ef,
+    entity_t & e,
+    neighbor_span_t & nbs,
+    std::vector<entity_t *> & scratch,
+    ARGS &&... args) {
+    if constexpr(std::is_invocable_v<EF, entity_t &, neighbor_span_t &,
+                   ARGS...>)
+      ef(e, nbs, std::forward<ARGS>(args)...);
+    else {
+      scratch.assign(nbs.begin(), nbs.end());
+      ef(e, scratch, std::forward<ARGS>(args)...);
+    }
+  }
+
+  /**
+   * @brief Geometry tests of the neighbor searches, periodic or not
+   */
+  bool within_distance2_(const point_t & p1,
+    const point_t & p2,
+    const element_t & r) const {
+    if(periodic_)
+      return pgeometry_t::within_distance2(p1, p2, r, period_);
+    return geometry_t::within_distance2(p1, p2, r);
+  }
+
+  bool intersects_sphere_box_(const point_t & min,
+    const point_t & max,
+    const point_t & c,
+    const element_t & r) const {
+    if(periodic_)
+      return pgeometry_t::intersects_sphere_box(min, max, c, r, period_);
+    return geometry_t::intersects_sphere_box(min, max, c, r);
+  }
+
+  bool intersects_box_box_(const point_t & min_b1,
+    const point_t & max_b1,
+    const point_t & min_b2,
+    const point_t & max_b2) const {
+    if(periodic_)
+      return pgeometry_t::intersects_box_box(
+        min_b1, max_b1, min_b2, max_b2, period_);
+    return geometry_t::intersects_box_box(min_b1, max_b1, min_b2, max_b2);
+  }
+
   /**
    * @brief      Export to a file the current tree in memory
    * This is useful for small number of particles to see the tree
@@ -1089,7 +1616,7 @@ private:
         cofm_t * c = cur->is_shared() ? &shared_nodes_[idx] : &cofm_[idx];
         output << std::oct << cur->key() << std::dec << " [label=\"" << std::oct
                << cur->key() << std::dec << "\", xlabel=\"" << cur->nchildren()
-               << "," << c->sub_entities() << "," << cur->owner() << "\"];"
+               << "," << c->sub_entities() << "," << owner(cur) << "\"];"
                << std::endl;
         if(cur->is_shared()) {
           output << std::oct << cur->key() << std::dec
@@ -1119,7 +1646,7 @@ private:
       }
       else {
         output << std::oct << cur->key() << std::dec << " [label=\"" << std::oct
-               << cur->key() << std::dec << "\", xlabel=\"" << cur->owner()
+               << cur->key() << std::dec << "\", xlabel=\"" << owner(cur)
                << "\"];" << std::endl;
         if(cur->is_shared()) {
           output << std::oct << cur->key() << std::dec
@@ -1318,7 +1845,7 @@ private:
 #ifdef _DEBUG_TREE_
       assert(cur->is_node());
 #endif
-      tmp_nodes_replies.emplace_back(cur->owner(),cur->key(),*get_node(cur),
+      tmp_nodes_replies.emplace_back(owner(cur),cur->key(),*get_node(cur),
           cur->nchildren());
       for(int j = 0; j < nchildren_; ++j) {
         if(cur->get_child(j)) {
@@ -1329,12 +1856,12 @@ private:
           assert(child != htable_.end());
 #endif
           if(child->second.is_node()) {
-            tmp_nodes_replies.emplace_back(child->second.owner(),
+            tmp_nodes_replies.emplace_back(owner(&child->second),
               child->second.key(), *get_node(&child->second),
               child->second.nchildren());
           }
           else if(child->second.is_entity()) {
-            tmp_entities_replies.emplace_back(child->second.owner(),
+            tmp_entities_replies.emplace_back(owner(&child->second),
               child->second.key(), *get_entity(&child->second));
           }
 #ifdef _DEBUG_TREE_
@@ -1417,12 +1944,12 @@ private:
         if(cells[j]->is_node()) {
           cells[j]->set_nchildren_to_receive(cells[j]->nchildren());
           tmp_nodes_replies.emplace_back(
-            cells[j]->owner(), cells[j]->key(), *get_node(cells[j]),
+            owner(cells[j]), cells[j]->key(), *get_node(cells[j]),
             cells[j]->nchildren());
         }
         else if(cells[j]->is_entity()) {
           tmp_entities_replies.emplace_back(
-            cells[j]->owner(), cells[j]->key(), *get_entity(cells[j]));
+            owner(cells[j]), cells[j]->key(), *get_entity(cells[j]));
         }
 #ifdef _DEBUG_TREE_
         else {
@@ -1487,7 +2014,7 @@ private:
         hcell_t(recv_entities[i].key, shared_entities_.size() - 1));
       auto it = htable_.find(recv_entities[i].key);
       it->second.set_shared();
-      it->second.set_owner(recv_entities[i].owner);
+      set_owner_(&it->second, recv_entities[i].owner);
       // Change parent
       int child = recv_entities[i].key.last_value();
       parent->second.add_child(child);
@@ -1521,7 +2048,7 @@ private:
       auto it = htable_.find(recv_nodes[i].key);
       it->second.set_shared();
       it->second.set_node_idx(shared_nodes_.size() - 1);
-      it->second.set_owner(recv_nodes[i].owner);
+      set_owner_(&it->second, recv_nodes[i].owner);
       it->second.set_nchildren_to_receive(recv_nodes[i].nchildren);
       // Change parent
       int child = recv_nodes[i].key.last_value();
@@ -1756,26 +2283,17 @@ private:
     key_boundary_(nkey, min_key, max_key);
     if(min_key >= lobound_ && max_key <= hibound_) {
       if(current->is_unset()) {
-        std::vector<hcell_t *> daughters;
-        daughters.reserve(nchildren_);
-        for(int i = 0; i < nchildren_; ++i) {
-          if(current->get_child(i)) {
-            key_t ckey = nkey;
-            ckey.push(i);
-            auto it = htable_.find(ckey);
-#ifdef _DEBUG_TREE_
-            assert(it != htable_.end());
-#endif
-            daughters.push_back(&(htable_.find(ckey)->second));
-          } // if
-        } // for
-        for(int i = 0; i < daughters.size(); ++i) {
+        hcell_t * daughters[nchildren_];
+        int children = 0;
+        daughters_(current, daughters, children);
+        for(int i = 0; i < children; ++i) {
           cofm_update_(daughters[i], f_cc);
         } // for
         current->set_shared();
         current->set_node_idx(shared_nodes_.size());
         shared_nodes_.push_back(nkey);
-        cofm_children_(&shared_nodes_[current->node_idx()], daughters, f_cc);
+        cofm_children_(
+          &shared_nodes_[current->node_idx()], daughters, children, f_cc);
       } // if
     }
   }
@@ -1812,11 +2330,11 @@ private:
           if(cur->is_node()) {
             cofm_t * cofm = get_node(cur);
             // TODO: check if initializing nchildren with 0 is OK here
-            nodes.emplace_back(cur->owner(), cur->key(), *cofm, 0); 
+            nodes.emplace_back(owner(cur), cur->key(), *cofm, 0); 
           }
           else {
             entity_t * ent = get_entity(cur);
-            entities.emplace_back(cur->owner(), cur->key(), *ent);
+            entities.emplace_back(owner(cur), cur->key(), *ent);
           } // if
         } // else
       } // for
@@ -1839,7 +2357,7 @@ private:
     htable_.emplace(key, hcell_t(key, entity_idx));
     hcell_t * cur = &(htable_.find(key)->second);
     cur->set_shared();
-    cur->set_owner(owner);
+    set_owner_(cur, owner);
     int lastbit = key.pop_value();
     add_parent_(key, lastbit, owner);
   }
@@ -1857,7 +2375,7 @@ private:
     hcell_t * cur = &(htable_.find(key)->second);
     cur->set_shared();
     cur->set_node_idx(node_idx);
-    cur->set_owner(owner);
+    set_owner_(cur, owner);
     int lastbit = key.pop_value();
     add_parent_(key, lastbit, owner);
   }
@@ -1875,7 +2393,7 @@ private:
       parent = htable_.find(key);
       parent->second.set_shared();
       parent->second.add_child(child);
-      parent->second.set_owner(owner);
+      set_owner_(&parent->second, owner);
       child = key.pop_value();
     } // while
 #ifdef _DEBUG_TREE_
@@ -1900,20 +2418,62 @@ private:
 #endif
     n->set_node_idx(cofm_.size());
     cofm_.emplace_back(key);
-    std::vector<hcell_t *> daughters;
-    daughters.reserve(nchildren_);
-    for(int j = 0; j < nchildren_; ++j) {
-      if(n->get_child(j)) {
-        key_t ckey = key;
-        ckey.push(j);
-        auto it = htable_.find(ckey);
-#ifdef _DEBUG_TREE_
-        assert(it != htable_.end());
-#endif
-        daughters.push_back(&(htable_.find(ckey)->second));
-      } // if
-    } // for
-    cofm_children_(&cofm_[n->node_idx()], daughters, f_c);
+    hcell_t * daughters[nchildren_];
+    int children = 0;
+    daughters_(n, daughters, children);
+    cofm_children_(&cofm_[n->node_idx()], daughters, children, f_c);
+  }
+
+  /**
+   * @brief Find the cell covering the region of a key recorded in a previous
+   * FMM traversal: the key itself or, if the region is now inside a bigger
+   * entity cell, this entity.
+   * Return nullptr if no particle lies in the region anymore.
+   */
+  hcell_t * fmm_cache_resolve_(const key_t & key) {
+    auto it = htable_.find(key);
+    if(it != htable_.end())
+      return &(it->second);
+    key_t pkey = key;
+    while(pkey != key_t::root()) {
+      pkey.pop();
+      if((it = htable_.find(pkey)) != htable_.end())
+        break;
+    } // while
+    if(it == htable_.end() || !it->second.is_entity())
+      return nullptr;
+    key_t ekey = get_entity(&(it->second))->key();
+    ekey.truncate(key.depth());
+    if(ekey != key)
+      return nullptr;
+    return &(it->second);
+  }
+
+  /**
+   * @brief Cells covering the children of a recorded split cell that were
+   * absent (not in the mask) at record time but hold particles now.
+   */
+  void fmm_cache_new_children_(const key_t & key,
+    hcell_t * hc,
+    const int & mask,
+    scratch_vector<hcell_t *> & new_children) {
+    new_children.clear();
+    if(hc->is_node()) {
+      for(int j = 0; j < nchildren_; ++j) {
+        if(hc->get_child(j) && !(mask & (1 << j))) {
+          key_t ckey = key;
+          ckey.push(j);
+          new_children.push_back(&(htable_.find(ckey)->second));
+        } // if
+      } // for
+    }
+    else {
+      // Single entity covering the cell: check in which child it lies
+      key_t ekey = get_entity(hc)->key();
+      ekey.truncate(key.depth() + 1);
+      if(!(mask & (1 << ekey.last_value())))
+        new_children.push_back(hc);
+    } // if
   }
 
   /**
@@ -1943,14 +2503,18 @@ private:
 
   /**
    * @brief Compute the CofM data based on the daughters of the node.
+   * The lists of daughters are in the scratch arena.
    */
   template<typename CCOFM>
   void cofm_children_(cofm_t * cofm,
-    const std::vector<hcell_t *> & daughters,
+    hcell_t * const * daughters,
+    const int & children,
     CCOFM && f_ce) {
-    std::vector<entity_t *> v_entities;
-    std::vector<cofm_t *> v_nodes;
-    for(int i = 0; i < daughters.size(); ++i) {
+    scratch_vector<entity_t *> v_entities(scratch_allocator_<entity_t *>());
+    scratch_vector<cofm_t *> v_nodes(scratch_allocator_<cofm_t *>());
+    v_entities.reserve(children);
+    v_nodes.reserve(children);
+    for(int i = 0; i < children; ++i) {
       if(daughters[i]->is_entity()) {
         v_entities.push_back(get_entity(daughters[i]));
       }
@@ -2039,6 +2603,7 @@ private:
    */
   void init_comms_(const int & size) {
     std::fill(comms_done_.begin(), comms_done_.end(), false);
+    // The first arrays are kept from a traversal to the next
     mpi_requests_.resize(1);
     mpi_requests_[0].reserve(requests_keys_max_);
     mpi_replies_.resize(1);
@@ -2065,7 +2630,8 @@ private:
 #endif
       }
     }
-    mpi_requests_.clear();
+    mpi_requests_.resize(1);
+    mpi_requests_[0].clear();
     for(int i = 0; i < mpi_replies_.size(); ++i) {
       for(int j = 0; j < mpi_replies_[i].size(); ++j) {
         MPI_Test(&mpi_replies_[i][j], &flag, &status);
@@ -2074,7 +2640,8 @@ private:
 #endif
       }
     }
-    mpi_replies_.clear();
+    mpi_replies_.resize(1);
+    mpi_replies_[0].clear();
     requests_keys_.clear();
     nodes_replies_.clear();
     entities_replies_.clear();
@@ -2091,13 +2658,16 @@ private:
   };
 
   // Tree topology
-  size_t max_depth_;
+  size_t max_depth_ = 0;
   // KEEP this to switch with hashtable
   // to see the best implementation
   using umap_t = std::unordered_map<key_t, hcell_t, branch_id_hasher__<key_t>>;
   // using umap_t = hashtable<key_t, hcell_t>;
   typename umap_t::iterator root_;
   umap_t htable_;
+  // Owners of the remote cells, the other cells belong to rank_
+  std::unordered_map<key_t, int, branch_id_hasher__<key_t>> remote_owners_;
+  int rank_;
   range_t range_;
   std::vector<cofm_t> cofm_;
   std::vector<entity_t> entities_;
@@ -2117,8 +2687,26 @@ private:
   const int requests_keys_max_ = 100;
   double comms_timer_, lost_timer_;
   // Traversal
-  const int sub_entities_ = 128;
-  const int fmm_sub_entities_ = 0;
+  int sub_entities_ = 128;
+  int fmm_sub_entities_ = 0;
+  double search_padding_ = 1.;
+  point_t period_ = 0.;
+  bool periodic_ = false;
+  bool cell_list_enabled_ = false;
+  cell_list_t cell_list_;
+  // Scratch data of the traversals and of the construction
+  arena scratch_arena_;
+  std::vector<entity_t *> scratch_entities_;
+  std::vector<entity_t *> scratch_half_;
+  std::vector<entity_t *> scratch_sources_;
+  std::vector<std::vector<key_t>> request_keys_;
+  std::vector<std::vector<key_t>> request_keys_subtree_;
+  // FMM interaction list caching
+  double fmm_cutoff_ = 0.;
+  bool fmm_cache_ = false;
+  double fmm_cache_margin_ = 0.;
+  std::vector<fmm_cache_entry_t> fmm_cache_list_;
+  std::vector<key_t> fmm_cache_keys_;
 };
 
 } // namespace topology
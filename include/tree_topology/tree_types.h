@@ -29,6 +29,7 @@
 #include <bitset>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 #include <math.h>
@@ -142,7 +143,10 @@ protected:
 
 /**
  * @brief Class hcell, a cell in the hashtable
- * that represents the tree topology
+ * that represents the tree topology.
+ * The cell is kept small: the node or entity index is one tagged index, the
+ * flags are packed in one word and the cell does not know the rank. The
+ * owner of the remote cells is kept by the tree.
  **/
 template<size_t D, class KEY, class NODE, class ENTITY>
 class hcell
@@ -155,34 +159,25 @@ class hcell
     CHILD_DISPL = 0,
     LOCALITY_DISPL = 1 << dimension,
     REQUESTED_DISPL = (1 << dimension) + 2,
-    NCHILD_RECV_DISPL = (1 << dimension) + 3
+    NCHILD_RECV_DISPL = (1 << dimension) + 3,
+    REMOTE_DISPL = (1 << dimension) + 7
   };
   enum type_mask : int {
     CHILD_MASK = 0b11111111,
     LOCALITY_MASK = 0b11 << LOCALITY_DISPL,
     REQUESTED_MASK = 0b1 << REQUESTED_DISPL,
-    NCHILD_RECV_MASK = 0b1111 << NCHILD_RECV_DISPL
+    NCHILD_RECV_MASK = 0b1111 << NCHILD_RECV_DISPL,
+    REMOTE_MASK = 0b1 << REMOTE_DISPL
   };
   enum type_locality : int { LOCAL = 0, NONLOCAL = 1, SHARED = 2 };
+  // Tagged index: the entities from 0, the nodes from -2 downwards
+  static constexpr int32_t UNSET = -1;
 
 public:
-  hcell(const key_t & key) {
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
-    owner_ = rank_;
-    key_ = key;
-    node_idx_ = -1;
-    entity_idx_ = -1;
-    type_ = 0;
-  }
+  hcell(const key_t & key) : key_(key) {}
 
-  hcell(const key_t & key, const int entity_idx) {
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
-    owner_ = rank_;
-    key_ = key;
-    node_idx_ = -1;
-    entity_idx_ = entity_idx;
-    type_ = 0;
-  }
+  hcell(const key_t & key, const int entity_idx)
+    : key_(key), index_(entity_idx) {}
 
   bool get_child(const int & c) const {
     return type_ & (1 << c);
@@ -197,12 +192,12 @@ public:
     return nchild;
   }
   void set_node_idx(const int node_idx) {
-    node_idx_ = node_idx;
-    assert(entity_idx_ == -1);
+    assert(!is_entity_());
+    index_ = node_idx == -1 ? UNSET : -2 - node_idx;
   }
   void set_entity_idx(const int entity_idx) {
-    entity_idx_ = entity_idx;
-    assert(node_idx_ == -1);
+    assert(!is_node_());
+    index_ = entity_idx;
   }
   void set_shared() {
     type_ &= ~LOCALITY_MASK;
@@ -226,12 +221,17 @@ public:
     type_ |= (n << NCHILD_RECV_DISPL);
   }
 
-  void set_owner(const int & owner) {
-    owner_ = owner;
+  /*
+   * The cell belongs to another rank, see tree_topology::owner
+   */
+  void set_remote(const bool & remote) {
+    type_ &= ~REMOTE_MASK;
+    if(remote)
+      type_ |= REMOTE_MASK;
   }
 
   bool iam_owner() const {
-    return owner_ == rank_;
+    return !(type_ & REMOTE_MASK);
   }
 
   bool is_shared() const {
@@ -250,10 +250,10 @@ public:
   }
 
   int node_idx() const {
-    return node_idx_;
+    return is_node_() ? -2 - index_ : -1;
   }
   int entity_idx() const {
-    return entity_idx_;
+    return is_entity_() ? index_ : -1;
   }
   unsigned int type() const {
     return type_;
@@ -261,29 +261,30 @@ public:
   key_t key() const {
     return key_;
   }
-  int owner() const {
-    return owner_;
-  }
 
   bool is_node() const {
-    assert(node_idx_ != -1 || entity_idx_ != -1);
-    return node_idx_ != -1;
+    assert(!is_unset());
+    return is_node_();
   }
   bool is_entity() const {
     return !is_node();
   }
 
   bool is_unset() const {
-    return node_idx_ == -1 && entity_idx_ == -1;
+    return index_ == UNSET;
   }
 
 private:
+  bool is_node_() const {
+    return index_ < UNSET;
+  }
+  bool is_entity_() const {
+    return index_ > UNSET;
+  }
+
   KEY key_;
-  int node_idx_ = -1;
-  int entity_idx_ = -1;
-  int owner_;
-  unsigned int type_ = 0;
-  int rank_;
+  int32_t index_ = UNSET;
+  uint32_t type_ = 0;
 };
 
 /*----------------------------------------------------------------------------*
@@ -14,7 +14,9 @@
 #define _mpisph_body_system_h_
 
 #include "fmm.h"
+#include "pm.h"
 #include "io.h"
+#include "diagnostic.h"
 #include "params.h"
 #include "utils.h"
 
@@ -56,6 +58,55 @@ public:
     if(param::sph_variable_h) {
       log_one(warn) << "Variable smoothing length ENABLE" << std::endl;
     }
+
+    // The particles of this driver must carry the fields of the run (the
+    // total energy is only integrated by the drivers keeping it). The white
+    // dwarf and tabulated EOS read the electron fraction and temperature,
+    // the polytropic ones the adiabatic invariant K set by eos::init (the
+    // ideal fluid EOS only reads it in compute_internal_energy).
+    const bool eos_composition = param::eos_type == param::eos_wd ||
+                                 param::eos_type == param::eos_tab;
+    const bool eos_adiabatic = param::eos_type == param::eos_polytropic ||
+                               param::eos_type == param::eos_ppt;
+    if((param::enable_fmm && !body_fields::gravity) ||
+       (param::gravity_subcycling > 1 && !body_fields::gravity_subcycling) ||
+       (eos_composition && !body_fields::composition) ||
+       (eos_adiabatic && !body_fields::adiabatic) ||
+       (physics::smoothinglength_solved() && !body_fields::h_solve)) {
+      log_one(error) << "The particle fields of this driver do not support "
+                     << "the parameters (see include/physics/body.h)"
+                     << std::endl;
+      MPI_Finalize();
+      exit(2);
+    }
+
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if(param::fmm_cache_interactions && size > 1) {
+      log_one(warn) << "FMM interaction caching is only used on one rank"
+                    << std::endl;
+    }
+    tree_.set_fmm_cache(param::fmm_cache_interactions, param::fmm_cache_margin);
+    if(boost::iequals(param::sph_neighbor_search, "cell_list") && size > 1) {
+      log_one(warn) << "The cell list neighbor search is only used on one "
+                    << "rank" << std::endl;
+    }
+
+    if(param::enable_treepm)
+      pm_.set_mesh(param::treepm_mesh_size, param::treepm_split);
+
+    tree_.set_sub_entities(param::sph_group_size);
+    tree_.set_fmm_sub_entities(param::fmm_p2p_group_size);
+    if(param::tree_autotune) {
+      // Candidates around the SPH group size and for the FMM p2p threshold
+      for(int f : {1, 2, 4, 8})
+        tune_sph_sizes_.push_back(std::max(1, param::sph_group_size * f / 4));
+      // Subcycled gravity steps are not timed
+      if(param::enable_fmm && param::gravity_subcycling <= 1)
+        tune_fmm_sizes_ = {0, 8, 16, 32, 64};
+      tune_sph_times_.resize(tune_sph_sizes_.size(), 0.);
+      tune_fmm_times_.resize(tune_fmm_sizes_.size(), 0.);
+    }
   };
 
   /**
@@ -158,16 +209,14 @@ public:
     // Clean the whole tree structure
     tree_.clean();
 
-    if(param::periodic_boundary_x || param::periodic_boundary_y ||
-       param::periodic_boundary_z) {
-      boundary::pboundary_clean(tree_.entities());
-      // Choose the smoothing length to be the biggest from everyone
-      double smoothinglength = getSmoothinglength();
-      boundary::pboundary_generate(tree_.entities(), 2.5 * smoothinglength);
-      localnbodies_ = tree_.entities().size();
-      MPI_Allreduce(&localnbodies_, &totalnbodies_, 1, MPI_INT64_T, MPI_SUM,
-        MPI_COMM_WORLD);
-    }
+    if(param::tree_autotune)
+      autotune_next_();
+
+    // Periodic boundaries: the neighbor search wraps around the box
+    boundary::pboundary_init();
+    tree_.set_period(boundary::period);
+    if(boundary::periodic)
+      boundary::pboundary_wrap(tree_.entities());
 
     log_one(trace) << "#particles: " << totalnbodies_ << std::endl;
     // Then compute the range of the system
@@ -224,6 +273,7 @@ public:
 
     tree_.build_tree(physics::compute_cofm);
     log_one(trace) << "#particles: " << totalnbodies_ << std::endl;
+    tree_.set_cell_list(cell_list_selected_());
 
     localnbodies_ = tree_.entities().size();
     log_one(trace) << tree_ << std::endl;
@@ -279,12 +329,47 @@ public:
    * @brief      Compute the gravition interction between all the particles
    * @details    The function is based on Fast Multipole Method. The functions
    *             are defined in the file tree_fmm.h
+   *             With gravity subcycling, the FMM is only solved every
+   *             gravity_subcycling iterations, or earlier if a particle moved
+   *             too much, and the field is extrapolated in between.
+   *
+   * @param      time  Time of the positions of the particles
    */
-  void gravitation_fmm() {
+  void gravitation_fmm(const double & time) {
     assert (gdimension == 3);
     if constexpr (gdimension == 3) { 
       using namespace fmm;
-      tree_.traversal_fmm(macangle_, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+      if(!gravity_solve_needed_()) {
+        ++gravity_substep_;
+        apply_all(gravity_extrapolate, time);
+        return;
+      }
+      gravity_substep_ = 0;
+      double start = omp_get_wtime();
+      // TreePM: the tree walk only computes the short-range part
+      if(param::enable_treepm) {
+        pm_.set_range(range_);
+        fmm::r_split = pm_.r_split();
+        tree_.set_fmm_cutoff(param::treepm_cutoff * fmm::r_split);
+      }
+      // Walk the whole tree again from time to time
+      if(param::fmm_cache_refresh > 0 &&
+         fmm_iteration_++ % param::fmm_cache_refresh == 0)
+        tree_.clear_fmm_cache();
+      if(param::fmm_mutual_interactions)
+        tree_.traversal_fmm(macangle_, taylor_c2c, taylor_p2c, fmm_p2p,
+          fmm_c2p, taylor_c2c_mutual, taylor_p2c_mutual, fmm_p2p_mutual);
+      else
+        tree_.traversal_fmm(
+          macangle_, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+      if(param::enable_treepm)
+        pm_.solve(tree_.entities());
+      if(tune_phase_ == TUNE_FMM)
+        tune_fmm_times_[tune_step_] += omp_get_wtime() - start;
+      if(param::gravity_subcycling > 1) {
+        gravity_solved(time);
+        apply_all(gravity_save);
+      }
     }
   }
 
@@ -304,7 +389,87 @@ public:
    */
   template<typename EF, typename... ARGS>
   void apply_in_smoothinglength(EF && ef, ARGS &&... args) {
+    double start = omp_get_wtime();
     tree_.traversal_sph(ef, std::forward<ARGS>(args)...);
+    if(tune_phase_ == TUNE_SPH)
+      tune_sph_times_[tune_step_] += omp_get_wtime() - start;
+  }
+
+  /**
+   * @brief      Same as apply_in_smoothinglength with the neighbors searched
+   *             in the smoothing length times the padding: EF receives a
+   *             superset of the neighbors, which it can reduce (see
+   *             physics::compute_density_smoothinglength)
+   *
+   * @param[in]  padding  The factor on the search radius
+   * @param[in]  ef       The function to apply in the smoothing length
+   * @param[in]  args     Arguments of the function
+   */
+  template<typename EF, typename... ARGS>
+  void apply_in_smoothinglength_padded(const double & padding,
+    EF && ef,
+    ARGS &&... args) {
+    tree_.set_search_padding(padding);
+    apply_in_smoothinglength(ef, std::forward<ARGS>(args)...);
+    tree_.set_search_padding(1.);
+  }
+
+  /**
+   * @brief      Apply the function EF with ARGS in the smoothing length of
+   *             the local particles for which the predicate AF is true (the
+   *             active particles). The groups of particles without active
+   *             particle are skipped and the neighbors of the inactive
+   *             particles are not gathered; the inactive particles are
+   *             still neighbors of the active ones.
+   *
+   * @param[in]  active  The predicate on a particle
+   * @param[in]  ef      The function to apply in the smoothing length
+   * @param[in]  args    Arguments of the function
+   */
+  template<typename AF, typename EF, typename... ARGS>
+  void apply_in_smoothinglength_if(AF && active, EF && ef, ARGS &&... args) {
+    double start = omp_get_wtime();
+    tree_.traversal_sph_if(active, ef, std::forward<ARGS>(args)...);
+    if(tune_phase_ == TUNE_SPH)
+      tune_sph_times_[tune_step_] += omp_get_wtime() - start;
+  }
+
+  /**
+   * @brief      Same as apply_in_smoothinglength_if for the local particles
+   *             of a precomputed index list (see active_indices), valid
+   *             until the next update_iteration
+   */
+  template<typename EF, typename... ARGS>
+  void apply_in_smoothinglength_indices(const std::vector<size_t> & indices,
+    EF && ef,
+    ARGS &&... args) {
+    std::vector<bool> & mask = active_mask_;
+    mask.assign(tree_.entities().size(), false);
+    for(auto i : indices)
+      mask[i] = true;
+    const body * const first = tree_.entities().data();
+    apply_in_smoothinglength_if(
+      [&](const body & b) { return mask[&b - first]; }, ef,
+      std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief      Half-pair version of apply_in_smoothinglength: the sums are
+   *             started on all the local particles by RF, then the pair
+   *             function EF evaluates each pair of local particles once and
+   *             updates both (see tree_topology::traversal_sph_half_pairs).
+   *             The pairs with remote particles stay one-sided.
+   *
+   * @param[in]  rf    The function starting the sums on each particle
+   * @param[in]  ef    The pair function to apply in the smoothing length
+   */
+  template<typename RF, typename EF>
+  void apply_in_smoothinglength_pairs(RF && rf, EF && ef) {
+    double start = omp_get_wtime();
+    apply_all(rf);
+    tree_.traversal_sph_half_pairs(ef);
+    if(tune_phase_ == TUNE_SPH)
+      tune_sph_times_[tune_step_] += omp_get_wtime() - start;
   }
 
   /**
@@ -324,6 +489,66 @@ public:
     }
   }
 
+  /**
+   * @brief      Same as apply_all with the particles shared by the OpenMP
+   *             threads, for functions without side effects on other
+   *             particles or globals (see integration::leapfrog_kick_drift)
+   *
+   * @param[in]  ef    The function to apply
+   * @param[in]  args  Arguments of the function
+   */
+  template<typename EF, typename... ARGS>
+  void apply_all_parallel(EF && ef, ARGS &&... args) {
+    int64_t nelem = tree_.entities().size();
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < nelem; ++i) {
+      ef(tree_.entities()[i], std::forward<ARGS>(args)...);
+    }
+  }
+
+  /**
+   * @brief      Apply a function to the particles for which the predicate
+   *             AF is true
+   *
+   * @param[in]  active  The predicate on a particle
+   * @param[in]  ef      The function to apply
+   * @param[in]  args    Arguments of the function
+   */
+  template<typename AF, typename EF, typename... ARGS>
+  void apply_all_if(AF && active, EF && ef, ARGS &&... args) {
+    int64_t nelem = tree_.entities().size();
+    for(int64_t i = 0; i < nelem; ++i) {
+      if(active(tree_.entities()[i]))
+        ef(tree_.entities()[i], std::forward<ARGS>(args)...);
+    }
+  }
+
+  /**
+   * @brief      Apply a function to the particles of a precomputed index
+   *             list (see active_indices)
+   */
+  template<typename EF, typename... ARGS>
+  void apply_all_indices(const std::vector<size_t> & indices,
+    EF && ef,
+    ARGS &&... args) {
+    for(auto i : indices)
+      ef(tree_.entities()[i], std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief      Index list of the local particles for which the predicate
+   *             AF is true, valid until the next update_iteration
+   */
+  template<typename AF>
+  std::vector<size_t> active_indices(AF && active) {
+    std::vector<size_t> indices;
+    for(size_t i = 0; i < tree_.entities().size(); ++i) {
+      if(active(tree_.entities()[i]))
+        indices.push_back(i);
+    }
+    return indices;
+  }
+
   /**
    * @brief      Apply a function on the vector of local bodies
    *
@@ -367,16 +592,129 @@ public:
   }
 
 private:
+  /**
+   * @brief      Gravity subcycling: the FMM has to be solved if it was never
+   *             solved, after gravity_subcycling iterations or if a particle
+   *             moved by more than gravity_subcycling_displacement times its
+   *             smoothing length since the last solve.
+   */
+  bool gravity_solve_needed_() {
+    if(param::gravity_subcycling <= 1 || gravity_substep_ < 0 ||
+       gravity_substep_ + 1 >= param::gravity_subcycling)
+      return true;
+    if(param::gravity_subcycling_displacement <= 0.)
+      return false;
+    double max_displacement = 0.;
+    for(auto & b : tree_.entities()) {
+      max_displacement = std::max(max_displacement,
+        distance(b.coordinates(), b.getGSolveCoordinates()) / b.radius());
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &max_displacement, 1, MPI_DOUBLE, MPI_MAX,
+      MPI_COMM_WORLD);
+    return max_displacement > param::gravity_subcycling_displacement;
+  }
+
+  /**
+   * @brief      Whether the SPH traversals use the cell list: if selected by
+   *             sph_neighbor_search and as long as the dispersion of the
+   *             smoothing lengths h_max / h_min stays below
+   *             cell_list_max_h_ratio, the tree otherwise.
+   */
+  bool cell_list_selected_() {
+    if(!boost::iequals(param::sph_neighbor_search, "cell_list"))
+      return false;
+    diagnostic::compute_smoothinglength_stats(tree_.entities(), totalnbodies_);
+    const bool uniform =
+      diagnostic::h_max <= param::cell_list_max_h_ratio * diagnostic::h_min;
+    if(uniform != tree_.cell_list_enabled()) {
+      log_one(info) << "Neighbor search: " << (uniform ? "cell list" : "tree")
+                    << " (h_max / h_min = "
+                    << diagnostic::h_max / diagnostic::h_min << ")"
+                    << std::endl;
+    }
+    return uniform;
+  }
+
+  /**
+   * @brief      Leaf sizes auto-tuning: called once per iteration. The SPH
+   *             group size candidates are timed first, one per iteration,
+   *             then the FMM p2p ones with the fastest SPH size: a change
+   *             of one does not bias the timings of the other. The first
+   *             iteration is not timed (warm-up).
+   */
+  void autotune_next_() {
+    if(tune_phase_ == TUNE_WARMUP) {
+      if(tune_step_++ == 0)
+        return;
+      tune_phase_ = TUNE_SPH;
+      tune_step_ = 0;
+    }
+    else if(tune_phase_ != TUNE_DONE)
+      ++tune_step_;
+    if(tune_phase_ == TUNE_SPH &&
+       !autotune_select_(tune_sph_sizes_, tune_sph_times_, "SPH group size",
+         [&](int n) { tree_.set_sub_entities(n); })) {
+      tune_phase_ = TUNE_FMM;
+      tune_step_ = 0;
+    }
+    if(tune_phase_ == TUNE_FMM &&
+       !autotune_select_(tune_fmm_sizes_, tune_fmm_times_,
+         "FMM p2p group size",
+         [&](int n) { tree_.set_fmm_sub_entities(n); }))
+      tune_phase_ = TUNE_DONE;
+  }
+
+  /**
+   * @brief      Set the candidate tune_step_ to be timed in this iteration
+   *             and return true, or lock in the fastest one and return
+   *             false once all the candidates have been timed
+   */
+  template<typename SET>
+  bool autotune_select_(const std::vector<int> & sizes,
+    std::vector<double> & times,
+    const char * name,
+    SET && set) {
+    if(tune_step_ < sizes.size()) {
+      set(sizes[tune_step_]);
+      return true;
+    }
+    if(sizes.empty())
+      return false;
+    // All candidates timed: use the slowest rank to decide
+    MPI_Allreduce(MPI_IN_PLACE, &times[0], times.size(), MPI_DOUBLE, MPI_MAX,
+      MPI_COMM_WORLD);
+    int best = std::min_element(times.begin(), times.end()) - times.begin();
+    set(sizes[best]);
+    log_one(info) << "Auto-tuned " << name << ": " << sizes[best] << " ("
+                  << times[best] << "s)" << std::endl;
+    return false;
+  }
+
   int64_t totalnbodies_; // Total number of local particles
   int64_t localnbodies_; // Local number of particles
   double macangle_; // Macangle for FMM
   double maxmasscell_; // Mass criterion for FMM
   range_t range_;
   tree_topology_t tree_; // The particle tree data structure
+  pm::pm_solver pm_; // Long-range gravitation of TreePM
+  std::vector<bool> active_mask_; // Particles of an index list
   double epsilon_ = 0.;
 
   const int refresh_tree = 0;
   int current_refresh = refresh_tree;
+
+  int64_t fmm_iteration_ = 0; // Number of FMM traversals
+  int gravity_substep_ = -1; // Iterations since the last FMM solve
+
+  // Leaf sizes auto-tuning: the phase gives the candidates timed in the
+  // iteration, tune_step_ the index of the candidate
+  enum tune_phase_t : int { TUNE_WARMUP, TUNE_SPH, TUNE_FMM, TUNE_DONE };
+  tune_phase_t tune_phase_ = TUNE_WARMUP;
+  size_t tune_step_ = 0;
+  std::vector<int> tune_sph_sizes_;
+  std::vector<int> tune_fmm_sizes_;
+  std::vector<double> tune_sph_times_;
+  std::vector<double> tune_fmm_times_;
 };
 
 #endif
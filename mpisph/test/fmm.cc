@@ -0,0 +1,411 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <iostream>
+#include <log.h>
+#include <mpi.h>
+
+#include "default_physics.h"
+#include "fmm.h"
+#include "pm.h"
+#include "tree.h"
+
+// Number of particles
+#define N 2000
+#define MACANGLE 0.25
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int argc, char * argv[]) {}
+} // namespace execution
+} // namespace flecsi
+
+// MPI is shared by all the tests of this file
+class mpi_environment : public ::testing::Environment
+{
+public:
+  void SetUp() override {
+    MPI_Init(nullptr, nullptr);
+  }
+  void TearDown() override {
+    MPI_Finalize();
+  }
+};
+::testing::Environment * const mpi_env =
+  ::testing::AddGlobalTestEnvironment(new mpi_environment);
+
+double
+uniform() {
+  return double(rand()) / RAND_MAX;
+}
+
+/**
+ * @brief Compute the range over all the ranks and sort the entities, reset
+ *        the gravitation
+ */
+void
+sort_entities(tree_topology_t & t) {
+  range_t range = {t.entities()[0].coordinates(), t.entities()[0].coordinates()};
+  for(auto & e : t.entities()) {
+    e.setGAcceleration(point_t{});
+    e.setGPotential(0.);
+    for(size_t d = 0; d < gdimension; ++d) {
+      range[0][d] = std::min(range[0][d], e.coordinates()[d] - e.radius());
+      range[1][d] = std::max(range[1][d], e.coordinates()[d] + e.radius());
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &range[0][0], gdimension, MPI_DOUBLE, MPI_MIN,
+    MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &range[1][0], gdimension, MPI_DOUBLE, MPI_MAX,
+    MPI_COMM_WORLD);
+  t.set_range(range);
+  t.clean();
+  t.compute_keys();
+  std::sort(
+    t.entities().begin(), t.entities().end(), [](auto & left, auto & right) {
+      if(left.key() < right.key()) {
+        return true;
+      }
+      if(left.key() == right.key()) {
+        return left.id() < right.id();
+      }
+      return false;
+    }); // sort
+}
+
+/**
+ * @brief Sort the entities and build the tree
+ */
+void
+rebuild_tree(tree_topology_t & t) {
+  sort_entities(t);
+  t.build_tree(physics::compute_cofm);
+}
+
+/**
+ * @brief N random particles in the unit cube, the same on all the ranks
+ */
+void
+random_particles(std::vector<body> & bodies) {
+  srand(42);
+  for(size_t i = 0; i < N; ++i) {
+    bodies.push_back(body{});
+    bodies.back().set_coordinates(point_t{uniform(), uniform(), uniform()});
+    bodies.back().set_mass(1. / N);
+    bodies.back().set_radius(0.01);
+    bodies.back().set_id(i);
+  }
+}
+
+/**
+ * @brief Build a tree of N random particles in the unit cube. Distributed,
+ *        each rank keeps a contiguous part of the particles in key order, as
+ *        after the distributed sort of the drivers.
+ */
+void
+build_random_tree(tree_topology_t & t, const bool distributed = false) {
+  random_particles(t.entities());
+  if(distributed) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    sort_entities(t);
+    auto & entities = t.entities();
+    entities.erase(entities.begin() + N * (rank + 1) / size, entities.end());
+    entities.erase(entities.begin(), entities.begin() + N * rank / size);
+  }
+  rebuild_tree(t);
+}
+
+/**
+ * @brief RMS relative error of the accelerations with respect to direct
+ *        summation
+ */
+double
+error_direct(tree_topology_t & t) {
+  double err = 0;
+  for(auto & p : t.entities()) {
+    point_t acc = {};
+    double pot = 0;
+    for(auto & q : t.entities()) {
+      if(p.id() != q.id())
+        acc += fmm::gravitation_p2p(
+          pot, p.coordinates(), q.coordinates(), q.mass());
+    }
+    double e = distance(acc, p.getGAcceleration()) / magnitude(acc);
+    err += e * e;
+  }
+  return sqrt(err / N);
+}
+
+/**
+ * @brief RMS relative error of the accelerations of the particles of all the
+ *        ranks, with respect to direct summation over all the particles
+ */
+double
+error_direct_distributed(tree_topology_t & t, const std::vector<body> & all) {
+  double err = 0;
+  for(auto & p : t.entities()) {
+    point_t acc = {};
+    double pot = 0;
+    for(auto & q : all) {
+      if(p.id() != q.id())
+        acc += fmm::gravitation_p2p(
+          pot, p.coordinates(), q.coordinates(), q.mass());
+    }
+    double e = distance(acc, p.getGAcceleration()) / magnitude(acc);
+    err += e * e;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  return sqrt(err / N);
+}
+
+TEST(fmm, mutual_interactions) {
+  using namespace fmm;
+
+  // One-sided interactions
+  tree_topology_t t1;
+  build_random_tree(t1);
+  size_t ninter1 = 0;
+  t1.traversal_fmm(
+    MACANGLE,
+    [&](node * n, const node * s) {
+      ++ninter1;
+      taylor_c2c(n, s);
+    },
+    [&](node * n, const body * s) {
+      ++ninter1;
+      taylor_p2c(n, s);
+    },
+    [&](std::vector<body *> & sinks, const node * ns,
+      const std::vector<body *> & ps) {
+      ninter1 += sinks.size() * (ps.size() + (ns != nullptr));
+      fmm_p2p(sinks, ns, ps);
+    },
+    fmm_c2p);
+
+  // Mutual interactions
+  tree_topology_t t2;
+  build_random_tree(t2);
+  size_t ninter2 = 0;
+  t2.traversal_fmm(
+    MACANGLE,
+    [&](node * n, const node * s) {
+      ++ninter2;
+      taylor_c2c(n, s);
+    },
+    [&](node * n, const body * s) {
+      ++ninter2;
+      taylor_p2c(n, s);
+    },
+    [&](std::vector<body *> & sinks, const node * ns,
+      const std::vector<body *> & ps) {
+      ninter2 += sinks.size() * (ps.size() + (ns != nullptr));
+      fmm_p2p(sinks, ns, ps);
+    },
+    fmm_c2p,
+    [&](node * n1, node * n2) {
+      ++ninter2;
+      taylor_c2c_mutual(n1, n2);
+    },
+    [&](node * n, body * e) {
+      ++ninter2;
+      taylor_p2c_mutual(n, e);
+    },
+    [&](body * p, body * q) {
+      ++ninter2;
+      fmm_p2p_mutual(p, q);
+    });
+
+  std::cout << "Interactions: one-sided " << ninter1 << " mutual " << ninter2
+            << std::endl;
+  ASSERT_TRUE(ninter2 < 0.6 * ninter1);
+
+  double err1 = error_direct(t1);
+  double err2 = error_direct(t2);
+  std::cout << "RMS error: one-sided " << err1 << " mutual " << err2
+            << std::endl;
+  ASSERT_TRUE(err1 < 5.e-2);
+  ASSERT_TRUE(err2 < 5.e-2);
+  ASSERT_TRUE(fabs(err1 - err2) < 1.e-6);
+
+  // Direct p2p computation for the small cells, with mutual interactions
+  tree_topology_t t3;
+  build_random_tree(t3);
+  t3.set_fmm_sub_entities(32);
+  t3.traversal_fmm(MACANGLE, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p,
+    taylor_c2c_mutual, taylor_p2c_mutual, fmm_p2p_mutual);
+  double err3 = error_direct(t3);
+  std::cout << "RMS error: p2p groups " << err3 << std::endl;
+  ASSERT_TRUE(err3 < err1);
+}
+
+TEST(fmm, interaction_cache) {
+  using namespace fmm;
+
+  // Record the interaction list
+  tree_topology_t t1;
+  build_random_tree(t1);
+  t1.set_fmm_cache(true, 0.1);
+  t1.traversal_fmm(MACANGLE, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+  size_t nrecorded = t1.fmm_cache_size();
+  ASSERT_TRUE(nrecorded > 0);
+  double err1 = error_direct(t1);
+
+  // Move the particles slightly and replay the list
+  for(auto & e : t1.entities()) {
+    e.set_coordinates(
+      e.coordinates() + 1.e-3 * point_t{uniform(), uniform(), uniform()});
+  }
+  rebuild_tree(t1);
+  t1.traversal_fmm(MACANGLE, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+  double err2 = error_direct(t1);
+
+  // Full walk on the same configuration
+  tree_topology_t t2;
+  t2.entities() = t1.entities();
+  rebuild_tree(t2);
+  t2.traversal_fmm(MACANGLE, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+  double err3 = error_direct(t2);
+
+  std::cout << "Cached interactions: " << nrecorded << " -> "
+            << t1.fmm_cache_size() << std::endl;
+  std::cout << "RMS error: recorded " << err1 << " replayed " << err2
+            << " full walk " << err3 << std::endl;
+  // The recorded list uses a tighter MAC: at least as accurate as a walk
+  ASSERT_TRUE(err1 < err3);
+  ASSERT_TRUE(err2 < err3);
+}
+
+/**
+ * @brief Field of particles moving on straight lines, solved by direct
+ *        summation at t = 0 and h and extrapolated to 2h: the error of the
+ *        first order extrapolation decreases as h^2, the one of the field
+ *        held constant as h
+ */
+TEST(fmm, gravity_extrapolation) {
+  using namespace fmm;
+
+  tree_topology_t t;
+  build_random_tree(t);
+  std::vector<point_t> x0, v;
+  for(auto & e : t.entities()) {
+    x0.push_back(e.coordinates());
+    v.push_back(point_t{uniform() - .5, uniform() - .5, uniform() - .5});
+  }
+  auto solve_direct = [&](const double & time) {
+    for(size_t i = 0; i < N; ++i)
+      t.entities()[i].set_coordinates(x0[i] + time * v[i]);
+    for(auto & p : t.entities()) {
+      point_t acc = {};
+      double pot = 0;
+      for(auto & q : t.entities()) {
+        if(p.id() != q.id())
+          acc += gravitation_p2p(
+            pot, p.coordinates(), q.coordinates(), q.mass());
+      }
+      p.setGAcceleration(acc);
+      p.setGPotential(pot);
+    }
+  };
+
+  const double h[2] = {1.e-4, 5.e-5};
+  double err_hold[2], err_first[2];
+  for(int k = 0; k < 2; ++k) {
+    gsolve_count = 0;
+    for(int s = 0; s < 2; ++s) {
+      solve_direct(s * h[k]);
+      gravity_solved(s * h[k]);
+      for(auto & e : t.entities())
+        gravity_save(e);
+    }
+    for(size_t i = 0; i < N; ++i)
+      t.entities()[i].set_coordinates(x0[i] + 2. * h[k] * v[i]);
+    for(auto & e : t.entities())
+      gravity_extrapolate(e, 2. * h[k]);
+    err_first[k] = error_direct(t);
+    for(auto & e : t.entities())
+      e.setGAcceleration(e.getGSolveAcceleration());
+    err_hold[k] = error_direct(t);
+  }
+  gsolve_count = 0;
+
+  std::cout << "RMS error: held " << err_hold[0] << " -> " << err_hold[1]
+            << ", extrapolated " << err_first[0] << " -> " << err_first[1]
+            << std::endl;
+  const double order = std::log2(err_first[0] / err_first[1]);
+  ASSERT_TRUE(order > 1.8 && order < 2.2);
+  ASSERT_TRUE(err_first[0] < .1 * err_hold[0]);
+}
+
+TEST(fmm, pm_fft) {
+  // Compare with the direct discrete Fourier transform
+  const size_t n = 16;
+  std::vector<pm::complex_t> data(n), ref(n);
+  for(size_t i = 0; i < n; ++i)
+    data[i] = pm::complex_t(uniform(), uniform());
+  for(size_t k = 0; k < n; ++k)
+    for(size_t i = 0; i < n; ++i)
+      ref[k] += data[i] * std::polar(1., -2. * M_PI * i * k / n);
+  std::vector<pm::complex_t> res = data;
+  pm::fft(&res[0], n, -1);
+  for(size_t k = 0; k < n; ++k)
+    ASSERT_TRUE(std::abs(res[k] - ref[k]) < 1.e-10);
+  // Inverse transform
+  pm::fft(&res[0], n, 1);
+  for(size_t k = 0; k < n; ++k)
+    ASSERT_TRUE(std::abs(res[k] / double(n) - data[k]) < 1.e-10);
+}
+
+TEST(fmm, treepm) {
+  using namespace fmm;
+
+  // The particles, the tree and the mesh are distributed among the ranks
+  tree_topology_t t;
+  build_random_tree(t, true);
+  std::vector<body> all;
+  random_particles(all);
+  pm::pm_solver pm;
+  pm.set_mesh(32, 1.25);
+
+  // The same solver on a second, larger mesh: the transform of the Green's
+  // function computed for the first one is rescaled
+  for(const double margin : {0., .25}) {
+    range_t range = t.range();
+    for(size_t d = 0; d < gdimension; ++d) {
+      range[0][d] -= margin;
+      range[1][d] += margin;
+    }
+    pm.set_range(range);
+    rebuild_tree(t);
+
+    // Short-range tree walk and long-range mesh
+    r_split = pm.r_split();
+    t.set_fmm_cutoff(4.5 * r_split);
+    t.traversal_fmm(MACANGLE, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+    pm.solve(t.entities());
+    r_split = 0.;
+    double err = error_direct_distributed(t, all);
+
+    std::cout << "RMS error: TreePM " << err << " (r_split " << pm.r_split()
+              << ")" << std::endl;
+    ASSERT_TRUE(err < 5.e-2);
+  }
+}
+
+TEST(fmm, treepm_range) {
+  std::vector<body> bodies;
+  random_particles(bodies);
+  pm::pm_solver pm;
+  pm.set_mesh(32, 1.25);
+
+  // Mesh on a smaller range than the particles, on every rank
+  range_t range = {point_t{0., 0., 0.}, point_t{.75, .75, .75}};
+  pm.set_range(range);
+  ASSERT_THROW(pm.solve(bodies), std::runtime_error);
+}
@@ -0,0 +1,833 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <log.h>
+#include <mpi.h>
+#include <new>
+#include <numeric>
+#include <omp.h>
+
+#include "default_physics.h"
+#include "integration.h"
+#include "tree.h"
+
+// Number of particles
+#define N 4000
+
+using namespace std;
+using namespace flecsi;
+using namespace topology;
+
+namespace flecsi {
+namespace execution {
+void
+driver(int argc, char * argv[]) {}
+} // namespace execution
+} // namespace flecsi
+
+// MPI is shared by all the tests of this file
+class mpi_environment : public ::testing::Environment
+{
+public:
+  void SetUp() override {
+    MPI_Init(nullptr, nullptr);
+  }
+  void TearDown() override {
+    MPI_Finalize();
+  }
+};
+::testing::Environment * const mpi_env =
+  ::testing::AddGlobalTestEnvironment(new mpi_environment);
+
+// Heap allocations of the program, see the scratch_arena test. All the
+// forms of the global allocation functions are replaced so that every
+// operator delete matches its operator new
+std::atomic<size_t> heap_allocations(0);
+
+void *
+counted_alloc(size_t size) {
+  ++heap_allocations;
+  if(void * p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *
+counted_alloc(size_t size, std::align_val_t align) {
+  ++heap_allocations;
+  const size_t a = static_cast<size_t>(align);
+  if(void * p = aligned_alloc(a, (size + a - 1) / a * a))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *
+operator new(size_t size) {
+  return counted_alloc(size);
+}
+
+void *
+operator new[](size_t size) {
+  return counted_alloc(size);
+}
+
+void *
+operator new(size_t size, std::align_val_t align) {
+  return counted_alloc(size, align);
+}
+
+void *
+operator new[](size_t size, std::align_val_t align) {
+  return counted_alloc(size, align);
+}
+
+void
+operator delete(void * p) noexcept {
+  free(p);
+}
+
+void
+operator delete[](void * p) noexcept {
+  free(p);
+}
+
+void
+operator delete(void * p, size_t) noexcept {
+  free(p);
+}
+
+void
+operator delete[](void * p, size_t) noexcept {
+  free(p);
+}
+
+void
+operator delete(void * p, std::align_val_t) noexcept {
+  free(p);
+}
+
+void
+operator delete[](void * p, std::align_val_t) noexcept {
+  free(p);
+}
+
+void
+operator delete(void * p, size_t, std::align_val_t) noexcept {
+  free(p);
+}
+
+void
+operator delete[](void * p, size_t, std::align_val_t) noexcept {
+  free(p);
+}
+
+double
+uniform() {
+  return double(rand()) / RAND_MAX;
+}
+
+/**
+ * @brief Build a tree of n random particles in the unit cube, shifted by
+ *        -shift, with smoothing length varying by dh and random hydro fields
+ */
+void
+build_random_tree(tree_topology_t & t,
+  const double & shift = 0.,
+  const double & dh = .2,
+  const size_t & n = N) {
+  srand(42);
+  // About 100 neighbors
+  const double h = std::pow(100. / n * 3. / (4. * M_PI), 1. / 3.);
+  for(size_t i = 0; i < n; ++i) {
+    t.entities().push_back(body{});
+    body & b = t.entities().back();
+    b.set_coordinates(
+      point_t{uniform() - shift, uniform() - shift, uniform() - shift});
+    b.setVelocity(point_t{uniform() - .5, uniform() - .5, uniform() - .5});
+    b.setVelocityhalf(point_t{uniform() - .5, uniform() - .5, uniform() - .5});
+    b.set_mass(1. / n);
+    b.set_radius(h * (1. + dh * (uniform() - .5)));
+    b.setDensity(1. + uniform());
+    b.setPressure(1. + uniform());
+    b.setSoundspeed(1. + uniform());
+    b.setGAcceleration(point_t{uniform(), uniform(), uniform()});
+    b.set_id(i);
+  }
+  range_t range = {
+    t.entities()[0].coordinates(), t.entities()[0].coordinates()};
+  for(auto & e : t.entities()) {
+    for(size_t d = 0; d < gdimension; ++d) {
+      range[0][d] = std::min(range[0][d], e.coordinates()[d] - e.radius());
+      range[1][d] = std::max(range[1][d], e.coordinates()[d] + e.radius());
+    }
+  }
+  t.set_range(range);
+  t.compute_keys();
+  std::sort(
+    t.entities().begin(), t.entities().end(), [](auto & left, auto & right) {
+      if(left.key() < right.key()) {
+        return true;
+      }
+      if(left.key() == right.key()) {
+        return left.id() < right.id();
+      }
+      return false;
+    }); // sort
+  t.build_tree(physics::compute_cofm);
+}
+
+/**
+ * @brief The half-pair passes give the same acceleration, dudt and dedt as
+ *        the passes evaluating both directions of each pair
+ */
+TEST(sph, half_pairs) {
+  using namespace param;
+  kernels::select();
+  physics::select();
+
+  tree_topology_t t1, t2;
+  build_random_tree(t1);
+  build_random_tree(t2);
+
+  double start = omp_get_wtime();
+  t1.traversal_sph(physics::compute_acceleration);
+  t1.traversal_sph(physics::compute_dudt);
+  t1.traversal_sph(physics::compute_dedt);
+  const double time_full = omp_get_wtime() - start;
+
+  start = omp_get_wtime();
+  for(auto & e : t2.entities()) {
+    physics::reset_acceleration(e);
+    physics::reset_dudt(e);
+    physics::reset_dedt(e);
+  }
+  t2.traversal_sph_half_pairs(physics::compute_acceleration_pairs);
+  t2.traversal_sph_half_pairs(physics::compute_dudt_pairs);
+  t2.traversal_sph_half_pairs(physics::compute_dedt_pairs);
+  const double time_half = omp_get_wtime() - start;
+
+  double err_acc = 0, err_dudt = 0, err_dedt = 0;
+  for(size_t i = 0; i < N; ++i) {
+    const body & f = t1.entities()[i];
+    const body & h = t2.entities()[i];
+    ASSERT_TRUE(f.id() == h.id());
+    err_acc = std::max(err_acc,
+      distance(h.getAcceleration(), f.getAcceleration()) /
+        magnitude(f.getAcceleration()));
+    err_dudt = std::max(
+      err_dudt, fabs(h.getDudt() - f.getDudt()) / fabs(f.getDudt()));
+    err_dedt = std::max(
+      err_dedt, fabs(h.getDedt() - f.getDedt()) / fabs(f.getDedt()));
+  }
+  std::cout << "Max relative difference: acc " << err_acc << " dudt "
+            << err_dudt << " dedt " << err_dedt << std::endl;
+  std::cout << "Time: full pairs " << time_full << "s half pairs "
+            << time_half << "s" << std::endl;
+  ASSERT_TRUE(err_acc < 1.e-10);
+  ASSERT_TRUE(err_dudt < 1.e-10);
+  ASSERT_TRUE(err_dedt < 1.e-10);
+}
+
+/**
+ * @brief With the batched EOS, the acceleration passes give the signal
+ *        speed with the new sound speeds of all the neighbors, as a separate
+ *        pass after the per particle EOS
+ */
+TEST(sph, batched_signalspeed) {
+  using namespace param;
+  kernels::select();
+  physics::select();
+  _eos_type = eos_ideal;
+  eos::select();
+  _evolve_internal_energy = false;
+  physics::iteration = initial_iteration + 1;
+
+  tree_topology_t t[3];
+  for(auto & tree : t) {
+    build_random_tree(tree);
+    for(auto & b : tree.entities())
+      b.setInternalenergy(1. + 1.e-3 * b.id());
+  }
+
+  // per particle EOS in the density pass, then signal speed
+  _eos_batched = false;
+  t[0].traversal_sph(physics::compute_density_pressure_soundspeed);
+  t[0].traversal_sph([](body & b, std::vector<body *> & nbs) {
+    physics::compute_signalspeed(b, nbs);
+  });
+
+  // batched EOS, signal speed of the full and half-pair passes
+  _eos_batched = true;
+  for(int i = 1; i < 3; ++i) {
+    t[i].traversal_sph(physics::compute_density_pressure_soundspeed);
+    physics::compute_eos_batched(t[i].entities());
+  }
+  t[1].traversal_sph(physics::compute_acceleration);
+  for(auto & b : t[2].entities())
+    physics::reset_acceleration(b);
+  t[2].traversal_sph_half_pairs(physics::compute_acceleration_pairs);
+
+  double err[2] = {0, 0};
+  for(size_t i = 0; i < N; ++i) {
+    const double vsig = t[0].entities()[i].getSignalspeed();
+    for(int j = 0; j < 2; ++j)
+      err[j] = std::max(err[j],
+        fabs(t[j + 1].entities()[i].getSignalspeed() - vsig) / vsig);
+  }
+  std::cout << "Max relative difference of the signal speed: full "
+            << err[0] << " half pairs " << err[1] << std::endl;
+  ASSERT_TRUE(err[0] < 1.e-14);
+  ASSERT_TRUE(err[1] < 1.e-14);
+  _eos_batched = false;
+  _evolve_internal_energy = true;
+  physics::iteration = initial_iteration;
+}
+
+/**
+ * @brief The filtered traversal only updates the active particles, with the
+ *        same result, and skips the groups without active particle
+ */
+TEST(sph, active_filter) {
+  kernels::select();
+  physics::select();
+
+  tree_topology_t t1, t2;
+  build_random_tree(t1);
+  build_random_tree(t2);
+  for(auto & e : t2.entities())
+    e.setAcceleration(point_t{});
+
+  // Active particles in one corner of the box
+  auto active = [](const body & b) {
+    return b.coordinates()[0] < .25 && b.coordinates()[1] < .5;
+  };
+  size_t nsinks = 0;
+  t1.traversal_sph(physics::compute_acceleration);
+  t2.traversal_sph_if(active, [&](body & b, std::vector<body *> & nbs) {
+    ++nsinks;
+    physics::compute_acceleration(b, nbs);
+  });
+
+  size_t nactive = 0;
+  for(size_t i = 0; i < N; ++i) {
+    const body & f = t1.entities()[i];
+    const body & a = t2.entities()[i];
+    if(active(a)) {
+      ++nactive;
+      ASSERT_TRUE(distance(a.getAcceleration(), f.getAcceleration()) <=
+                  1.e-14 * magnitude(f.getAcceleration()));
+    }
+    else
+      ASSERT_TRUE(magnitude(a.getAcceleration()) == 0.);
+  }
+  std::cout << "Active particles: " << nactive << "/" << N << std::endl;
+  ASSERT_TRUE(nsinks == nactive);
+}
+
+/**
+ * @brief The smoothing length solve converges on the padded neighbor list:
+ *        repeated solves, as over the steps, start from the previous solution
+ *        and h and rho end up satisfying the relation with the smoothing
+ *        lengths of the neighbors, away from the free boundaries of the box.
+ *        The neighbors keep their smoothing length during a solve: the cell
+ *        list, which visits the particles in another order, gives the same.
+ */
+TEST(sph, smoothinglength_solve) {
+  using namespace param;
+  kernels::select();
+  physics::select();
+  _sph_variable_h = true;
+  _sph_h_iterations = 20;
+  _sph_h_tolerance = 1.e-6;
+  using kernel_t = kernels::analytic<wendland_c4>;
+  _sph_kernel = wendland_c4;
+
+  tree_topology_t t;
+  build_random_tree(t);
+  t.set_search_padding(sph_h_search_padding);
+  const int nsolves = 5;
+  double iterations[nsolves];
+  for(int solve = 0; solve < nsolves; ++solve) {
+    physics::h_solves = physics::h_iterations = physics::h_iterations_max = 0;
+    t.traversal_sph([](body & b, auto & nbs) {
+      physics::passes::compute_density_smoothinglength<kernel_t>(b, nbs);
+    });
+    iterations[solve] = double(physics::h_iterations) / physics::h_solves;
+    std::cout << "Solve " << solve << ": average iterations "
+              << iterations[solve] << " max " << physics::h_iterations_max
+              << std::endl;
+
+    std::vector<double> h_tree(N);
+    for(auto & b : t.entities())
+      h_tree[b.id()] = b.next_radius();
+    t.set_cell_list(true);
+    t.traversal_sph([](body & b, auto & nbs) {
+      physics::passes::compute_density_smoothinglength<kernel_t>(b, nbs);
+    });
+    t.set_cell_list(false);
+    for(auto & b : t.entities())
+      ASSERT_TRUE(fabs(b.next_radius() - h_tree[b.id()]) <=
+                  1.e-12 * h_tree[b.id()]);
+
+    // new smoothing lengths in the tree
+    for(auto & b : t.entities())
+      physics::update_smoothinglength_solved(b);
+    t.clean();
+    t.build_tree(physics::compute_cofm);
+  }
+  ASSERT_TRUE(iterations[nsolves - 1] < .5 * iterations[0]);
+
+  // Density with the final smoothing lengths, unpadded search
+  t.set_search_padding(1.);
+  t.traversal_sph([](body & b, auto & nbs) {
+    physics::passes::compute_density<kernel_t>(b, nbs);
+  });
+  double err = 0;
+  size_t n_min = N, n_max = 0;
+  for(auto & b : t.entities()) {
+    bool interior = true;
+    for(size_t d = 0; d < gdimension; ++d)
+      interior = interior and b.coordinates()[d] > 2. * b.radius() and
+                 b.coordinates()[d] < 1. - 2. * b.radius();
+    if(not interior)
+      continue;
+    const double rho = b.mass() *
+      std::pow(sph_eta * kernels::kernel_width / b.radius(), gdimension);
+    err = std::max(err, fabs(b.getDensity() - rho) / rho);
+    n_min = std::min(n_min, b.getNeighbors());
+    n_max = std::max(n_max, b.getNeighbors());
+  }
+  std::cout << "Max relative error on rho(h): " << err << ", neighbors "
+            << n_min << "-" << n_max << std::endl;
+  ASSERT_TRUE(err < 1.e-2);
+  _sph_variable_h = false;
+  _sph_h_iterations = 0;
+}
+
+/**
+ * @brief Periodic unit box: the traversal finds the neighbors of the minimum
+ *        image convention across the faces and the density is the one of the
+ *        direct sum over the nearest images, without ghost copies. Constant
+ *        smoothing length, for which the tree search is exact.
+ */
+TEST(sph, periodic_search) {
+  using namespace param;
+  kernels::select();
+  physics::select();
+  _box_length = _box_width = _box_height = 1.;
+  _periodic_boundary_x = _periodic_boundary_y = _periodic_boundary_z = true;
+  boundary::pboundary_init();
+
+  tree_topology_t t;
+  build_random_tree(t, .5, 0.);
+  t.set_period(boundary::period);
+  std::vector<size_t> nbs_tree(N);
+  t.traversal_sph([&](body & b, std::vector<body *> & nbs) {
+    nbs_tree[b.id()] = nbs.size();
+    physics::compute_density(b, nbs);
+  });
+
+  std::vector<body *> nbs;
+  double err = 0;
+  size_t nwrapped = 0;
+  for(auto & b : t.entities()) {
+    nbs.clear();
+    for(auto & nb : t.entities()) {
+      const point_t image =
+        boundary::nearest_image(b.coordinates(), nb.coordinates());
+      if(distance(image, b.coordinates()) <=
+         std::max(b.radius(), nb.radius())) {
+        nbs.push_back(&nb);
+        nwrapped += image != nb.coordinates();
+      }
+    }
+    ASSERT_TRUE(nbs.size() == nbs_tree[b.id()]);
+    const double rho = b.getDensity();
+    physics::compute_density(b, nbs);
+    err = std::max(err, fabs(b.getDensity() - rho) / rho);
+  }
+  std::cout << "Max relative difference on rho: " << err << ", "
+            << nwrapped << " neighbors across the faces" << std::endl;
+  ASSERT_TRUE(err < 1.e-12);
+  ASSERT_TRUE(nwrapped > 0);
+  _periodic_boundary_x = _periodic_boundary_y = _periodic_boundary_z = false;
+  boundary::pboundary_init();
+}
+
+/**
+ * @brief The cell list gives the neighbors of the brute force search,
+ *        periodic or not, with variable smoothing length; time of the
+ *        density pass with the tree and with the cell list
+ */
+TEST(sph, cell_list) {
+  using namespace param;
+  kernels::select();
+  physics::select();
+  _box_length = _box_width = _box_height = 1.;
+  for(int periodic = 0; periodic < 2; ++periodic) {
+    _periodic_boundary_x = _periodic_boundary_y = _periodic_boundary_z =
+      periodic;
+    boundary::pboundary_init();
+    tree_topology_t t;
+    build_random_tree(t, .5);
+    t.set_period(boundary::period);
+    t.set_cell_list(true);
+    std::vector<std::vector<size_t>> nbs_cells(N);
+    t.traversal_sph([&](body & b, std::vector<body *> & nbs) {
+      for(auto nb : nbs)
+        nbs_cells[b.id()].push_back(nb->id());
+      std::sort(nbs_cells[b.id()].begin(), nbs_cells[b.id()].end());
+    });
+
+    std::vector<size_t> nbs;
+    for(auto & b : t.entities()) {
+      nbs.clear();
+      for(auto & nb : t.entities()) {
+        const point_t image =
+          boundary::nearest_image(b.coordinates(), nb.coordinates());
+        if(distance(image, b.coordinates()) <=
+           std::max(b.radius(), nb.radius()))
+          nbs.push_back(nb.id());
+      }
+      std::sort(nbs.begin(), nbs.end());
+      ASSERT_TRUE(nbs == nbs_cells[b.id()]);
+    }
+
+    double time[2];
+    for(int cells = 0; cells < 2; ++cells) {
+      t.set_cell_list(cells);
+      const double start = omp_get_wtime();
+      t.traversal_sph(physics::compute_density);
+      time[cells] = omp_get_wtime() - start;
+    }
+    std::cout << "Periodic " << periodic << " density pass: tree " << time[0]
+              << "s, cell list " << time[1] << "s" << std::endl;
+  }
+  _periodic_boundary_x = _periodic_boundary_y = _periodic_boundary_z = false;
+  boundary::pboundary_init();
+}
+
+/**
+ * @brief The fused kick-drift and kick-check-dt sweeps of the drivers give
+ *        the same positions, velocities, energies and dt as the separate
+ *        sweeps, for each energy formulation
+ */
+TEST(sph, fused_leapfrog) {
+  using namespace param;
+  using namespace integration;
+  kernels::select();
+  physics::select();
+  physics::dt = 1.e-3;
+  const bool evolve_default = evolve_internal_energy;
+  const bool thermokinetic_default = thermokinetic_formulation;
+  const bool adaptive_default = adaptive_timestep;
+  _adaptive_timestep = true;
+
+  for(int formulation = 0; formulation < 3; ++formulation) {
+    _evolve_internal_energy = formulation > 0;
+    _thermokinetic_formulation = formulation == 2;
+    tree_topology_t separate, fused;
+    for(auto * t : {&separate, &fused}) {
+      build_random_tree(*t);
+      for(auto & b : t->entities()) {
+        b.setAcceleration(point_t{uniform(), uniform(), uniform()});
+        b.setInternalenergy(1. + uniform());
+        b.setDudt(uniform());
+        b.setTotalenergy(1. + uniform());
+        b.setDedt(uniform());
+        b.setSignalspeed(1. + uniform());
+      }
+    }
+
+    auto apply = [](tree_topology_t & t, auto && f) {
+      for(auto & b : t.entities())
+        f(b);
+    };
+    auto kick_energy = [&](tree_topology_t & t) {
+      if(evolve_internal_energy) {
+        if(thermokinetic_formulation)
+          apply(t, leapfrog_kick_e);
+        else
+          apply(t, leapfrog_kick_u);
+      }
+    };
+    apply(separate, leapfrog_kick_v);
+    kick_energy(separate);
+    apply(separate, save_velocityhalf);
+    apply(separate, leapfrog_drift);
+    if(evolve_internal_energy)
+      kick_energy(separate);
+    else
+      apply(separate, leapfrog_kick_v);
+    apply(separate, physics::check_nans);
+    apply(separate, physics::check_negativity);
+    apply(separate, physics::compute_dt);
+
+    // as body_system::apply_all_parallel
+    auto & bodies = fused.entities();
+    const int64_t nelem = bodies.size();
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < nelem; ++i)
+      leapfrog_kick_drift(bodies[i]);
+#pragma omp parallel for schedule(static)
+    for(int64_t i = 0; i < nelem; ++i)
+      leapfrog_kick_check_dt(bodies[i]);
+
+    for(size_t i = 0; i < N; ++i) {
+      body & s = separate.entities()[i];
+      body & f = fused.entities()[i];
+      ASSERT_TRUE(f.coordinates() == s.coordinates());
+      ASSERT_TRUE(f.getVelocity() == s.getVelocity());
+      ASSERT_TRUE(f.getVelocityhalf() == s.getVelocityhalf());
+      ASSERT_TRUE(f.getInternalenergy() == s.getInternalenergy());
+      ASSERT_TRUE(f.getTotalenergy() == s.getTotalenergy());
+      ASSERT_TRUE(f.getDt() == s.getDt());
+    }
+  }
+  _evolve_internal_energy = evolve_default;
+  _thermokinetic_formulation = thermokinetic_default;
+  _adaptive_timestep = adaptive_default;
+}
+
+/**
+ * @brief The block timesteps divide the largest step in the steps of the
+ *        rungs: each particle ends its steps 2^rung times, the substeps only
+ *        stop at the end of some step
+ */
+TEST(sph, block_timesteps) {
+  using namespace param;
+  using namespace integration;
+  std::vector<body> bodies(N);
+  srand(42);
+  for(auto & b : bodies) {
+    // dt over all the rungs below initial_dt
+    b.setDt(initial_dt * std::pow(2., -(block_timestep_rungs - 1) * uniform()));
+    block_set_rung(b);
+  }
+  block_advance(bodies);
+
+  std::vector<int> ends(N, 0);
+  double time = 0;
+  size_t substeps = 0;
+  while(block_tick < (uint64_t(1) << (block_timestep_rungs - 1))) {
+    time += physics::dt;
+    ++substeps;
+    bool active = false;
+    for(size_t i = 0; i < N; ++i) {
+      if(block_ends(bodies[i])) {
+        ++ends[i];
+        active = true;
+      }
+    }
+    ASSERT_TRUE(active);
+    block_advance(bodies);
+  }
+  for(size_t i = 0; i < N; ++i) {
+    ASSERT_TRUE(ends[i] == 1 << bodies[i].getRung());
+    ASSERT_TRUE(block_dt(bodies[i]) <= bodies[i].getDt());
+  }
+  const size_t nsmallest = 1 << (block_timestep_rungs - 1);
+  std::cout << "Substeps: " << substeps << " for " << nsmallest
+            << " smallest steps, force evaluations: "
+            << std::accumulate(ends.begin(), ends.end(), 0) << " for "
+            << N * nsmallest << std::endl;
+  ASSERT_TRUE(fabs(time - initial_dt) < 1.e-12 * initial_dt);
+}
+
+/**
+ * @brief A particle with dt below the smallest block step does not fit in
+ *        the rungs: block_set_rung stops instead of giving it a larger step
+ */
+TEST(sph, block_timesteps_cap) {
+  using namespace param;
+  using namespace integration;
+  block_tick = block_tick_next = 0;
+  body b;
+  const double smallest = initial_dt / (1 << (block_timestep_rungs - 1));
+  b.setDt(smallest);
+  ASSERT_NO_THROW(block_set_rung(b));
+  ASSERT_TRUE(b.getRung() == block_timestep_rungs - 1);
+  b.setDt(.5 * smallest);
+  ASSERT_THROW(block_set_rung(b), std::runtime_error);
+}
+
+/**
+ * @brief A hot particle on the smallest block step crosses a row of cold
+ *        particles on the largest one: the neighbor limiter wakes the cold
+ *        particles it reaches and keeps them within block_timestep_rung_gap
+ *        rungs of it. With a constant acceleration the leapfrog is exact, for
+ *        the shortened steps as well
+ */
+TEST(sph, block_timesteps_limiter) {
+  using namespace param;
+  using namespace integration;
+  const bool thermokinetic_default = thermokinetic_formulation;
+  _thermokinetic_formulation = false;
+  block_tick = block_tick_next = 0;
+
+  const int ncold = 16;
+  const double dx = 1., h = 1.5 * dx, acc = -.5, dudt = 2.;
+  const double smallest = initial_dt / (1 << (block_timestep_rungs - 1));
+  std::vector<body> bodies(ncold + 1);
+  std::vector<point_t> x0(ncold + 1), v0(ncold + 1);
+  for(int i = 0; i <= ncold; ++i) {
+    body & b = bodies[i];
+    point_t x = {}, v = {}, a = {};
+    x[0] = i * dx;
+    a[0] = acc;
+    // the hot particle starts before the row and crosses it in the step
+    if(i == ncold) {
+      x[0] = -2. * dx;
+      v[0] = (ncold + 4.) * dx / initial_dt;
+    }
+    b.set_coordinates(x);
+    b.setVelocity(v);
+    b.setAcceleration(a);
+    b.setGAcceleration(point_t{});
+    b.setInternalenergy(1.);
+    b.setDudt(dudt);
+    b.setDt(i == ncold ? smallest : initial_dt);
+    block_set_rung(b);
+    x0[i] = x;
+    v0[i] = v;
+  }
+  block_advance(bodies);
+
+  size_t woken = 0;
+  while(block_tick < (uint64_t(1) << (block_timestep_rungs - 1))) {
+    for(auto & b : bodies)
+      if(block_starts(b)) {
+        block_kick_v(b);
+        block_kick_u(b);
+        save_velocityhalf(b);
+      }
+    for(auto & b : bodies)
+      leapfrog_drift(b);
+    for(auto & b : bodies) {
+      std::vector<body *> nbs;
+      for(auto & nb : bodies)
+        if(flecsi::distance(b.coordinates(), nb.coordinates()) < 2. * h)
+          nbs.push_back(&nb);
+      physics::passes::compute_neighbor_rung(b, nbs);
+    }
+    for(auto & b : bodies) {
+      if(block_ends(b) && block_tick_next % block_length(b) != 0)
+        ++woken;
+      block_wake(b);
+    }
+    for(auto & b : bodies)
+      if(block_ends(b)) {
+        block_kick_v(b);
+        block_kick_u(b);
+        block_set_rung(b);
+        ASSERT_TRUE(b.getRung() >=
+                    b.getNeighborRung() - block_timestep_rung_gap);
+      }
+    block_advance(bodies);
+  }
+  std::cout << "Woken cold particles: " << woken << std::endl;
+  ASSERT_TRUE(woken > 0);
+
+  for(int i = 0; i <= ncold; ++i) {
+    const body & b = bodies[i];
+    const double t = initial_dt;
+    ASSERT_NEAR(b.coordinates()[0], x0[i][0] + v0[i][0] * t + .5 * acc * t * t,
+      1.e-12 * (fabs(x0[i][0]) + 1.));
+    ASSERT_NEAR(b.getVelocity()[0], v0[i][0] + acc * t,
+      1.e-12 * (fabs(v0[i][0]) + 1.));
+    ASSERT_NEAR(b.getInternalenergy(), 1. + dudt * t, 1.e-12);
+  }
+  _thermokinetic_formulation = thermokinetic_default;
+}
+
+/**
+ * @brief After the first steps, the traversals take all their scratch data
+ *        from the arena and do not allocate from the heap; the tree build
+ *        does not need new arena blocks either
+ */
+TEST(sph, scratch_arena) {
+  using namespace param;
+  kernels::select();
+  physics::select();
+  tree_topology_t t;
+  build_random_tree(t);
+  auto step = [&]() {
+    t.traversal_sph(physics::compute_density);
+    t.traversal_sph_half_pairs(physics::compute_acceleration_pairs);
+  };
+  auto rebuild = [&]() {
+    t.clean();
+    t.build_tree(physics::compute_cofm);
+  };
+  for(int warmup = 0; warmup < 2; ++warmup) {
+    rebuild();
+    step();
+  }
+
+  const size_t arena_blocks = t.scratch_arena().heap_allocations();
+  const size_t arena_allocations = t.scratch_arena().allocations();
+  const size_t heap_start = heap_allocations;
+  step();
+  const size_t heap_step = heap_allocations - heap_start;
+  // The log lines of the traversals (two each) format their stamp on the heap
+  const size_t heap_log_start = heap_allocations;
+  for(int l = 0; l < 4; ++l)
+    log_one(trace) << "Traversal SPH.done: " << 0. << "s" << std::endl;
+  const size_t heap_log = heap_allocations - heap_log_start;
+  rebuild();
+  std::cout << "Scratch arena: " << t.scratch_arena().capacity()
+            << " bytes, high water " << t.scratch_arena().high_water()
+            << " bytes, " << t.scratch_arena().allocations() - arena_allocations
+            << " allocations in a step and a build" << std::endl;
+  std::cout << "Heap allocations in the traversals of a step: " << heap_step
+            << ", " << heap_log << " of them for the log" << std::endl;
+  ASSERT_TRUE(t.scratch_arena().heap_allocations() == arena_blocks);
+  ASSERT_TRUE(heap_step == heap_log);
+
+  // The FMM traversals, one-sided and mutual, log two lines each as well
+  auto fmm_step = [&](const bool mutual) {
+    using namespace fmm;
+    if(mutual)
+      t.traversal_fmm(.5, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p,
+        taylor_c2c_mutual, taylor_p2c_mutual, fmm_p2p_mutual);
+    else
+      t.traversal_fmm(.5, taylor_c2c, taylor_p2c, fmm_p2p, fmm_c2p);
+  };
+  for(const bool mutual : {false, true}) {
+    for(int warmup = 0; warmup < 2; ++warmup) {
+      rebuild();
+      fmm_step(mutual);
+    }
+    const size_t fmm_blocks = t.scratch_arena().heap_allocations();
+    const size_t heap_fmm_start = heap_allocations;
+    fmm_step(mutual);
+    const size_t heap_fmm = heap_allocations - heap_fmm_start;
+    std::cout << "Heap allocations in the " << (mutual ? "mutual " : "")
+              << "FMM traversal: " << heap_fmm << std::endl;
+    ASSERT_TRUE(t.scratch_arena().heap_allocations() == fmm_blocks);
+    ASSERT_TRUE(heap_fmm == heap_log / 2);
+  }
+}
+
+/**
+ * @brief Time of the tree construction and memory of the cells
+ */
+TEST(sph, tree_build) {
+  const size_t n = 1 << 19;
+  tree_topology_t t;
+  build_random_tree(t, 0., .2, n);
+  double time = DBL_MAX;
+  for(int run = 0; run < 5; ++run) {
+    t.clean();
+    const double start = omp_get_wtime();
+    t.build_tree(physics::compute_cofm);
+    time = std::min(time, omp_get_wtime() - start);
+  }
+  std::cout << "Tree of " << n << " particles: build " << time << "s, "
+            << sizeof(tree_topology_t::hcell_t) << " bytes per cell, "
+            << "hash table " << t.htable_memory() / 1.e6 << " MB" << std::endl;
+  ASSERT_TRUE(t.get_node(t.root())->sub_entities() == n);
+}